@@ -0,0 +1,439 @@
+#include <text.hpp>
+#include <foldersearch.hpp>
+#include <trigramindex.hpp>
+#include <scan.hpp>
+#include <options.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+
+// headless benchmark of the editing core, prints one json object per line:
+// {"size": <bytes>, "op": "<name>", "ops": <count>, "ns_per_op": <float>, "bytes_moved": <count>, "peak_rss_kb": <count>, "kernel": "<isa>", "backend": "gap" or "rope", "history_bytes": <undo log size>}
+
+Options options;
+
+static const size_t defaultSizes[] = {
+    1ul << 10,
+    64ul << 10,
+    1ul << 20,
+    16ul << 20,
+    256ul << 20,
+    1ul << 30,
+};
+
+struct Rng{
+    uint64_t state = 0x9E3779B97F4A7C15;
+    uint64_t next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+    size_t below(size_t n) {
+        return n ? next() % n : 0;
+    }
+};
+
+static long peakRssKb() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static void report(size_t size, const char* op, size_t ops, std::chrono::nanoseconds elapsed, size_t bytesMoved, size_t historyBytes) {
+    printf(
+        "{\"size\": %zu, \"op\": \"%s\", \"ops\": %zu, \"ns_per_op\": %.1f, \"bytes_moved\": %zu, \"peak_rss_kb\": %ld, \"kernel\": \"%s\", \"backend\": \"%s\", \"history_bytes\": %zu}\n",
+        size, op, ops, ops ? static_cast<double>(elapsed.count()) / ops : 0.0, bytesMoved, peakRssKb(), scanKernelName(), ROPE ? "rope" : "gap", historyBytes
+    );
+    fflush(stdout);
+}
+
+// source-code-ish lines with indentation, tabs and some multi byte characters
+static void generateFile(const char* path, size_t size) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "could not create %s\n", path);
+        exit(1);
+    }
+    static const char* words[] = {"int", "return", "x", "buffer", "cursor", "+=", "==", "{", "}", "(void)", "äöü", "—", "size_t", "// TODO"};
+    Rng rng;
+    std::string chunk;
+    size_t written = 0;
+    while (written < size) {
+        chunk.clear();
+        while (chunk.size() < 1 << 16) {
+            const size_t indent = rng.below(4);
+            for (size_t i = 0; i < indent; i++) {
+                chunk += rng.below(4) ? "    " : "\t";
+            }
+            const size_t numWords = rng.below(12);
+            for (size_t i = 0; i < numWords; i++) {
+                chunk += words[rng.below(std::size(words))];
+                chunk += ' ';
+            }
+            chunk += '\n';
+        }
+        const size_t n = std::min(chunk.size(), size-written);
+        fwrite(chunk.data(), n, 1, f);
+        written += n;
+    }
+    fclose(f);
+}
+
+template <typename F>
+static void measure(Text& text, size_t size, const char* op, size_t ops, F&& f) {
+    const size_t movedBefore = text.getBytesMoved();
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        f(i);
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    report(size, op, ops, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed), text.getBytesMoved()-movedBefore, text.getHistoryMemory());
+}
+
+static void benchSize(size_t size, size_t ops, const std::string& dir) {
+    const std::string path = dir + "/bench_text_input.txt";
+    const std::string savePath = dir + "/bench_text_output.txt";
+    generateFile(path.c_str(), size);
+    Rng rng;
+
+    {
+        const auto start = std::chrono::steady_clock::now();
+        Text loaded(path.c_str());
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        report(size, "construct", 1, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed), 0, 0);
+    }
+    {
+        // time to first frame: open the file and read the first screen of lines
+        const auto start = std::chrono::steady_clock::now();
+        Text opened(path.c_str());
+        const size_t end = opened.lineEnd(opened.clampLine(60));
+        volatile char sink = 0;
+        for (auto it = opened.begin(); it.pos < end; ++it) {
+            sink = sink + *it;
+        }
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        report(size, "first_screen", 1, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed), 0, 0);
+    }
+    Text text;
+    measure(text, size, "load", 1, [&](size_t) {
+        text.load(path.c_str());
+    });
+    measure(text, size, "moveTo", ops, [&](size_t) {
+        text.moveTo(rng.below(text.getFileSize()));
+    });
+    measure(text, size, "insert_char_scattered", ops, [&](size_t) {
+        text.moveTo(rng.below(text.getFileSize()));
+        text.insert('x');
+    });
+    measure(text, size, "insert_str_scattered", ops, [&](size_t) {
+        text.moveTo(rng.below(text.getFileSize()));
+        text.insert("inserted words\n");
+    });
+    {
+        // one large paste and one large deletion, their cost should grow linearly with the payload
+        std::string payload;
+        while (payload.size() < std::min<size_t>(size, 16 << 20)) {
+            payload += "pasted line\n";
+        }
+        text.moveTo(text.getFileSize()/2);
+        measure(text, size, "paste", 1, [&](size_t) {
+            text.insert(payload.data(), payload.size());
+        });
+        measure(text, size, "erase_range", 1, [&](size_t) {
+            text.erase(text.getFileSize()/4, text.getFileSize()/4 + payload.size());
+        });
+        // takes back the erase and the paste and does them again
+        measure(text, size, "undo", 2, [&](size_t) {
+            text.undo();
+        });
+        measure(text, size, "redo", 2, [&](size_t) {
+            text.redo();
+        });
+    }
+    measure(text, size, "replace_scattered", ops, [&](size_t) {
+        const size_t from = rng.below(text.getFileSize());
+        text.replace(from, from+8, "replaced", 8);
+    });
+    text.moveTo(text.getFileSize()/2);
+    measure(text, size, "insert_char_local", ops, [&](size_t) {
+        text.insert('y');
+    });
+    // a line of typing with a typo fixed every few characters, coalesced into one undo record per line
+    measure(text, size, "typing", ops*16, [&](size_t i) {
+        if (i % 64 == 63) {
+            text.insert('\n');
+        } else if (i % 8 == 7) {
+            text.backspace();
+        } else {
+            text.insert("t");
+        }
+    });
+    measure(text, size, "left_word", ops, [&](size_t) {
+        text.left(true);
+    });
+    measure(text, size, "right_word", ops, [&](size_t) {
+        text.right(true);
+    });
+    measure(text, size, "backspace", ops, [&](size_t) {
+        text.backspace();
+    });
+    measure(text, size, "del", ops, [&](size_t) {
+        text.del();
+    });
+    measure(text, size, "backspace_scattered", ops, [&](size_t) {
+        text.moveTo(1+rng.below(text.getFileSize()-1));
+        text.backspace();
+    });
+    measure(text, size, "beginning_ending", ops, [&](size_t) {
+        text.beginning();
+        text.ending();
+    });
+    text.moveTo(text.getFileSize()/2);
+    measure(text, size, "up", ops, [&](size_t) {
+        text.up(-1);
+    });
+    measure(text, size, "down", ops, [&](size_t) {
+        text.down(-1);
+    });
+    {
+        // a minified file, the arrow keys go between two lines that are megabytes long
+        const size_t lineLength = std::min<size_t>(size/2, 16 << 20);
+        std::string lines;
+        lines.reserve(2*lineLength+1);
+        while (lines.size() < 2*lineLength) {
+            lines += lines.size() == lineLength ? "\n" : rng.below(8) ? "x" : rng.below(2) ? "\t" : "ä";
+        }
+        Text minified;
+        minified.insert(lines.data(), lines.size());
+        minified.beginning();
+        const size_t column = minified.columnOf(minified.lineEnd(0)) * 9 / 10;
+        measure(minified, size, "up_down_long_line", ops, [&](size_t i) {
+            i % 2 ? minified.up(column) : minified.down(column);
+        });
+    }
+    {
+        // a word that is on almost every line, a rare phrase with the byte filter and one long enough for Horspool
+        volatile size_t matches = 0;
+        measure(text, size, "find_all", 1, [&](size_t) {
+            matches = matches + text.findAll("buffer").size();
+        });
+        measure(text, size, "find_all_rare", 1, [&](size_t) {
+            matches = matches + text.findAll("cursor += size_t").size();
+        });
+        measure(text, size, "find_all_long", 1, [&](size_t) {
+            matches = matches + text.findAll("return buffer cursor += size_t (void) int x").size();
+        });
+        // an alternation that the lazy DFA has to try at every byte and an anchored one that fails early on most lines
+        const Regex alternation("(buffer|cursor) \\+= [a-z_]+");
+        measure(text, size, "regex_find_all", 1, [&](size_t) {
+            matches = matches + text.findAll(alternation).size();
+        });
+        const Regex anchored("^\\s*return x");
+        measure(text, size, "regex_find_all_anchored", 1, [&](size_t) {
+            matches = matches + text.findAll(anchored).size();
+        });
+        // find-as-you-type, every key after the first one only checks the matches so far
+        std::vector<size_t> typed;
+        const std::string query = "buffer {";
+        measure(text, size, "find_typing", query.size(), [&](size_t i) {
+            if (!i) {
+                typed = text.findAll(query.substr(0, 1));
+            } else {
+                text.refine(typed, query.substr(0, i+1));
+            }
+        });
+    }
+    {
+        // 10000 cursors spread over the file, every key is one pass over all of them
+        std::vector<size_t> cursors;
+        const size_t lines = text.getLineCount();
+        for (size_t i = 0; i < std::min<size_t>(lines, 10000); i++) {
+            cursors.push_back(text.lineStart(i*lines / std::min<size_t>(lines, 10000)));
+        }
+        cursors.erase(std::unique(cursors.begin(), cursors.end()), cursors.end());
+        measure(text, size, "multi_cursor_typing", ops, [&](size_t i) {
+            if (i % 4 == 3) {
+                text.backspace(cursors);
+            } else {
+                text.insert(cursors, "m", 1);
+            }
+        });
+    }
+    {
+        // what LCTRL + C does with half of the file selected, the spans are copied once and the gap stays
+        const size_t from = text.getFileSize()/4;
+        const size_t to = from + text.getFileSize()/2;
+        auto clipboard = std::make_unique_for_overwrite<char[]>(to-from);
+        measure(text, size, "copy_selection", 1, [&](size_t) {
+            char* out = clipboard.get();
+            for (const std::string_view span : text.spans(from, to)) {
+                memcpy(out, span.data(), span.size());
+                out += span.size();
+            }
+        });
+    }
+    {
+        // the first look at the middle of a highlighted file lexes everything in front of it, after that every
+        // key looks up the lines of a screen around the cursor like a frame does. Opening a comment is the
+        // worst case, everything behind it changes, but only the screen is lexed again.
+        const size_t middle = text.getLineCount()/2;
+        const size_t screen = 60;
+        text.setLanguage(Highlighter::CPP);
+        measure(text, size, "highlight_first_view", 1, [&](size_t) {
+            for (size_t line = middle; line < middle+screen; line++) {
+                text.tokens(text.clampLine(line));
+            }
+        });
+        text.moveTo(text.lineStart(text.clampLine(middle+screen/2)));
+        measure(text, size, "highlight_typing", ops, [&](size_t i) {
+            switch (i % 4) {
+                case 0: text.insert("/*", 2); break;
+                case 3: text.insert('x'); break;
+                default: text.backspace(); break;
+            }
+            for (size_t line = middle; line < middle+screen; line++) {
+                text.tokens(text.clampLine(line));
+            }
+        });
+        text.setLanguage(Highlighter::PLAIN);
+    }
+    measure(text, size, "line_lookup", ops, [&](size_t) {
+        const size_t line = text.lineOf(rng.below(text.getFileSize()));
+        text.lineEnd(line);
+    });
+    measure(text, size, "save", 1, [&](size_t) {
+        text.save(savePath.c_str());
+    });
+    {
+        // typing while the file is written in the background, should cost the same as insert_char_local
+        std::atomic<bool> saved = false;
+        // bring the gap to the cursor first, moving it isn't what is measured here
+        text.insert('s');
+        text.saveInBackground(savePath.c_str(), [&](int) {
+            saved = true;
+        });
+        measure(text, size, "insert_while_saving", ops, [&](size_t) {
+            text.insert('s');
+        });
+        while (!saved) {
+            std::this_thread::yield();
+        }
+    }
+    {
+        // a tab going to the background and coming back, the way back should take less than a frame
+        Compressed compressed;
+        measure(text, size, "compress_tab", 1, [&](size_t) {
+            const auto spans = text.spans(0, text.getFileSize());
+            compressed = Compressed(std::vector<std::string_view>(spans.begin(), spans.end()));
+        });
+        text.store(std::move(compressed));
+        measure(text, size, "decompress_tab", 1, [&](size_t) {
+            text.decompress();
+        });
+    }
+    remove(path.c_str());
+    remove(savePath.c_str());
+}
+
+// find in folder over an existing tree, size is the bytes of the files that were searched.
+// The same through a trigram index in dir, built from nothing and updated with nothing changed.
+static void benchFolder(const std::string& folder, const std::string& dir) {
+    const struct{
+        const char* op;
+        const char* query;
+        bool regex;
+    } queries[] = {
+        {"find_in_folder", "return", false},
+        {"find_in_folder_rare", "XYZZY_not_there", false},
+        {"regex_find_in_folder", "int [a-z_]+\\(", true},
+    };
+    auto run = [](FolderSearch& search) {
+        while (!search.isDone()) {
+            search.take();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    };
+    for (const auto& query : queries) {
+        const auto start = std::chrono::steady_clock::now();
+        FolderSearch search(folder, query.query, query.regex, [] {});
+        run(search);
+        report(search.getByteCount(), query.op, 1, std::chrono::steady_clock::now()-start, 0, 0);
+    }
+    const std::string path = dir + "/bench_folder.trigrams";
+    remove(path.c_str());
+    const std::atomic<bool> stop = false;
+    for (const char* op : {"index_folder", "update_index"}) {
+        const auto start = std::chrono::steady_clock::now();
+        if (!TrigramIndex::update(folder, path, stop)) {
+            fprintf(stderr, "can't write %s\n", path.c_str());
+            return;
+        }
+        report(0, op, 1, std::chrono::steady_clock::now()-start, 0, 0);
+    }
+    const TrigramIndex index(path);
+    for (const auto& query : queries) {
+        const auto start = std::chrono::steady_clock::now();
+        const std::vector<bool> candidates = index.candidates(query.query, query.regex);
+        FolderSearch search(folder, [&](const std::string& file, const struct stat& st) {
+            return index.skips(candidates, file, st);
+        }, query.query, query.regex, [] {});
+        run(search);
+        report(search.getByteCount(), (std::string("indexed_") + query.op).c_str(), 1, std::chrono::steady_clock::now()-start, 0, 0);
+    }
+    remove(path.c_str());
+}
+
+static size_t parseSize(const char* str) {
+    char* end;
+    size_t size = strtoull(str, &end, 10);
+    switch (*end) {
+        case 'G': case 'g': size <<= 10; [[fallthrough]];
+        case 'M': case 'm': size <<= 10; [[fallthrough]];
+        case 'K': case 'k': size <<= 10; break;
+        default: break;
+    }
+    return size;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<size_t> sizes(std::begin(defaultSizes), std::end(defaultSizes));
+    size_t ops = 256;
+    std::string dir = "/tmp";
+    std::string folder;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--sizes") && i+1 < argc) {
+            // comma separated list like 1K,4M,1G
+            sizes.clear();
+            for (char* size = strtok(argv[++i], ","); size; size = strtok(nullptr, ",")) {
+                sizes.push_back(parseSize(size));
+            }
+        } else if (!strcmp(argv[i], "--ops") && i+1 < argc) {
+            ops = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--dir") && i+1 < argc) {
+            dir = argv[++i];
+        } else if (!strcmp(argv[i], "--folder") && i+1 < argc) {
+            // searches the files below it instead
+            folder = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--sizes 1K,1M,1G] [--ops N] [--dir DIR] [--folder DIR]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (!folder.empty()) {
+        benchFolder(folder, dir);
+        return 0;
+    }
+    for (const size_t size : sizes) {
+        benchSize(size, ops, dir);
+    }
+    return 0;
+}
@@ -1,3 +1,5 @@
 extern struct Options{
     bool underscore_is_word_break : 1 = false;
+    // find in folder goes through a trigram index that is kept in the cache directory
+    bool index_folder : 1 = false;
 } options;
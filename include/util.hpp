@@ -4,6 +4,9 @@
 #include <chrono>
 #include <cstring>
 #include <cassert>
+#include <cstdio>
+#include <new>
+#include <utility>
 
 // #ifdef DEBUG
 #ifdef SDL_CHK
@@ -15,27 +18,40 @@
 
 #define UNUSED(x) (void)(x)
 
-template <class Resolution = std::chrono::duration<float, std::milli>>
+// what a Timer does when it dies, prints its name and how long it lived
+struct PrintDuration{
+    template <class TimePoint, class Rep>
+    void operator()(const char* name, TimePoint start, TimePoint end, Rep elapsed) {
+        UNUSED(start);
+        UNUSED(end);
+        printf("%s: %f\n", name, elapsed);
+    }
+};
+
+template <class Resolution = std::chrono::duration<float, std::milli>, class Report = PrintDuration>
 requires requires(Resolution r) {
     {std::chrono::duration{r}} -> std::same_as<Resolution>;
 }
 struct Timer{
     const char* name = nullptr;
     const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    [[no_unique_address]] Report report{};
     using resolution = Resolution;
     Timer() = default;
     explicit Timer(const char* name) : name(name) {}
-    ~Timer() {
-        const auto end = std::chrono::high_resolution_clock::now();
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+    // the time since start in Resolution
+    Resolution::rep elapsed(std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now()) const {
         const auto delta = end-start;
-        printf(
-            "%s: %f\n",
-            name,
-            delta.count()
+        return delta.count()
             * std::chrono::high_resolution_clock::period::num * static_cast<Resolution::rep>(Resolution::period::den)
             / std::chrono::high_resolution_clock::period::den
-            / Resolution::period::num
-        );
+            / Resolution::period::num;
+    }
+    ~Timer() {
+        const auto end = std::chrono::high_resolution_clock::now();
+        report(name, start, end, elapsed(end));
     }
 };
 
@@ -52,20 +68,32 @@ struct List{
     size_t capacity = 0;
     size_t push(T&& moveFrom) {
         if (size == capacity) {
-            capacity = capacity * 2 + 1;
-            items = (T*) realloc(items, capacity*sizeof(T));
-            // std::memset(items+size, 0, sizeof(T)*(capacity-size));
+            // no realloc, items may point into themselves like a std::string does
+            const size_t grown = capacity * 2 + 1;
+            T* moved = (T*) malloc(grown*sizeof(T));
+            assert(moved);
+            for (size_t i = 0; i < size; i++) {
+                new(&moved[i]) T(std::move(items[i]));
+                items[i].~T();
+            }
+            free(items);
+            items = moved;
+            capacity = grown;
         }
-        new(&items[size]) T();
-        items[size] = std::move(moveFrom);
+        new(&items[size]) T(std::move(moveFrom));
         return size++;
     }
-    T&& pop() {
+    T pop() {
         assert(size);
         size--;
-        return std::move(items[size]);
+        T last(std::move(items[size]));
+        items[size].~T();
+        return last;
     }
     void clear() {
+        for (size_t i = 0; i < size; i++) {
+            items[i].~T();
+        }
         free(items);
         items = nullptr;
         size = 0;
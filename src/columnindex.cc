@@ -0,0 +1,108 @@
+#include "columnindex.hpp"
+
+ColumnIndex::Line& ColumnIndex::find(size_t start) {
+    clock++;
+    for (Line& line : lines) {
+        if (line.start == start) {
+            line.used = clock;
+            return line;
+        }
+    }
+    if (lines.size() < maxLines) {
+        lines.emplace_back();
+    }
+    Line& line = *std::min_element(lines.begin(), lines.end(), [](const Line& a, const Line& b) {
+        return a.used < b.used;
+    });
+    line.start = start;
+    line.ends.clear();
+    line.columns.clear();
+    line.used = clock;
+    return line;
+}
+
+size_t ColumnIndex::covered(const Line& line) {
+    return line.ends.empty() ? 0 : line.ends.back();
+}
+
+void ColumnIndex::truncate(Line& line, size_t index) {
+    line.ends.resize(index);
+    line.columns.resize(index);
+}
+
+void ColumnIndex::inserted(size_t pos, size_t len, size_t columns, bool newLine) {
+    for (Line& line : lines) {
+        if (pos < line.start || (pos == line.start && newLine)) {
+            // the bytes the sums are about didn't change, they only moved
+            line.start += len;
+            continue;
+        }
+        const size_t offset = pos-line.start;
+        if (offset > covered(line) || line.ends.empty()) {
+            continue;
+        }
+        if (newLine) {
+            // the line was split, everything behind the new '\n' belongs to another line
+            truncate(line, std::upper_bound(line.ends.begin(), line.ends.end(), offset) - line.ends.begin());
+            continue;
+        }
+        // a boundary at offset stays in front of the new bytes, they go into the chunk ending there
+        const size_t chunk = std::lower_bound(line.ends.begin(), line.ends.end(), offset) - line.ends.begin();
+        for (size_t i = chunk; i < line.ends.size(); i++) {
+            line.ends[i] += len;
+            line.columns[i] += columns;
+        }
+        if (line.ends[chunk] - (chunk ? line.ends[chunk-1] : 0) > maxChunkSize) {
+            truncate(line, chunk);
+        }
+    }
+}
+
+bool ColumnIndex::counts(size_t pos, size_t len) const {
+    for (const Line& line : lines) {
+        if (pos >= line.start && pos+len <= line.start+covered(line)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ColumnIndex::erased(size_t pos, size_t len, size_t columns) {
+    for (Line& line : lines) {
+        if (pos+len <= line.start) {
+            line.start -= len;
+            continue;
+        }
+        if (pos < line.start) {
+            // the front of the counted bytes is gone
+            truncate(line, 0);
+            continue;
+        }
+        const size_t offset = pos-line.start;
+        if (offset >= covered(line)) {
+            continue;
+        }
+        if (offset+len > covered(line)) {
+            // only the chunks in front of the erased range still hold
+            truncate(line, std::upper_bound(line.ends.begin(), line.ends.end(), offset) - line.ends.begin());
+            continue;
+        }
+        // the chunks from the one containing pos to the one containing the erased range's end become one
+        const size_t first = std::upper_bound(line.ends.begin(), line.ends.end(), offset) - line.ends.begin();
+        const size_t last = std::lower_bound(line.ends.begin(), line.ends.end(), offset+len) - line.ends.begin();
+        line.ends.erase(line.ends.begin()+first, line.ends.begin()+last);
+        line.columns.erase(line.columns.begin()+first, line.columns.begin()+last);
+        for (size_t i = first; i < line.ends.size(); i++) {
+            line.ends[i] -= len;
+            line.columns[i] -= columns;
+        }
+        if (line.ends[first] - (first ? line.ends[first-1] : 0) > maxChunkSize) {
+            truncate(line, first);
+        }
+    }
+}
+
+void ColumnIndex::clear() {
+    lines.clear();
+    clock = 0;
+}
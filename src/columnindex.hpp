@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Display columns of the few long lines that were looked at last, so converting between a column
+// and a position doesn't walk megabytes of a minified file on every arrow key.
+// A line is cut into chunks of about chunkSize bytes and the bytes and columns up to the end of each
+// chunk are kept as prefix sums. A lookup binary searches them and leaves at most one chunk to be
+// scanned, an edit adjusts the sums behind it. Short lines are not cached, scanning them is cheaper.
+class ColumnIndex{
+    public:
+    static constexpr size_t chunkSize = 4096;
+    static constexpr size_t minLineLength = 4*chunkSize;
+    // a chunk that grew this large by typing into it is counted again
+    static constexpr size_t maxChunkSize = 4*chunkSize;
+    static constexpr size_t maxLines = 8;
+    // a position and the columns between the start of its line and it
+    struct Point{
+        size_t pos;
+        size_t columns;
+    };
+    // the last chunk boundary at or in front of pos in the line [start, end),
+    // columnsIn(from, to) counts the columns of chunks that weren't counted yet
+    template <typename F>
+    Point beforePos(size_t start, size_t end, size_t pos, F&& columnsIn) {
+        if (end-start < minLineLength) {
+            return {start, 0};
+        }
+        Line& line = find(start);
+        extend(line, end, columnsIn, [&] {
+            return line.ends.back() >= pos-start;
+        });
+        const size_t i = std::upper_bound(line.ends.begin(), line.ends.end(), pos-start) - line.ends.begin();
+        return i ? Point{start+line.ends[i-1], line.columns[i-1]} : Point{start, 0};
+    }
+    // the last chunk boundary in the line [start, end) with less than column columns in front of it
+    template <typename F>
+    Point beforeColumn(size_t start, size_t end, size_t column, F&& columnsIn) {
+        if (end-start < minLineLength) {
+            return {start, 0};
+        }
+        Line& line = find(start);
+        extend(line, end, columnsIn, [&] {
+            return line.columns.back() >= column;
+        });
+        const size_t i = std::lower_bound(line.columns.begin(), line.columns.end(), column) - line.columns.begin();
+        return i ? Point{start+line.ends[i-1], line.columns[i-1]} : Point{start, 0};
+    }
+    // len bytes that take up columns were inserted at pos, newLine if there was a '\n' among them
+    void inserted(size_t pos, size_t len, size_t columns, bool newLine);
+    // erased() has to be told the columns of [pos, pos+len) only if this is true
+    bool counts(size_t pos, size_t len) const;
+    // [pos, pos+len) was removed, columns only matters if counts(pos, len)
+    void erased(size_t pos, size_t len, size_t columns);
+    void clear();
+    private:
+    struct Line{
+        size_t start = 0;
+        // prefix sums relative to start, [start, start+ends.back()) never contains a '\n'
+        std::vector<size_t> ends;
+        std::vector<size_t> columns;
+        uint64_t used = 0;
+    };
+    // the cached sums of the bytes behind start, the least recently used line makes room for it
+    Line& find(size_t start);
+    static size_t covered(const Line& line);
+    // drops the chunks from the index-th on
+    static void truncate(Line& line, size_t index);
+    template <typename F, typename Done>
+    static void extend(Line& line, size_t end, F&& columnsIn, Done&& done) {
+        size_t pos = line.start+covered(line);
+        while (pos < end && (line.ends.empty() || !done())) {
+            const size_t to = std::min(end, pos+chunkSize);
+            line.columns.push_back((line.columns.empty() ? 0 : line.columns.back()) + columnsIn(pos, to));
+            line.ends.push_back(to-line.start);
+            pos = to;
+        }
+    }
+    std::vector<Line> lines;
+    uint64_t clock = 0;
+};
@@ -0,0 +1,62 @@
+#include "compressed.hpp"
+#include "search.hpp"
+#include <algorithm>
+#include <atomic>
+#include <zlib.h>
+
+Compressed::Compressed(const std::vector<std::string_view>& pieces) {
+    // where every piece starts in the whole
+    std::vector<size_t> starts;
+    for (const std::string_view piece : pieces) {
+        starts.push_back(total);
+        total += piece.size();
+    }
+    chunks.resize((total+chunkSize-1) / chunkSize);
+    forEachChunk(chunks.size(), [&](size_t chunk) {
+        const size_t from = chunk*chunkSize;
+        const size_t to = std::min(total, from+chunkSize);
+        z_stream stream{};
+        // logs and sources shrink to a fraction at the fastest level already
+        deflateInit(&stream, Z_BEST_SPEED);
+        std::vector<uint8_t>& out = chunks[chunk];
+        out.resize(deflateBound(&stream, to-from));
+        stream.next_out = out.data();
+        stream.avail_out = out.size();
+        size_t piece = std::upper_bound(starts.begin(), starts.end(), from) - starts.begin() - 1;
+        for (size_t pos = from; pos < to; piece++) {
+            const size_t offset = pos-starts[piece];
+            const size_t len = std::min(pieces[piece].size()-offset, to-pos);
+            stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(pieces[piece].data()+offset));
+            stream.avail_in = len;
+            pos += len;
+            deflate(&stream, pos == to ? Z_FINISH : Z_NO_FLUSH);
+        }
+        out.resize(stream.total_out);
+        out.shrink_to_fit();
+        deflateEnd(&stream);
+    });
+}
+
+size_t Compressed::memory() const {
+    size_t bytes = 0;
+    for (const auto& chunk : chunks) {
+        bytes += chunk.capacity();
+    }
+    return bytes;
+}
+
+bool Compressed::inflate(char* out) const {
+    std::atomic<bool> damaged = false;
+    forEachChunk(chunks.size(), [&](size_t chunk) {
+        const size_t from = chunk*chunkSize;
+        const size_t len = std::min(total-from, chunkSize);
+        uLongf inflated = len;
+        const int result = uncompress(
+            reinterpret_cast<Bytef*>(out+from), &inflated, chunks[chunk].data(), chunks[chunk].size()
+        );
+        if (result != Z_OK || inflated != len) {
+            damaged = true;
+        }
+    });
+    return !damaged;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Bytes deflated in chunks of chunkSize that don't depend on each other, so both ways run on all cores.
+// Background tabs keep their content like this, see Text::store().
+class Compressed{
+    public:
+    static constexpr size_t chunkSize = 1 << 20;
+    Compressed() = default;
+    // the pieces one after the other
+    explicit Compressed(const std::vector<std::string_view>& pieces);
+    // bytes before compressing
+    size_t size() const {
+        return total;
+    }
+    // bytes it holds
+    size_t memory() const;
+    bool empty() const {
+        return chunks.empty();
+    }
+    // writes the size() bytes to out, false if the chunks are damaged
+    bool inflate(char* out) const;
+    private:
+    std::vector<std::vector<uint8_t>> chunks{};
+    size_t total = 0;
+};
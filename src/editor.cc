@@ -4,213 +4,583 @@
 #include "SDL3/SDL_keyboard.h"
 #include "SDL3_ttf/SDL_ttf.h"
 #include "logging.hpp"
+#include "profiler.hpp"
 #include "util.hpp"
+#include "workerpool.hpp"
+#include <options.hpp>
 #include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define S64SIGN_BIT (~(static_cast<size_t>(-1) >> 1))
 
-SDL_FPoint drawLine(const char* buffer, int len, const SDL_FRect& into, TTF_Font* font, SDL_Renderer* renderer) {
-    if (!len) {
-        return {0, (float)TTF_GetFontHeight(font)};
-    }
-    if (len == -1) {
-        len = 0;
-    }
-    SDL_Surface* renderedStrip = TTF_RenderText_Blended(font, buffer, len, SDL_Color{255, 255, 255, 255});
-    SDL_CHK(!!renderedStrip);
-    // SDL_CHK(SDL_GetSurfaceClipRect(renderedStrip, &srcrect));
-    // if (srcrect.w > into.w) {
-    //     srcrect.w = into.w;
-    // }
-    // if (srcrect.h > into.h) {
-    //     srcrect.h = into.h;
-    // }
-    // SDL_CHK(SDL_SetSurfaceClipRect(renderedStrip, &srcrect));
-    auto stripTexture = SDL_CreateTextureFromSurface(renderer, renderedStrip);
-    SDL_CHK(!!stripTexture);
-    float width, height;
-    SDL_CHK(SDL_GetTextureSize(stripTexture, &width, &height));
-    SDL_FRect srcrect = {0, 0, width, height};
-    SDL_FRect dstrect{into.x, into.y, srcrect.w, srcrect.h};
-    SDL_CHK(SDL_RenderTexture(renderer, stripTexture, &srcrect, &dstrect));
-    SDL_DestroySurface(renderedStrip);
-    SDL_DestroyTexture(stripTexture);
-    return {srcrect.w, srcrect.h};
-}
-
-void drawCursor(const SDL_FRect& into, SDL_Renderer* renderer, TTF_Font* font) {
-    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-    SDL_FRect cursor = {into.x, into.y, 2, static_cast<float>(TTF_GetFontHeight(font))};
-    SDL_RenderFillRect(renderer, &cursor);
-}
-
-static void renderText(SDL_Renderer* renderer, TTF_Font* font, SDL_FRect& into, Text& text, ssize_t startLine, const std::vector<ssize_t>& newLines) {
-    static char buffer[16];
+static constexpr SDL_FColor textColor{1, 1, 1, 1};
+static constexpr SDL_FColor selectionColor{0.2, 0.3, 0.5, 1};
+// by Highlighter::Kind
+static constexpr SDL_FColor tokenColors[] = {
+    textColor,
+    {0.8, 0.5, 0.9, 1},
+    {0.4, 0.8, 0.9, 1},
+    {0.9, 0.7, 0.4, 1},
+    {0.6, 0.85, 0.5, 1},
+    {0.5, 0.5, 0.5, 1},
+    {0.9, 0.5, 0.5, 1},
+};
+
+static constexpr float lineNumberWidth = 5*20+10;
+// how far a notch of the wheel scrolls sideways
+static constexpr ssize_t columnsPerNotch = 4;
+
+// draws the lines from startLine on that fit into into, each from startColumn up to the right edge of into.
+// The column and line indexes find both ends, what is left and right of into costs nothing however long the line is.
+static void renderText(
+    GlyphAtlas& atlas, SDL_Renderer* renderer, TTF_Font* font, SDL_FRect& into, const Text& text, ssize_t startLine,
+    size_t startColumn, const std::vector<size_t>& carets, std::pair<size_t, size_t> selection
+) {
     assert(startLine >= 0);
-    char lineNumber[5]{};
-    int lineNumberSize = SDL_snprintf(lineNumber, 5, "%zu", (startLine+1) % 100'000);
-    std::memmove(lineNumber+5-lineNumberSize, lineNumber, lineNumberSize);
-    std::memset(lineNumber, 0, 5-lineNumberSize);
-    auto it = text.begin()+(startLine > 0 ? newLines[startLine-1]+1 : 0);
-    // const ssize_t startOfThisLine = (it == text.begin()) ? 0 : *it +1;
-    size_t drawnChars = 0;
-    int i = 0;
-    SDL_FPoint orig{into.x, into.w};
-    const auto lineNumberWidth = 5*20+10;
-    drawLine(lineNumber+5-lineNumberSize, lineNumberSize, into, font, renderer);
-    into.x += lineNumberWidth;
-    into.w -= lineNumberWidth;
+    const float fontHeight = TTF_GetFontHeight(font);
+    const float spaceWidth = atlas.advance(renderer, font, ' ');
+    const float right = into.x+into.w;
+    char lineNumber[8];
+    size_t line = startLine;
+    auto it = text.begin()+text.lineStart(startLine);
+    const auto end = text.end();
+    auto caret = std::lower_bound(carets.begin(), carets.end(), it.pos);
     while (into.h > 0) {
-        if (it.cursorPos == it.pos) {
-            SDL_FPoint drawn = drawLine(buffer, i, into, font, renderer);
-            into.x += drawn.x;
-            into.w -= drawn.x;
-            i = 0;
-            drawCursor(into, renderer, font);
-        }
-        if (it == text.end()) {
-            drawLine(buffer, i, into, font, renderer);
-            return;
+        Zone zone("drawLine");
+        const int lineNumberSize = SDL_snprintf(lineNumber, sizeof(lineNumber), "%zu", (line+1) % 100'000);
+        atlas.draw(renderer, font, lineNumber, lineNumberSize, into.x, into.y, textColor);
+        float x = into.x + lineNumberWidth;
+        size_t drawnChars = 0;
+        // only looked up, the lines were lexed when they were edited or first drawn
+        const auto& tokens = text.tokens(line);
+        auto token = tokens.begin();
+        const size_t lineStart = it.pos;
+        // the line ends left of into
+        bool hidden = false;
+        if (startColumn) {
+            const size_t first = text.posAtColumn(line, startColumn);
+            drawnChars = text.columnOf(first);
+            hidden = drawnChars < startColumn;
+            x += (static_cast<float>(drawnChars)-startColumn)*spaceWidth;
+            it = text.begin()+first;
+            token = std::upper_bound(tokens.begin(), tokens.end(), first-lineStart, [](size_t offset, const auto& next) {
+                return offset < next.start;
+            });
+            if (token != tokens.begin()) {
+                --token;
+            }
         }
-        if (*it == '\n') {
-            SDL_FPoint drawn = drawLine(buffer, i, into, font, renderer);
-            ++it;
-            into.y += drawn.y;
-            into.h -= drawn.y;
-            into.x = orig.x;
-            into.w = orig.y;
-            i = 0;
-            drawnChars = 0;
-            for (int j = 4; j >= 0; j--) {
-                lineNumber[j]++;
-                if (lineNumber[j] == 1) {
-                    lineNumber[j] = '1';
-                    lineNumberSize++;
-                    assert(static_cast<size_t>(lineNumberSize) <= SDL_arraysize(lineNumber));
-                    break;
+        while (true) {
+            while (caret != carets.end() && *caret < it.pos) {
+                ++caret;
+            }
+            if (!hidden && (it.cursorPos == it.pos || (caret != carets.end() && *caret == it.pos))) {
+                atlas.fill(renderer, {x, into.y, 2, fontHeight}, textColor);
+            }
+            if (it == end) {
+                return;
+            }
+            if (x >= right && *it != '\n') {
+                // the rest of the line is right of into
+                it = text.begin()+text.lineEnd(line);
+                hidden = true;
+                continue;
+            }
+            const bool selected = selection.first <= it.pos && it.pos < selection.second;
+            if (*it == '\n') {
+                if (selected && !hidden) {
+                    atlas.fill(renderer, {x, into.y, spaceWidth, fontHeight}, selectionColor);
                 }
-                if (lineNumber[j] > '9') {
-                    lineNumber[j] = '0';
-                } else {
-                    break;
+                ++it;
+                break;
+            }
+            if (*it == '\t') {
+                const size_t spaces = 4-(drawnChars%4);
+                if (selected) {
+                    atlas.fill(renderer, {x, into.y, spaces*spaceWidth, fontHeight}, selectionColor);
                 }
+                x += spaces*spaceWidth;
+                drawnChars += spaces;
+                ++it;
+                continue;
             }
-            drawLine(lineNumber+5-lineNumberSize, lineNumberSize, into, font, renderer);
-            // printf(
-            //     "lineNumber: %02x %02x %02x %02x %02x\n"
-            //     "lineNumberSize: %d\n",
-            //     lineNumber[0],
-            //     lineNumber[1],
-            //     lineNumber[2],
-            //     lineNumber[3],
-            //     lineNumber[4],
-            //     lineNumberSize
-            // );
-            into.x += lineNumberWidth;
-            into.w -= lineNumberWidth;
-            continue;
-        }
-        if (*it == '\t') {
-            SDL_FPoint drawn = drawLine(buffer, i, into, font, renderer);
-            into.x += drawn.x;
-            into.w -= drawn.x;
-            i = 0;
-            *(uint32_t*)buffer = 0x01010101 * ' '; // 4 spaces
-            // contact me if you know how to convert 0b100 to 0x01010101 efficiently
-            drawn = drawLine(buffer, 4-(drawnChars%4), into, font, renderer);
-            drawnChars += 4-(drawnChars%4);
-            into.x += drawn.x;
-            into.w -= drawn.x;
-            ++it;
-            continue;
-        }
-        bool closeToEndAndIteratorDoesNotPointIntoAUTF8Byte = i > static_cast<int>(SDL_arraysize(buffer)-4) && ((*it & 0xC0) != 0x80);
-        if (closeToEndAndIteratorDoesNotPointIntoAUTF8Byte || i == SDL_arraysize(buffer)) {
-            SDL_FPoint drawn = drawLine(buffer, i, into, font, renderer);
-            into.x += drawn.x;
-            into.w -= drawn.x;
-            i = 0;
-        }
-        buffer[i++] = *it;
-        if (*it & 0x80) {
-            drawnChars += static_cast<bool>(*it & 0x40);
-        } else {
+            const size_t offset = it.pos-lineStart;
+            while (token+1 < tokens.end() && (token+1)->start <= offset) {
+                ++token;
+            }
+            const SDL_FColor color = token < tokens.end() ? tokenColors[token->kind] : textColor;
+            // one utf8 character is at most 4 bytes
+            char utf8[4];
+            size_t len = 0;
+            do {
+                utf8[len++] = *it;
+                ++it;
+            } while (len < 4 && it != end && (*it & 0xC0) == 0x80);
+            const char* decode = utf8;
+            const Uint32 codepoint = SDL_StepUTF8(&decode, &len);
+            if (selected) {
+                // behind the glyph, the quads are drawn in the order they were queued
+                atlas.fill(renderer, {x, into.y, atlas.advance(renderer, font, codepoint), fontHeight}, selectionColor);
+            }
+            x += atlas.draw(renderer, font, codepoint, x, into.y, color);
             drawnChars++;
         }
-        ++it;
+        into.y += fontHeight;
+        into.h -= fontHeight;
+        line++;
     }
 }
 
 void Editor::render(SDL_Renderer* renderer, SDL_FRect into) const {
-    SDL_SetRenderDrawColor(renderer, 20, 20, 20, 255);
-    SDL_RenderFillRect(renderer, &into);
+    if (!dirty) {
+        return;
+    }
+    Zone zone("Editor::render");
+    frames++;
     SDL_FRect canvas{into.x+30, into.y+10, into.w-50, into.h-20};
-    if (currentFile.index < files.size) {
-        const char* filename = filenames[currentFile.index].c_str();
-        if (!*filename) {
+    SDL_SetRenderDrawColor(renderer, 20, 20, 20, 255);
+    if (currentFile.index >= files.size) {
+        SDL_RenderFillRect(renderer, &into);
+        dirty = 0;
+        return;
+    }
+    const float fontHeight = TTF_GetFontHeight(font);
+    const SDL_FRect title = canvas;
+    // MOVE DOWN BY THE TITLE
+    canvas.y += fontHeight;
+    canvas.h -= fontHeight;
+    // MOVE DOWN ADDITIONAL 50 PX
+    canvas.y += 50;
+    canvas.h -= 50;
+    // MOVE RIGHT 20 PX
+    canvas.x += 20;
+    canvas.w -= 20;
+    ssize_t maxLines = canvas.h / fontHeight - 1;
+    auto& file = files.items[currentFile.index];
+    if (currentFile.startLine < 0) {
+        currentFile.startLine = currentFile.startLine ^ S64SIGN_BIT;
+        const ssize_t cursorLine = file.lineOf(file.begin().cursorPos);
+        if (currentFile.startLine > cursorLine) {
+            // cursor in above startLine and startLine was invalidated
+            currentFile.startLine = cursorLine;
+        }
+        if (maxLines+currentFile.startLine < cursorLine) {
+            // cursor is below startLine+maxLines and startLine was invalidated
+            currentFile.startLine = cursorLine-maxLines;
+        }
+        // the same for the column of the cursor
+        const size_t cursorColumn = file.columnOf(file.begin().cursorPos);
+        const size_t maxColumns = std::max<float>((canvas.w-lineNumberWidth) / atlas.advance(renderer, font, ' '), 1);
+        if (currentFile.startColumn > cursorColumn) {
+            currentFile.startColumn = cursorColumn;
+        }
+        if (maxColumns+currentFile.startColumn <= cursorColumn) {
+            currentFile.startColumn = cursorColumn-maxColumns+1;
+        }
+    }
+    // startLine larger than file allows
+    currentFile.startLine = file.clampLine(currentFile.startLine);
+    const bool everything = dirty & (DIRTY_VIEWPORT | DIRTY_WINDOW);
+    if (everything) {
+        SDL_RenderFillRect(renderer, &into);
+        std::string filename = filenames[currentFile.index];
+        if (const FolderSearch* search = searches.at(currentFile.index).get()) {
+            filename = "\"" + search->getQuery() + "\" in " + search->getFolder() + " (" + std::to_string(search->getResultCount())
+                + " lines in " + std::to_string(search->getFileCount()) + " files" + (search->isTruncated() ? ", stopped" : "")
+                + (search->isDone() ? ")" : ", searching)");
+        }
+        if (filename.empty()) {
             filename = "Untitled";
         }
-        const auto drawn = drawLine(filename, -1, canvas, font, renderer);
-        // MOVE DOWN BY THE DRAWN AMOUNT
-        canvas.y += drawn.y;
-        canvas.h -= drawn.y;
-        // MOVE DOWN ADDITIONAL 50 PX
-        canvas.y += 50;
-        canvas.h -= 50;
-        // MOVE RIGHT 20 PX
-        canvas.x += 20;
-        canvas.w -= 20;
-        ssize_t maxLines = canvas.h / TTF_GetFontHeight(font) - 1;
-        if (currentFile.startLine < 0) {
-            currentFile.startLine = currentFile.startLine ^ S64SIGN_BIT;
-            if (currentFile.startLine > currentFile.numLinesBeforeCursor) {
-                // cursor in above startLine and startLine was invalidated
-                currentFile.startLine = currentFile.numLinesBeforeCursor;
+        if (isLoading(currentFile.index)) {
+            filename += " (loading)";
+        }
+        if (find.active) {
+            filename += (find.folder ? "    in folder, " : "    ") + std::string(find.regex ? "regex: " : "find: ") + find.query;
+            if (!find.error.empty()) {
+                filename += " (" + find.error + ")";
+            } else if (!find.query.empty() && !find.folder) {
+                filename += " (" + std::to_string(find.matches.empty() ? 0 : find.current+1) + "/" + std::to_string(find.matches.size()) + ")";
+            }
+        }
+        atlas.draw(renderer, font, filename.data(), filename.size(), title.x, title.y, textColor);
+        atlas.flush(renderer);
+    }
+    tiles.resize(renderer, SDL_ceilf(canvas.w), fontHeight);
+    if (everything || currentFile.startColumn != drawnStartColumn) {
+        tiles.invalidate(0, SSIZE_MAX);
+    } else {
+        tiles.invalidate(damagedFirst, damagedLast);
+    }
+    // the last line may be cut off by the bottom of into
+    renderTiles(renderer, SDL_FRect{canvas.x, canvas.y, canvas.w, into.y+into.h-canvas.y}, file);
+    drawnStartColumn = currentFile.startColumn;
+    damagedFirst = SSIZE_MAX;
+    damagedLast = -1;
+    dirty = 0;
+}
+
+void Editor::renderTiles(SDL_Renderer* renderer, SDL_FRect area, const Text& file) const {
+    const int rowHeight = tiles.getRowHeight();
+    const size_t tileLines = TileCache::linesPerTile;
+    const size_t first = currentFile.startLine;
+    const size_t last = first + SDL_ceilf(area.h / rowHeight) - 1;
+    const size_t lastLine = file.clampLine(last);
+    const auto selected = selection();
+    SDL_Texture* target = SDL_GetRenderTarget(renderer);
+    // drawing a line can change the colors of the lines behind it, they are drawn once more
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t line = first - first%tileLines; line <= last; line += tileLines) {
+            TileCache::Tile* tile = tiles.tile(renderer, line);
+            if (!tile) {
+                return;
+            }
+            const size_t from = std::max(first, line)-line;
+            const size_t to = std::min(last, line+tileLines-1)-line;
+            if (!(tile->stale >> from)) {
+                continue;
             }
-            if (maxLines+currentFile.startLine < currentFile.numLinesBeforeCursor) {
-                // cursor is below startLine+maxLines and startLine was invalidated
-                currentFile.startLine = currentFile.numLinesBeforeCursor-maxLines;
+            SDL_CHK(SDL_SetRenderTarget(renderer, tile->texture));
+            for (size_t row = from; row <= to; row++) {
+                if (!(tile->stale & (1u << row))) {
+                    continue;
+                }
+                // the stale rows behind it are drawn at once
+                size_t rows = 1;
+                while (row+rows <= to && (tile->stale & (1u << (row+rows)))) {
+                    rows++;
+                }
+                SDL_FRect into{0, static_cast<float>(row*rowHeight), area.w, static_cast<float>(rows*rowHeight)};
+                SDL_RenderFillRect(renderer, &into);
+                if (line+row <= lastLine) {
+                    renderText(
+                        atlas, renderer, font, into, file, line+row, currentFile.startColumn,
+                        currentFile.carets, selected
+                    );
+                }
+                for (size_t i = row; i < row+rows; i++) {
+                    tile->stale &= ~(1u << i);
+                }
+                row += rows-1;
             }
+            atlas.flush(renderer);
         }
-        if (currentFile.startLine > static_cast<ssize_t>(currentFile.newLineIndices.size())) {
-            // startLine larger than file allows
-            currentFile.startLine = currentFile.newLineIndices.size();
+        const size_t recolored = file.takeRecolored();
+        if (recolored == SIZE_MAX) {
+            break;
         }
-        renderText(renderer, font, canvas, files.items[currentFile.index], currentFile.startLine, currentFile.newLineIndices);
+        tiles.invalidate(recolored, SSIZE_MAX);
     }
+    SDL_CHK(SDL_SetRenderTarget(renderer, target));
+    const SDL_Rect clip{
+        static_cast<int>(area.x), static_cast<int>(area.y),
+        static_cast<int>(SDL_ceilf(area.w)), static_cast<int>(SDL_ceilf(area.h)),
+    };
+    SDL_SetRenderClipRect(renderer, &clip);
+    const float tileHeight = rowHeight*tileLines;
+    for (size_t line = first - first%tileLines; line <= last; line += tileLines) {
+        // the tiles were all just used, none of them was given to other lines
+        TileCache::Tile* tile = tiles.tile(renderer, line);
+        const SDL_FRect src{0, 0, SDL_ceilf(area.w), tileHeight};
+        const SDL_FRect dst{
+            area.x, area.y + (static_cast<float>(line)-static_cast<float>(first))*rowHeight, src.w, tileHeight
+        };
+        SDL_CHK(SDL_RenderTexture(renderer, tile->texture, &src, &dst));
+    }
+    SDL_SetRenderClipRect(renderer, NULL);
 }
 
-void Editor::update() {
-    if ((SDL_GetMouseState(NULL, NULL) & SDL_BUTTON_LEFT) && true) {
-        moveToMousePos();
+void Editor::renderProfile(SDL_Renderer* renderer, SDL_FRect into) const {
+    static constexpr SDL_FColor background{0, 0, 0, 0.8};
+    const auto stats = Profiler::stats();
+    const float fontHeight = TTF_GetFontHeight(font);
+    char line[128];
+    const SDL_FRect box{into.x+into.w-900, into.y, 900, (stats.size()+1)*fontHeight};
+    atlas.fill(renderer, box, background);
+    float y = box.y;
+    atlas.draw(renderer, font, line, SDL_snprintf(line, sizeof(line), "%-16s %7s %7s %7s %7s  ms", "", "p50", "p90", "p99", "max"), box.x, y, textColor);
+    for (const auto& zone : stats) {
+        y += fontHeight;
+        const int len = SDL_snprintf(line, sizeof(line), "%-16.16s %7.2f %7.2f %7.2f %7.2f", zone.name, zone.p50, zone.p90, zone.p99, zone.max);
+        atlas.draw(renderer, font, line, len, box.x, y, textColor);
     }
-    if (currentFile.index >= files.size) {
+    atlas.flush(renderer);
+}
+
+void Editor::search() {
+    Zone zone("search");
+    auto& file = files.items[currentFile.index];
+    find.error.clear();
+    if (find.folder) {
+        // searching the folder takes a while, it only starts on RETURN
+        changed(DIRTY_WINDOW);
         return;
     }
-    currentFile.newLineIndices.clear();
-    const auto end = std::end(files.items[currentFile.index]);
-    currentFile.numLinesBeforeCursor = -1;
-    for (auto it = std::begin(files.items[currentFile.index]); it != end; ++it) {
-        if (it.pos == it.cursorPos) {
-            currentFile.numLinesBeforeCursor = currentFile.newLineIndices.size();
-        }
-        if (*it == '\n') {
-            currentFile.newLineIndices.push_back(it.pos);
+    if (find.query.empty()) {
+        find.matches.clear();
+    } else if (find.regex) {
+        // a longer expression can match more than the shorter one did, it is searched again every time
+        find.matches.clear();
+        const Regex regex(find.query);
+        if (regex.getError()) {
+            find.error = regex.getError();
+        } else {
+            for (const auto& match : file.findAll(regex)) {
+                find.matches.push_back(match.start);
+            }
         }
+    } else if (!find.matched.empty() && find.file == currentFile.index && find.query.starts_with(find.matched)) {
+        // every match of the longer query is a match of the shorter one
+        file.refine(find.matches, find.query);
+    } else {
+        find.matches = file.findAll(find.query);
+    }
+    find.matched = find.query;
+    find.file = currentFile.index;
+    const auto next = std::lower_bound(find.matches.begin(), find.matches.end(), find.origin);
+    find.current = next == find.matches.end() ? 0 : next-find.matches.begin();
+    file.moveTo(find.matches.empty() ? find.origin : find.matches[find.current]);
+    currentFile.startLine |= S64SIGN_BIT;
+    updateInlineOffset();
+    changed(DIRTY_WINDOW);
+}
+
+void Editor::nextMatch(bool backwards) {
+    if (find.matched != find.query || find.file != currentFile.index) {
+        search();
     }
-    if (currentFile.numLinesBeforeCursor < 0 && end.pos == end.cursorPos) {
-        currentFile.numLinesBeforeCursor = currentFile.newLineIndices.size();
+    if (find.matches.empty()) {
+        return;
     }
+    const size_t count = find.matches.size();
+    find.current = (find.current + (backwards ? count-1 : 1)) % count;
+    find.origin = find.matches[find.current];
+    files.items[currentFile.index].moveTo(find.origin);
+    currentFile.startLine |= S64SIGN_BIT;
+    updateInlineOffset();
+    changed(DIRTY_WINDOW);
 }
 
-void Editor::write(const char* str) {
+bool Editor::editCarets(const std::function<void(Text&, std::vector<size_t>&)>& edit) {
+    auto& carets = currentFile.carets;
+    if (carets.empty()) {
+        return false;
+    }
+    auto& file = files.items[currentFile.index];
+    const auto at = std::lower_bound(carets.begin(), carets.end(), file.begin().cursorPos);
+    const size_t index = at-carets.begin();
+    carets.insert(at, file.begin().cursorPos);
+    edit(file, carets);
+    file.moveTo(carets[index]);
+    // carets whose edits ran into each other are one now
+    carets.erase(carets.begin()+index);
+    carets.erase(std::unique(carets.begin(), carets.end()), carets.end());
+    const auto [first, last] = std::equal_range(carets.begin(), carets.end(), file.begin().cursorPos);
+    carets.erase(first, last);
+    currentFile.startLine |= S64SIGN_BIT;
+    updateInlineOffset();
+    // the edits are all over the file
+    changed(DIRTY_CONTENT | DIRTY_VIEWPORT);
+    return true;
+}
+
+void Editor::addCaret(size_t pos) {
+    auto& file = files.items[currentFile.index];
+    auto& carets = currentFile.carets;
+    const size_t cursor = file.begin().cursorPos;
+    // a selection at one of many cursors can't be edited
+    currentFile.anchor = -1;
+    carets.insert(std::lower_bound(carets.begin(), carets.end(), cursor), cursor);
+    file.moveTo(pos);
+    const auto [first, last] = std::equal_range(carets.begin(), carets.end(), file.begin().cursorPos);
+    carets.erase(first, last);
+    currentFile.startLine |= S64SIGN_BIT;
+    changed(DIRTY_VIEWPORT);
+}
+
+void Editor::clearCarets() {
+    if (!currentFile.carets.empty()) {
+        currentFile.carets.clear();
+        changed(DIRTY_VIEWPORT);
+    }
+}
+
+std::pair<size_t, size_t> Editor::selection() const {
+    const size_t cursor = files.items[currentFile.index].begin().cursorPos;
+    if (currentFile.anchor < 0) {
+        return {cursor, cursor};
+    }
+    return std::minmax<size_t>(currentFile.anchor, cursor);
+}
+
+void Editor::clearSelection() {
+    const auto [from, to] = selection();
+    currentFile.anchor = -1;
+    if (from != to) {
+        changed(DIRTY_VIEWPORT);
+    }
+}
+
+bool Editor::replaceSelection(const char* str, size_t len) {
+    const auto [from, to] = selection();
+    if (from == to) {
+        return false;
+    }
+    files.items[currentFile.index].replace(from, to, str, len);
+    currentFile.startLine |= S64SIGN_BIT;
+    updateInlineOffset();
+    changed(DIRTY_CONTENT | DIRTY_VIEWPORT);
+    return true;
+}
+
+// what was copied, SDL asks for it when something is pasted and frees it when something else is copied
+struct Clipboard{
+    std::unique_ptr<char[]> data;
+    size_t size;
+};
+
+static const void* SDLCALL clipboardData(void* userdata, const char* mimeType, size_t* size) {
+    UNUSED(mimeType);
+    const auto* clipboard = static_cast<const Clipboard*>(userdata);
+    *size = clipboard->size;
+    return clipboard->data.get();
+}
+
+static void SDLCALL clipboardCleanup(void* userdata) {
+    delete static_cast<Clipboard*>(userdata);
+}
+
+// the spans of the selection are copied straight into the buffer SDL hands out, that is the only copy
+void Editor::copy() const {
+    const auto [from, to] = selection();
+    if (from == to) {
+        return;
+    }
+    auto* clipboard = new Clipboard{std::make_unique_for_overwrite<char[]>(to-from), to-from};
+    char* out = clipboard->data.get();
+    for (const std::string_view span : files.items[currentFile.index].spans(from, to)) {
+        std::memcpy(out, span.data(), span.size());
+        out += span.size();
+    }
+    static const char* mimeTypes[] = {"text/plain;charset=utf-8", "text/plain", "UTF8_STRING", "TEXT", "STRING"};
+    // SDL owns the clipboard from here on, even if it fails
+    if (!SDL_SetClipboardData(clipboardData, clipboardCleanup, clipboard, mimeTypes, std::size(mimeTypes))) {
+        SDL_LogWarn(CUSTOM_LOG_CATEGORY_EDITOR, "Error while copying: %s\n", SDL_GetError());
+    }
+}
+
+void Editor::damage(ssize_t line) const {
+    damagedFirst = std::min(damagedFirst, line);
+    damagedLast = std::max(damagedLast, line);
+}
+
+void Editor::changed(unsigned what) const {
+    dirty |= what;
+    if (what & DIRTY_CONTENT) {
+        // the matches may have moved
+        find.matched.clear();
+        currentFile.anchor = -1;
+    }
     if (currentFile.index >= files.size) {
+        dirty |= DIRTY_WINDOW;
+        return;
+    }
+    // everything happens at the cursor, so the lines it was on before and after cover the change
+    const auto& file = files.items[currentFile.index];
+    const ssize_t line = file.lineOf(file.begin().cursorPos);
+    damage(cursorLine);
+    damage(line);
+    cursorLine = line;
+    if (file.getIndexedLineCount() != lineCount) {
+        // lines were added or removed, everything below moved
+        lineCount = file.getIndexedLineCount();
+        damagedLast = SSIZE_MAX;
+    }
+}
+
+void Editor::mouseMotion(const SDL_MouseMotionEvent& motion) {
+    if (currentFile.index >= files.size) {
+        return;
+    }
+    if (motion.state & SDL_BUTTON_LMASK) {
+        moveToMousePos(motion.x, motion.y);
+    }
+}
+
+void Editor::write(const char* str) {
+    if (currentFile.index >= files.size || isLoading(currentFile.index)) {
+        return;
+    }
+    if (find.active) {
+        find.query += str;
+        search();
+        return;
+    }
+    if (editCarets([&](Text& file, std::vector<size_t>& cursors) {
+        file.insert(cursors, str, strlen(str));
+    })) {
+        return;
+    }
+    if (replaceSelection(str, strlen(str))) {
         return;
     }
     files.items[currentFile.index].insert(str);
     currentFile.startLine |= S64SIGN_BIT;
+    changed(DIRTY_CONTENT);
+}
+
+
+// the dialogs and the savers call back from other threads while the main loop may be asleep in SDL_WaitEvent
+static void pushUserEvent(Editor::UserEvent code, const char* file = nullptr) {
+    SDL_Event event{};
+    event.type = SDL_EVENT_USER;
+    event.user.code = code;
+    event.user.data1 = file ? SDL_strdup(file) : nullptr;
+    SDL_PushEvent(&event);
+}
+
+// what a loader hands to the main loop with USER_EVENT_LOADED
+struct Loaded{
+    uint64_t load;
+    Text text;
+    bool read;
+};
+
+// the files are read and indexed in parallel, big files are only mapped and indexed while they are looked at
+static WorkerPool& loaders() {
+    static WorkerPool pool;
+    return pool;
+}
+
+// updating the index takes a while, the loaders stay free for the files that are opened meanwhile
+static WorkerPool& indexer() {
+    static WorkerPool pool(1);
+    return pool;
 }
 
+static void startLoading(uint64_t load, std::string file) {
+    loaders().submit([load, file = std::move(file)] {
+        Zone zone("load");
+        auto result = std::make_unique<Loaded>(load, Text(), false);
+        struct stat st;
+        if (!stat(file.c_str(), &st) && S_ISREG(st.st_mode) && !access(file.c_str(), R_OK)) {
+            result->text = Text(file.c_str());
+            result->read = true;
+        }
+        SDL_Event event{};
+        event.type = SDL_EVENT_USER;
+        event.user.code = Editor::USER_EVENT_LOADED;
+        event.user.data1 = result.get();
+        if (SDL_PushEvent(&event)) {
+            result.release();
+        }
+    });
+}
 
 static void SDLCALL saveFileCallback(void *userdata, const char * const *filelist, int filter) {
     UNUSED(filter);
@@ -226,8 +596,9 @@ static void SDLCALL saveFileCallback(void *userdata, const char * const *filelis
         // empty filename
         return;
     }
-    Editor* editor = reinterpret_cast<Editor*>(userdata);
-    editor->saveAs(filelist[0]);
+    // the files may only be touched by the main loop
+    UNUSED(userdata);
+    pushUserEvent(Editor::USER_EVENT_SAVE_AS, filelist[0]);
 }
 
 static void SDLCALL openFileCallback(void* userdata, const char * const *filelist, int filter) {
@@ -236,57 +607,133 @@ static void SDLCALL openFileCallback(void* userdata, const char * const *filelis
         SDL_LogWarn(CUSTOM_LOG_CATEGORY_EDITOR, "Error while opening file(s): %s\n", SDL_GetError());
         return;
     }
+    // the tabs are added by the main loop, the files are read by the loaders
+    UNUSED(userdata);
     for (const char* const* file = filelist; *file; file++) {
         const char* filename = *file;
         if (!*filename) {
             // filename in filelist has 0 size
             continue;
         }
-        Editor* editor = reinterpret_cast<Editor*>(userdata);
-        editor->open(filename);
+        pushUserEvent(Editor::USER_EVENT_OPEN, filename);
     }
 }
 
 static_assert(std::is_same<decltype(&openFileCallback), SDL_DialogFileCallback>::value);
 
+void Editor::saveAs(const char* filename) {
+    if (isLoading(currentFile.index)) {
+        // the tab only holds a placeholder, saving it would empty the file
+        SDL_LogWarn(CUSTOM_LOG_CATEGORY_EDITOR, "%s is still loading\n", filenames[currentFile.index].c_str());
+        return;
+    }
+    if (filenames.at(currentFile.index) != filename) {
+        // saved under another name, maybe with another extension
+        filenames[currentFile.index] = filename;
+        files.items[currentFile.index].setLanguage(Highlighter::languageOf(filename));
+    }
+    files.items[currentFile.index].saveInBackground(filename, [file = std::string(filename)](int error) {
+        if (error) {
+            pushUserEvent(USER_EVENT_SAVE_FAILED, (file + ": " + strerror(error)).c_str());
+        } else {
+            pushUserEvent(USER_EVENT_SAVED, file.c_str());
+        }
+    });
+    changed(DIRTY_WINDOW);
+}
+
+void Editor::userEvent(const SDL_UserEvent& event) {
+    const char* file = static_cast<const char*>(event.data1);
+    switch (event.code) {
+        case USER_EVENT_SAVE_AS:
+            if (currentFile.index < files.size) {
+                saveAs(file);
+            }
+            break;
+        case USER_EVENT_SAVED:
+            SDL_LogInfo(CUSTOM_LOG_CATEGORY_EDITOR, "saved %s\n", file);
+            break;
+        case USER_EVENT_SAVE_FAILED:
+            SDL_LogWarn(CUSTOM_LOG_CATEGORY_EDITOR, "Error while saving file %s\n", file);
+            break;
+        case USER_EVENT_OPEN:
+            open(file);
+            break;
+        case USER_EVENT_IDLE:
+            compressIdle();
+            break;
+        case USER_EVENT_COMPRESSED:
+            storeCompressed();
+            break;
+        case USER_EVENT_FOUND:
+            foundInFolder();
+            break;
+        case USER_EVENT_INDEXED:
+            storeIndex();
+            break;
+        case USER_EVENT_LOADED:
+            {
+                std::unique_ptr<Loaded> result(static_cast<Loaded*>(event.data1));
+                loaded(result->load, std::move(result->text), result->read);
+                return;
+            }
+        default:
+            break;
+    }
+    SDL_free(event.data1);
+}
+
 void Editor::close(size_t index) {
     if (index >= files.size) {
         return;
     }
-    files.items[index] = files.pop();
+    if (idle.at(index).compressing.valid()) {
+        // the worker still reads the buffer, it is freed below
+        idle[index].compressing.wait();
+    }
+    // the last tab takes the place of the closed one, or is the closed one and is freed with closed
+    Text closed = files.pop();
+    if (index < files.size) {
+        files.items[index] = std::move(closed);
+    }
     filenames.at(index) = *filenames.rbegin();
     filenames.pop_back();
+    loading.at(index) = loading.back();
+    loading.pop_back();
+    idle.at(index) = std::move(idle.back());
+    idle.pop_back();
+    // stops the search
+    searches.at(index) = std::move(searches.back());
+    searches.pop_back();
+    currentFile.carets.clear();
+    currentFile.anchor = -1;
+    changed(DIRTY_WINDOW);
 }
 
 void Editor::updateInlineOffset() {
     if (currentFile.index >= files.size) {
         return;
     }
-    update();
-    const auto cursor = files.items[currentFile.index].begin().cursorPos;
-    const auto endOfThisLine = std::lower_bound(currentFile.newLineIndices.begin(), currentFile.newLineIndices.end(), cursor);
-    const auto startOfThisLine = endOfThisLine == currentFile.newLineIndices.begin() ? 0 : *(endOfThisLine-1)+1;
-    currentFile.inlineOffset = 0;
-    for (size_t c = startOfThisLine; c < cursor; c++) {
-        const char currentChar = *(files.items[currentFile.index].begin()+c);
-        if (currentChar & 0x80) {
-            currentFile.inlineOffset += static_cast<bool>(currentChar & 0x40);
-        } else if (currentChar == '\t') {
-            currentFile.inlineOffset += 4;
-        } else {
-            currentFile.inlineOffset++;
-        }
-    }
+    const auto& file = files.items[currentFile.index];
+    currentFile.inlineOffset = file.columnOf(file.begin().cursorPos);
 }
 
 void Editor::scroll(SDL_MouseWheelEvent wheel) const {
     if (currentFile.startLine < 0) {
         return;
     }
-    currentFile.startLine -= wheel.integer_y * (1-2*wheel.direction);
+    ssize_t right = wheel.integer_x * (1-2*wheel.direction);
+    ssize_t down = -wheel.integer_y * (1-2*wheel.direction);
+    if (SDL_GetModState() & SDL_KMOD_SHIFT) {
+        // SHIFT + wheel scrolls sideways for mice without a horizontal wheel
+        std::swap(right, down);
+    }
+    currentFile.startLine += down;
     if (currentFile.startLine < 0) {
         currentFile.startLine = 0;
     }
+    currentFile.startColumn = std::max<ssize_t>(currentFile.startColumn + right*columnsPerNotch, 0);
+    changed(DIRTY_SCROLL);
 }
 
 void Editor::write(SDL_KeyboardEvent key) {
@@ -301,27 +748,150 @@ void Editor::write(SDL_KeyboardEvent key) {
     }
     if (key.key == SDLK_N && lctrl) {
         // LCTRL + N
+        hide(currentFile.index);
         currentFile.index = files.push(Text());
+        currentFile.carets.clear();
+        currentFile.anchor = -1;
         filenames.push_back({});
+        loading.push_back(0);
+        idle.emplace_back();
+        searches.emplace_back();
+        changed(DIRTY_WINDOW);
         return;
     }
     if (currentFile.index >= files.size) {
         return;
     }
     const bool ctrl = key.mod & SDL_KMOD_CTRL;
-    const bool* keyboard = SDL_GetKeyboardState(NULL);
-    if (!keyboard[key.scancode]) {
+    if (isLoading(currentFile.index) && !(lctrl && (key.key == SDLK_W || key.key == SDLK_TAB))) {
+        // nothing but closing and switching tabs, edits to the placeholder would be lost
         return;
     }
+    if (key.key == SDLK_F && lctrl) {
+        // LCTRL + F, with SHIFT for a regular expression and with LALT in the folder
+        const bool regex = key.mod & SDL_KMOD_SHIFT;
+        if (find.regex != regex) {
+            // the matches of the other mode can't be refined
+            find.regex = regex;
+            find.matched.clear();
+        }
+        find.folder = key.mod & SDL_KMOD_LALT;
+        find.active = true;
+        find.origin = files.items[currentFile.index].begin().cursorPos;
+        search();
+        return;
+    }
+    if (find.active) {
+        switch (key.scancode) {
+            case SDL_SCANCODE_ESCAPE:
+                find.active = false;
+                changed(DIRTY_WINDOW);
+                return;
+            case SDL_SCANCODE_BACKSPACE:
+                // a whole utf8 character
+                while (!find.query.empty() && (find.query.back() & 0xC0) == 0x80) {
+                    find.query.pop_back();
+                }
+                if (!find.query.empty()) {
+                    find.query.pop_back();
+                }
+                search();
+                return;
+            case SDL_SCANCODE_RETURN:
+                if (find.folder) {
+                    searchFolder();
+                    return;
+                }
+                if (key.mod & SDL_KMOD_LALT) {
+                    // LALT + RETURN, a cursor at every match
+                    if (find.matched != find.query || find.file != currentFile.index) {
+                        search();
+                    }
+                    find.active = false;
+                    if (!find.matches.empty()) {
+                        // the cursor stays on the current match
+                        files.items[currentFile.index].moveTo(find.matches[find.current]);
+                        currentFile.carets = find.matches;
+                        currentFile.carets.erase(currentFile.carets.begin()+find.current);
+                        updateInlineOffset();
+                    }
+                    changed(DIRTY_WINDOW);
+                    return;
+                }
+                // RETURN goes to the next match, SHIFT + RETURN to the previous one
+                nextMatch(key.mod & SDL_KMOD_SHIFT);
+                return;
+            default:
+                break;
+        }
+    }
+    const bool moves = key.scancode == SDL_SCANCODE_UP || key.scancode == SDL_SCANCODE_DOWN || key.scancode == SDL_SCANCODE_LEFT ||
+        key.scancode == SDL_SCANCODE_RIGHT || key.scancode == SDL_SCANCODE_HOME || key.scancode == SDL_SCANCODE_END;
+    if (lctrl && (key.mod & SDL_KMOD_LALT) && (key.scancode == SDL_SCANCODE_UP || key.scancode == SDL_SCANCODE_DOWN)) {
+        // LCTRL + LALT + UP / DOWN, one more cursor on the line above or below
+        auto& file = files.items[currentFile.index];
+        const size_t cursor = file.begin().cursorPos;
+        key.scancode == SDL_SCANCODE_UP ? file.up(currentFile.inlineOffset) : file.down(currentFile.inlineOffset);
+        const size_t pos = file.begin().cursorPos;
+        file.moveTo(cursor);
+        addCaret(pos);
+        return;
+    }
+    if (key.scancode == SDL_SCANCODE_ESCAPE || moves) {
+        // back to one cursor
+        clearCarets();
+    }
+    if (moves && (key.mod & SDL_KMOD_SHIFT)) {
+        // SHIFT + moving selects from where the cursor was
+        if (currentFile.anchor < 0) {
+            currentFile.anchor = files.items[currentFile.index].begin().cursorPos;
+        }
+        changed(DIRTY_VIEWPORT);
+    } else if (key.scancode == SDL_SCANCODE_ESCAPE || moves) {
+        clearSelection();
+    }
     switch(key.scancode) {
         case SDL_SCANCODE_DELETE:
+            if (editCarets([&](Text& file, std::vector<size_t>& cursors) {
+                file.del(cursors, ctrl);
+            })) {
+                return;
+            }
+            if (replaceSelection(nullptr, 0)) {
+                return;
+            }
             files.items[currentFile.index].del(ctrl);
+            changed(DIRTY_CONTENT);
             return;
         case SDL_SCANCODE_BACKSPACE:
+            if (editCarets([&](Text& file, std::vector<size_t>& cursors) {
+                file.backspace(cursors, ctrl);
+            })) {
+                return;
+            }
+            if (replaceSelection(nullptr, 0)) {
+                return;
+            }
             files.items[currentFile.index].backspace(ctrl);
             currentFile.inlineOffset--;
+            changed(DIRTY_CONTENT);
             return;
         case SDL_SCANCODE_RETURN:
+            if (searches.at(currentFile.index) && currentFile.carets.empty() && currentFile.anchor < 0) {
+                // the tab lists the results of a folder search
+                openResult();
+                return;
+            }
+            // no indentation with many cursors, every line would need its own
+            if (editCarets([&](Text& file, std::vector<size_t>& cursors) {
+                file.insert(cursors, "\n", 1);
+            })) {
+                return;
+            }
+            if (replaceSelection("\n", 1)) {
+                currentFile.inlineOffset = 0;
+                return;
+            }
             {
                 auto& file = files.items[currentFile.index];
                 file.insert('\n');
@@ -330,67 +900,74 @@ void Editor::write(SDL_KeyboardEvent key) {
                 // TODO: add whitespace from current line and add whitespace to text behind cursor
                 const auto next = file.begin() + file.begin().cursorPos;
                 if (next == file.end() || *next == '\n') {
-                    size_t lastLineBegin = 0;
-                    if (currentFile.numLinesBeforeCursor > 0) {
-                        lastLineBegin = currentFile.newLineIndices[currentFile.numLinesBeforeCursor-1] + 1;
-                    }
+                    const size_t lastLineBegin = file.lineStart(file.lineOf(file.begin().cursorPos)-1);
                     auto startOfWhitespace = file.begin() + lastLineBegin;
-                    int numSpaces = 0;
-                    int numTabs = 0;
+                    std::string indentation;
                     while (*startOfWhitespace == ' ') {
-                        ++numSpaces;
+                        indentation += ' ';
                         ++startOfWhitespace;
                     }
                     while (*startOfWhitespace == '\t') {
-                        ++numTabs;
+                        indentation += '\t';
                         ++startOfWhitespace;
                     }
-                    for (int i = 0; i < numSpaces; i++) {
-                        file.insert(' ');
-                    }
-                    for (int i = 0; i < numTabs; i++) {
-                        file.insert('\t');
-                    }
+                    file.insert(indentation.data(), indentation.size());
                 }
+                changed(DIRTY_CONTENT);
                 return;
             }
         case SDL_SCANCODE_UP:
-            files.items[currentFile.index].up(currentFile.newLineIndices, currentFile.inlineOffset);
+            files.items[currentFile.index].up(currentFile.inlineOffset);
             currentFile.startLine |= S64SIGN_BIT;
+            changed(DIRTY_CURSOR);
             return;
         case SDL_SCANCODE_DOWN:
-            files.items[currentFile.index].down(currentFile.newLineIndices, currentFile.inlineOffset);
+            files.items[currentFile.index].down(currentFile.inlineOffset);
             currentFile.startLine |= S64SIGN_BIT;
+            changed(DIRTY_CURSOR);
             return;
         case SDL_SCANCODE_LEFT:
             files.items[currentFile.index].left(ctrl);
             currentFile.startLine |= S64SIGN_BIT;
             updateInlineOffset();
+            changed(DIRTY_CURSOR);
             return;
         case SDL_SCANCODE_RIGHT:
             files.items[currentFile.index].right(ctrl);
             currentFile.startLine |= S64SIGN_BIT;
             updateInlineOffset();
+            changed(DIRTY_CURSOR);
             return;
         case SDL_SCANCODE_HOME:
             if (ctrl) {
                 files.items[currentFile.index].beginning();
                 currentFile.inlineOffset = 0;
             } else {
-                currentFile.inlineOffset = files.items[currentFile.index].home(currentFile.newLineIndices);
+                currentFile.inlineOffset = files.items[currentFile.index].home();
             }
             currentFile.startLine |= S64SIGN_BIT;
+            changed(DIRTY_CURSOR);
             return;
         case SDL_SCANCODE_END:
-            ctrl ? files.items[currentFile.index].ending() : files.items[currentFile.index].ende(currentFile.newLineIndices);
+            ctrl ? files.items[currentFile.index].ending() : files.items[currentFile.index].ende();
             updateInlineOffset();
             currentFile.startLine |= S64SIGN_BIT;
+            changed(DIRTY_CURSOR);
             return;
         case SDL_SCANCODE_TAB:
             static constexpr SDL_Keymod KMOD_TOGGLE_KEYS = SDL_KMOD_CAPS | SDL_KMOD_NUM | SDL_KMOD_SCROLL;
             if (!(key.mod & ~KMOD_TOGGLE_KEYS)) {
+                if (editCarets([&](Text& file, std::vector<size_t>& cursors) {
+                    file.insert(cursors, "    ", 4);
+                })) {
+                    return;
+                }
+                if (replaceSelection("    ", 4)) {
+                    return;
+                }
                 files.items[currentFile.index].insert("    ");
                 currentFile.startLine |= S64SIGN_BIT;
+                changed(DIRTY_CONTENT);
                 return;
             } break;
         default:
@@ -404,7 +981,10 @@ void Editor::write(SDL_KeyboardEvent key) {
             return;
         }
         // LCTRL + S
-        files.items[currentFile.index].save(filenames[currentFile.index].c_str());
+        const std::string file = filenames[currentFile.index];
+        if (!file.empty()) {
+            saveAs(file.c_str());
+        }
         return;
     }
     if (key.key == SDLK_W && lctrl) {
@@ -412,6 +992,9 @@ void Editor::write(SDL_KeyboardEvent key) {
         if (currentFile.index >= files.size) {
             currentFile.index = files.size-1;
         }
+        // another tab took its place
+        show(currentFile.index);
+        changed(DIRTY_WINDOW);
         return;
     }
     if (key.key == SDLK_TAB && lctrl) {
@@ -427,23 +1010,53 @@ void Editor::write(SDL_KeyboardEvent key) {
         switchTo((currentFile.index + 1) % files.size);
         return;
     }
+    if ((key.key == SDLK_Z || key.key == SDLK_Y) && lctrl) {
+        // LCTRL + Z undoes, LCTRL + Y and LCTRL + SHIFT + Z redo
+        auto& file = files.items[currentFile.index];
+        const bool redo = key.key == SDLK_Y || (key.mod & SDL_KMOD_SHIFT);
+        if (redo ? file.redo() : file.undo()) {
+            // the carets don't know where the edit went
+            clearCarets();
+            currentFile.startLine |= S64SIGN_BIT;
+            updateInlineOffset();
+            changed(DIRTY_CONTENT);
+        }
+        return;
+    }
+    if (key.key == SDLK_A && lctrl) {
+        // LCTRL + A
+        clearCarets();
+        auto& file = files.items[currentFile.index];
+        currentFile.anchor = 0;
+        file.ending();
+        updateInlineOffset();
+        currentFile.startLine |= S64SIGN_BIT;
+        changed(DIRTY_VIEWPORT);
+        return;
+    }
     if (key.key == SDLK_C && lctrl) {
-        // TODO: Copy
+        // LCTRL + C
+        copy();
         return;
     }
     if (key.key == SDLK_V && lctrl) {
-        // TODO: Paste
+        // LCTRL + V, replaces the selection and is typed at every cursor
+        char* pasted = SDL_GetClipboardText();
+        if (*pasted) {
+            write(pasted);
+        }
+        SDL_free(pasted);
         return;
     }
     if (key.key == SDLK_X && lctrl) {
-        // TODO: Cut
+        // LCTRL + X
+        copy();
+        replaceSelection(nullptr, 0);
         return;
     }
 }
 
-void Editor::moveToMousePos() {
-    float x, y;
-    SDL_GetMouseState(&x, &y);
+void Editor::moveToMousePos(float x, float y) {
     const int fontHeight = TTF_GetFontHeight(font);
     // TODO: get real font width
     const int fontWidth = 18;
@@ -459,36 +1072,13 @@ void Editor::moveToMousePos() {
         relativeY = 0;
     }
     ssize_t line = relativeY / fontHeight;
-    int column = std::max<float>(relativeX / fontWidth, 0);
+    const size_t column = std::max<float>(relativeX / fontWidth, 0) + currentFile.startColumn;
     line += currentFile.startLine;
-    ssize_t newLineIndex = -1;
     auto& file = files.items[currentFile.index];
-    if (line > static_cast<ssize_t>(currentFile.newLineIndices.size())) {
-        line = currentFile.newLineIndices.size();
-        newLineIndex = file.end().pos;
-    } else if (line > 0) {
-        newLineIndex = currentFile.newLineIndices[line-1];
-    }
-    const ssize_t end = (
-        line == static_cast<ssize_t>(currentFile.newLineIndices.size())
-    ) ? file.end().pos : currentFile.newLineIndices[line];
-    if (column > end) {
-        column = end;
-    }
-    // [X] find new column, keeping in mind that going right one char doesn't mean the cursor moves 1 byte
-    ssize_t newPos = std::min(end-column, newLineIndex)+1;
-    const auto e = file.end();
-    const ssize_t b = newPos;
-    auto it = file.begin();
-    for (it = it + newPos; newPos-b < column && it != e && it.pos < static_cast<size_t>(end); ++it) {
-        if (*it & 0x80) {
-            newPos += static_cast<bool>(*it & 0x40);
-        } else {
-            newPos++;
-        }
-    }
-    // [X] move the cursor to the new position
-    file.moveTo(it.pos);
+    line = file.clampLine(line);
+    file.moveTo(file.posAtColumn(line, column));
+    updateInlineOffset();
+    changed(DIRTY_CURSOR);
 }
 
 void Editor::buttonDown(const SDL_MouseButtonEvent& button) {
@@ -496,14 +1086,54 @@ void Editor::buttonDown(const SDL_MouseButtonEvent& button) {
         return;
     }
     if (button.button == SDL_BUTTON_LEFT) {
+        auto& file = files.items[currentFile.index];
         switch((button.clicks-1) % 3) {
-            case 2:
-                // TODO: select line
-            case 1:
-                // TODO: select word
+            case 2: {
+                // the line and its line break
+                clearCarets();
+                moveToMousePos(button.x, button.y);
+                const size_t line = file.lineOf(file.begin().cursorPos);
+                currentFile.anchor = file.lineStart(line);
+                file.moveTo(std::min(file.lineEnd(line)+1, file.getFileSize()));
+                updateInlineOffset();
+                changed(DIRTY_VIEWPORT);
+                break;
+            }
+            case 1: {
+                // the word, the spaces or the symbols that were clicked
+                clearCarets();
+                moveToMousePos(button.x, button.y);
+                const auto [from, to] = file.wordAt(file.begin().cursorPos);
+                currentFile.anchor = from;
+                file.moveTo(to);
+                updateInlineOffset();
+                changed(DIRTY_VIEWPORT);
+                break;
+            }
             case 0:
-                moveToMousePos();
-                // setSelectStart();
+                if (SDL_GetModState() & SDL_KMOD_LALT) {
+                    // LALT + click, one more cursor
+                    const size_t cursor = file.begin().cursorPos;
+                    moveToMousePos(button.x, button.y);
+                    const size_t pos = file.begin().cursorPos;
+                    file.moveTo(cursor);
+                    addCaret(pos);
+                    break;
+                }
+                clearCarets();
+                if (!(SDL_GetModState() & SDL_KMOD_SHIFT)) {
+                    // dragging selects from here
+                    clearSelection();
+                    moveToMousePos(button.x, button.y);
+                    currentFile.anchor = file.begin().cursorPos;
+                    break;
+                }
+                // SHIFT + click selects from where the cursor was
+                if (currentFile.anchor < 0) {
+                    currentFile.anchor = file.begin().cursorPos;
+                }
+                moveToMousePos(button.x, button.y);
+                changed(DIRTY_VIEWPORT);
                 break;
         }
     }
@@ -513,25 +1143,292 @@ void Editor::switchTo(size_t index) {
     if (index >= files.size) {
         return;
     }
+    if (index != currentFile.index) {
+        hide(currentFile.index);
+    }
+    show(index);
     currentFile = {
         index,
         0,
-        {},
-        0,
         -1
     };
     updateInlineOffset();
+    changed(DIRTY_WINDOW);
 }
 
 size_t Editor::open(const char* relativeFilePath) {
+    hide(currentFile.index);
     filenames.push_back(relativeFilePath);
-    currentFile.index = files.push(Text(relativeFilePath));
+    loading.push_back(++lastLoad);
+    idle.emplace_back();
+    searches.emplace_back();
+    currentFile.index = files.push(Text());
+    currentFile.carets.clear();
+    currentFile.anchor = -1;
+    startLoading(lastLoad, relativeFilePath);
     // currentFile.inlineOffset = -1;
     currentFile.startLine = S64SIGN_BIT;
+    currentFile.startColumn = 0;
     updateInlineOffset();
+    changed(DIRTY_WINDOW);
     assert(currentFile.index == files.size-1);
     assert(currentFile.index == filenames.size()-1);
+    assert(currentFile.index == loading.size()-1);
     return currentFile.index;
 }
 
-Editor::~Editor() = default;
+void Editor::loaded(uint64_t load, Text&& text, bool read) {
+    const auto tab = std::find(loading.begin(), loading.end(), load);
+    if (tab == loading.end()) {
+        // closed while it was loading
+        return;
+    }
+    const size_t index = tab-loading.begin();
+    if (!read) {
+        SDL_LogWarn(CUSTOM_LOG_CATEGORY_EDITOR, "Error while opening file %s\n", filenames[index].c_str());
+        close(index);
+        if (currentFile.index == files.size) {
+            // the last tab was moved into the closed one's place
+            currentFile.index = index;
+        }
+        if (currentFile.index >= files.size) {
+            currentFile.index = files.size-1;
+        }
+        switchTo(currentFile.index);
+        return;
+    }
+    *tab = 0;
+    files.items[index] = std::move(text);
+    files.items[index].setLanguage(Highlighter::languageOf(filenames[index]));
+    if (index == currentFile.index) {
+        switchTo(index);
+        if (jump.load == load) {
+            goTo(jump.line, jump.column);
+        }
+    }
+}
+
+void Editor::hide(size_t index) {
+    if (index < idle.size()) {
+        idle[index].since = SDL_GetTicks();
+    }
+}
+
+void Editor::show(size_t index) {
+    if (index >= files.size) {
+        return;
+    }
+    Idle& tab = idle.at(index);
+    tab.since = 0;
+    if (tab.compressing.valid()) {
+        // too late, the tab is edited from now on
+        tab.compressing.wait();
+        tab.compressing = {};
+    }
+    Zone zone("decompress");
+    files.items[index].decompress();
+}
+
+void Editor::compressIdle() {
+    const uint64_t now = SDL_GetTicks();
+    for (size_t index = 0; index < files.size; index++) {
+        Idle& tab = idle.at(index);
+        const Text& file = files.items[index];
+        if (
+            index == currentFile.index || !tab.since || now-tab.since < compressAfterMs
+            || isLoading(index) || tab.compressing.valid() || file.isCompressed()
+            || (searches.at(index) && !searches[index]->isDone())
+            || file.getFileSize() < minCompressedSize
+        ) {
+            continue;
+        }
+        // the pieces point into the buffer, which stays where it is when the tabs are moved around
+        const auto spans = file.spans(0, file.getFileSize());
+        auto task = std::make_shared<std::packaged_task<Compressed()>>(
+            [pieces = std::vector<std::string_view>(spans.begin(), spans.end())] {
+                Zone zone("compress");
+                return Compressed(pieces);
+            }
+        );
+        tab.compressing = task->get_future();
+        loaders().submit([task] {
+            (*task)();
+            pushUserEvent(USER_EVENT_COMPRESSED);
+        });
+    }
+}
+
+void Editor::storeCompressed() {
+    for (size_t index = 0; index < files.size; index++) {
+        Idle& tab = idle.at(index);
+        if (!tab.compressing.valid() || tab.compressing.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            continue;
+        }
+        // show() waits for the compression of the current tab and drops it, this one is still in the background
+        files.items[index].store(tab.compressing.get());
+    }
+}
+
+void Editor::waitForCompression() {
+    for (Idle& tab : idle) {
+        if (tab.compressing.valid()) {
+            tab.compressing.wait();
+        }
+    }
+}
+
+void Editor::searchFolder() {
+    if (find.query.empty()) {
+        return;
+    }
+    const std::string root = folder ? folder : ".";
+    if (options.index_folder && !index) {
+        // written by an earlier session, the first update only reads what changed since
+        index = std::make_unique<TrigramIndex>(TrigramIndex::pathFor(root));
+    }
+    std::unique_ptr<FolderSearch> search;
+    if (index && index->isOpen()) {
+        Zone zone("candidates");
+        // only the index is looked at here, the threads of the search compare the files on disk to it
+        auto skip = [indexed = index, candidates = index->candidates(find.query, find.regex)](const std::string& path, const struct stat& st) {
+            return indexed->skips(candidates, path, st);
+        };
+        search = std::make_unique<FolderSearch>(root, std::move(skip), find.query, find.regex, [] {
+            pushUserEvent(USER_EVENT_FOUND);
+        });
+    } else {
+        search = std::make_unique<FolderSearch>(root, find.query, find.regex, [] {
+            pushUserEvent(USER_EVENT_FOUND);
+        });
+    }
+    if (search->getError()) {
+        find.error = search->getError();
+        changed(DIRTY_WINDOW);
+        return;
+    }
+    find.active = false;
+    // the results get a tab of their own, like LCTRL + N
+    hide(currentFile.index);
+    currentFile.index = files.push(Text());
+    currentFile.carets.clear();
+    currentFile.anchor = -1;
+    currentFile.startLine = S64SIGN_BIT;
+    currentFile.startColumn = 0;
+    filenames.push_back({});
+    loading.push_back(0);
+    idle.emplace_back();
+    searches.push_back(std::move(search));
+    updateInlineOffset();
+    changed(DIRTY_WINDOW);
+    // the files that changed on disk were searched in full, the next search finds them in the index
+    updateIndex();
+}
+
+void Editor::updateIndex() {
+    if (!options.index_folder || indexing.valid()) {
+        return;
+    }
+    const std::string root = folder ? folder : ".";
+    auto task = std::make_shared<std::packaged_task<std::unique_ptr<TrigramIndex>()>>(
+        [root, stop = stopIndexing]() -> std::unique_ptr<TrigramIndex> {
+            Zone zone("index");
+            const std::string path = TrigramIndex::pathFor(root);
+            if (!TrigramIndex::update(root, path, *stop)) {
+                return nullptr;
+            }
+            return std::make_unique<TrigramIndex>(path);
+        }
+    );
+    indexing = task->get_future();
+    indexer().submit([task] {
+        (*task)();
+        pushUserEvent(USER_EVENT_INDEXED);
+    });
+}
+
+void Editor::storeIndex() {
+    if (!indexing.valid() || indexing.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return;
+    }
+    std::unique_ptr<TrigramIndex> updated = indexing.get();
+    if (!updated || !updated->isOpen()) {
+        SDL_LogWarn(CUSTOM_LOG_CATEGORY_EXPLORER, "Error while indexing %s\n", folder ? folder : ".");
+        return;
+    }
+    SDL_LogInfo(CUSTOM_LOG_CATEGORY_EXPLORER, "indexed %zu files\n", updated->getFileCount());
+    // a search that runs keeps the index it started with
+    index = std::move(updated);
+}
+
+void Editor::stopIndex() {
+    if (indexing.valid()) {
+        *stopIndexing = true;
+        indexing.wait();
+        indexing = {};
+        *stopIndexing = false;
+    }
+}
+
+void Editor::foundInFolder() {
+    for (size_t index = 0; index < files.size; index++) {
+        FolderSearch* search = searches.at(index).get();
+        if (!search) {
+            continue;
+        }
+        const std::string results = search->take();
+        if (!results.empty()) {
+            // behind everything, the cursor stays where it is
+            auto& file = files.items[index];
+            const size_t cursor = file.begin().cursorPos;
+            const size_t end = file.getFileSize();
+            file.replace(end, end, results.data(), results.size());
+            file.moveTo(cursor);
+        }
+        if (index == currentFile.index) {
+            // the counts in the title changed too
+            changed(DIRTY_WINDOW);
+        }
+    }
+}
+
+void Editor::openResult() {
+    const auto& file = files.items[currentFile.index];
+    const size_t line = file.lineOf(file.begin().cursorPos);
+    std::string result;
+    for (const std::string_view span : file.spans(file.lineStart(line), file.lineEnd(line))) {
+        result += span;
+    }
+    std::string path;
+    size_t row = 0;
+    size_t column = 0;
+    if (!FolderSearch::parse(result, path, row, column)) {
+        return;
+    }
+    const auto tab = std::find(filenames.begin(), filenames.end(), path);
+    if (tab == filenames.end()) {
+        open(path.c_str());
+        jump = {lastLoad, row, column};
+        return;
+    }
+    const size_t index = tab-filenames.begin();
+    switchTo(index);
+    if (isLoading(index)) {
+        jump = {loading[index], row, column};
+    } else {
+        goTo(row, column);
+    }
+}
+
+void Editor::goTo(size_t line, size_t column) {
+    auto& file = files.items[currentFile.index];
+    line = file.clampLine(line-1);
+    file.moveTo(std::min(file.lineStart(line)+column-1, file.lineEnd(line)));
+    currentFile.startLine |= S64SIGN_BIT;
+    updateInlineOffset();
+    changed(DIRTY_VIEWPORT);
+}
+
+Editor::~Editor() {
+    waitForCompression();
+    stopIndex();
+}
@@ -1,9 +1,20 @@
 #pragma once
 
+#include "foldersearch.hpp"
+#include "glyphatlas.hpp"
 #include "text.hpp"
+#include "tilecache.hpp"
+#include "trigramindex.hpp"
 #include <SDL3/SDL.h>
 #include <SDL3_ttf/SDL_ttf.h>
+#include <atomic>
+#include <climits>
+#include <cstdint>
 #include <cstdio>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
 #include <vector>
 
 
@@ -11,60 +22,238 @@ class Editor{
     struct OpenFile{
         size_t index{0};
         mutable ssize_t startLine{0};
-        std::vector<ssize_t> newLineIndices{};
-        ssize_t numLinesBeforeCursor{0};
         ssize_t inlineOffset{-1};
+        // the first column that is drawn, follows the cursor like startLine when that is invalidated
+        mutable size_t startColumn{0};
+        // more cursors next to the one of the Text, sorted and without it, edits happen at all of them.
+        // LALT + click and LCTRL + LALT + UP / DOWN add one, LALT + RETURN one at every match of a find.
+        // ESCAPE and moving the cursor go back to a single one.
+        std::vector<size_t> carets{};
+        // the selection reaches from here to the cursor, -1 if nothing is selected. SHIFT + moving the cursor,
+        // dragging, double and triple clicks select, every edit ends the selection.
+        mutable ssize_t anchor{-1};
     };
     List<Text> files{};
     OpenFile currentFile;
     std::vector<std::string> filenames{};
+    // for every tab the load it waits for, 0 once it holds its file
+    std::vector<uint64_t> loading{};
+    // Tabs that weren't looked at for compressAfterMs are deflated by a worker and only inflated again by
+    // switchTo(), so memory grows with the tabs that are used and not with the ones that are open.
+    struct Idle{
+        // SDL_GetTicks() when the tab stopped being the current one, 0 while it is
+        uint64_t since{0};
+        // the worker reads the buffer, the tab may neither be edited nor closed until it is done
+        std::future<Compressed> compressing{};
+    };
+    // for every tab
+    std::vector<Idle> idle{};
+    // for every tab the folder search whose results it shows, nullptr for files. RETURN on a result opens it.
+    std::vector<std::unique_ptr<FolderSearch>> searches{};
+    // where to put the cursor when the load arrives, see openResult()
+    struct Jump{
+        uint64_t load{0};
+        size_t line{0};
+        size_t column{0};
+    };
+    Jump jump{};
+    // with options.index_folder the folder is searched through its TrigramIndex, every search that used it
+    // updates it in the background for the next one
+    std::shared_ptr<TrigramIndex> index{};
+    std::future<std::unique_ptr<TrigramIndex>> indexing{};
+    // stops the update that runs
+    std::shared_ptr<std::atomic<bool>> stopIndexing{std::make_shared<std::atomic<bool>>(false)};
+    uint64_t lastLoad{0};
     const char* folder{nullptr};
     TTF_Font* font{nullptr};
+    mutable GlyphAtlas atlas{};
+    // the rows of the text area that were drawn, see TileCache
+    mutable TileCache tiles{};
+    // what has to be redrawn, see Dirty
+    mutable unsigned dirty{DIRTY_WINDOW};
+    // the range of file lines that changed since the last frame
+    mutable ssize_t damagedFirst{SSIZE_MAX};
+    mutable ssize_t damagedLast{-1};
+    // the state of the last frame, to find out what moved
+    mutable ssize_t cursorLine{0};
+    mutable size_t lineCount{1};
+    mutable size_t drawnStartColumn{0};
+    mutable size_t frames{0};
+    // find-as-you-type, LCTRL + F starts it and typing goes into the query until ESCAPE,
+    // LCTRL + SHIFT + F does the same with the query as a regular expression.
+    // With LALT the query is searched in the files of the folder when RETURN is pressed.
+    struct Find{
+        bool active{false};
+        bool regex{false};
+        bool folder{false};
+        std::string query{};
+        // why the query doesn't compile, empty if it does
+        std::string error{};
+        // the query the matches were searched for in files.items[file], empty if they have to be searched again
+        std::string matched{};
+        size_t file{0};
+        std::vector<size_t> matches{};
+        // the match the cursor is on
+        size_t current{0};
+        // where the cursor was when the find started, typing goes to the first match behind it
+        size_t origin{0};
+    };
+    mutable Find find{};
+    void damage(ssize_t line) const;
+    // the current tab goes to the background, or index comes out of it
+    void hide(size_t index);
+    void show(size_t index);
+    // starts compressing the tabs that were in the background for long enough
+    void compressIdle();
+    // keeps what the workers compressed for tabs that are still in the background
+    void storeCompressed();
+    void waitForCompression();
+    // draws the stale visible rows of the tiles and copies the tiles into area, the text area below the title
+    void renderTiles(SDL_Renderer* renderer, SDL_FRect area, const Text& file) const;
+    // searches the current query, refining the last matches if it only got longer
+    void search();
+    // moves the cursor to the next or the previous match
+    void nextMatch(bool backwards);
+    // searches the folder for the query, the results arrive in a new tab
+    void searchFolder();
+    // appends the results that arrived to the tabs of the searches
+    void foundInFolder();
+    // opens the file of the result under the cursor at its line
+    void openResult();
+    // moves the cursor to line and column, both from 1, and the view along
+    void goTo(size_t line, size_t column);
+    // starts updating the index of the folder unless that runs already
+    void updateIndex();
+    // keeps the index an update wrote
+    void storeIndex();
+    void stopIndex();
+    // makes edit(file, cursors) at the cursor of the Text and all carets, false if there are no carets
+    bool editCarets(const std::function<void(Text&, std::vector<size_t>&)>& edit);
+    // adds a caret where the cursor is, the cursor moves on to pos
+    void addCaret(size_t pos);
+    void clearCarets();
+    // the selected range, empty at the cursor if nothing is selected
+    std::pair<size_t, size_t> selection() const;
+    void clearSelection();
+    // replaces the selection with len bytes of str, false if nothing is selected
+    bool replaceSelection(const char* str, size_t len);
+    // puts the selection on the clipboard
+    void copy() const;
+    // swaps the file a worker read into the tab that waits for it
+    void loaded(uint64_t load, Text&& text, bool read);
     public:
+    enum Dirty : unsigned{
+        DIRTY_CONTENT = 1,
+        DIRTY_CURSOR = 2,
+        // switched files or changed what many lines look like, the whole text area is redrawn
+        DIRTY_VIEWPORT = 4,
+        // resized or exposed, everything is redrawn
+        DIRTY_WINDOW = 8,
+        // scrolled, the lines that were drawn before are reused
+        DIRTY_SCROLL = 16,
+    };
     Editor() = default;
     Editor(TTF_Font* font) : font(font) {
         updateInlineOffset();
     };
     // Editor(List<Text>&& oFiles, const char* oFolder) {
     //     files = std::move(oFiles);
-    //     currentFile = {files.size-1, 0, {}, -1, 0};
+    //     currentFile = {files.size-1, 0, -1};
     //     folder = oFolder;
-    //     for (auto it = std::begin(files.items[currentFile.index]); it != std::end(files.items[currentFile.index]); ++it) {
-    //         if (*it == '\n') {
-    //             currentFile.newLineIndices.push_back(it.pos);
-    //         }
-    //     }
     // }
     Editor& operator=(Editor&& moveFrom) {
+        waitForCompression();
+        stopIndex();
         files = std::move(moveFrom.files);
         moveFrom.filenames.swap(filenames);
+        moveFrom.loading.swap(loading);
+        moveFrom.idle.swap(idle);
+        moveFrom.searches.swap(searches);
+        lastLoad = moveFrom.lastLoad;
+        jump = moveFrom.jump;
+        index.swap(moveFrom.index);
+        indexing = std::move(moveFrom.indexing);
+        stopIndexing.swap(moveFrom.stopIndexing);
         currentFile = moveFrom.currentFile;
         folder = moveFrom.folder;
         font = moveFrom.font;
+        atlas = std::move(moveFrom.atlas);
+        tiles = std::move(moveFrom.tiles);
+        frames = moveFrom.frames;
+        changed(DIRTY_WINDOW);
         return *this;
     }
     ~Editor();
+    static constexpr uint64_t compressAfterMs = 30'000;
+    // smaller tabs aren't worth it
+    static constexpr size_t minCompressedSize = 64 << 10;
     enum SpecialKey{
         DEL, BACKSPACE,
         LAST
     };
+    // adds a tab right away, the file is read by a worker and arrives as USER_EVENT_LOADED
     size_t open(const char* relativeFilePath);
+    bool isLoading(size_t index) const {
+        return index < loading.size() && loading[index];
+    }
+    // some tab still waits for its USER_EVENT_LOADED
+    bool isLoadingAny() const {
+        for (const uint64_t load : loading) {
+            if (load) {
+                return true;
+            }
+        }
+        return false;
+    }
     void close(size_t index);
     void switchTo(size_t index);
+    // only draws what changed since the last call, nothing if needsRedraw() is false
     void render(SDL_Renderer* renderer, SDL_FRect into) const;
-    void update();
+    // the frame time percentiles of the profiler in the top right corner of into, drawn over whatever is there
+    void renderProfile(SDL_Renderer* renderer, SDL_FRect into) const;
+    // marks what has to be drawn in the next frame, call it after every change
+    void changed(unsigned what) const;
+    bool needsRedraw() const {
+        return dirty;
+    }
+    // how many frames render() actually drew, a replay checks with it that frames without events draw nothing
+    size_t getFrameCount() const {
+        return frames;
+    }
     void write(const char* str);
     void write(SDL_KeyboardEvent key);
     void updateInlineOffset();
     void invalidateStartLine() const;
-    void moveToMousePos();
+    // where the mouse is in the window
+    void moveToMousePos(float x, float y);
     void buttonDown(const SDL_MouseButtonEvent& button);
+    void mouseMotion(const SDL_MouseMotionEvent& motion);
     void scroll(SDL_MouseWheelEvent wheel) const;
-    // TODO: text selection
-    void saveAs(const char* filename) {
-        filenames.at(currentFile.index) = filename;
-        files.items[currentFile.index].save(filename);
-    }
+    // saves in the background, the main loop gets a USER_EVENT_SAVED when it is done
+    void saveAs(const char* filename);
+    // codes of the SDL_EVENT_USER events that other threads send to the main loop
+    enum UserEvent : Sint32{
+        // only wakes the main loop up
+        USER_EVENT_WAKE,
+        // the save dialog picked a file, data1 is its SDL_malloced name
+        USER_EVENT_SAVE_AS,
+        // a background save finished, data1 is the SDL_malloced file name
+        USER_EVENT_SAVED,
+        USER_EVENT_SAVE_FAILED,
+        // the open dialog picked a file, data1 is its SDL_malloced name
+        USER_EVENT_OPEN,
+        // a worker read a file, data1 is the Loaded result and owned by the main loop
+        USER_EVENT_LOADED,
+        // sent now and then, compresses the tabs that were in the background for compressAfterMs
+        USER_EVENT_IDLE,
+        // a worker compressed a tab
+        USER_EVENT_COMPRESSED,
+        // a folder search has results
+        USER_EVENT_FOUND,
+        // an update of the index of the folder is done
+        USER_EVENT_INDEXED,
+    };
+    void userEvent(const SDL_UserEvent& event);
     void print() const {
         printf("%s: (%zd / %zu)\n - %s\n", folder, currentFile.index, files.size, filenames[currentFile.index].c_str());
     }
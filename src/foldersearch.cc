@@ -0,0 +1,188 @@
+#include "foldersearch.hpp"
+#include "scan.hpp"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+FolderSearch::FolderSearch(const std::string& folder, std::string_view query, bool isRegex, std::function<void()> found, size_t threads)
+    : folder(folder), query(query), found(std::move(found)) {
+    if (compile(isRegex)) {
+        walk = std::make_unique<FolderWalk>(folder, [this](FolderWalk& walk, const std::string& path) {
+            search(walk, path);
+        }, [this] {
+            finish();
+        }, threads);
+    }
+}
+
+FolderSearch::FolderSearch(
+    const std::string& folder, Skip skip, std::string_view query, bool isRegex, std::function<void()> found, size_t threads
+) : folder(folder), query(query), found(std::move(found)), skip(std::move(skip)) {
+    if (compile(isRegex)) {
+        walk = std::make_unique<FolderWalk>(folder, [this](FolderWalk& walk, const std::string& path) {
+            search(walk, path);
+        }, [this] {
+            finish();
+        }, threads);
+    }
+}
+
+FolderSearch::~FolderSearch() = default;
+
+bool FolderSearch::compile(bool isRegex) {
+    if (!isRegex) {
+        finder.emplace(query);
+        return true;
+    }
+    regex.emplace(query);
+    if (regex->getError()) {
+        error = regex->getError();
+        return false;
+    }
+    return true;
+}
+
+const char* FolderSearch::getError() const {
+    return error.empty() ? nullptr : error.c_str();
+}
+
+std::string FolderSearch::take() {
+    std::lock_guard lock(resultsMutex);
+    notified = false;
+    return std::exchange(arrived, {});
+}
+
+bool FolderSearch::isDone() const {
+    std::lock_guard lock(resultsMutex);
+    return finished && arrived.empty();
+}
+
+bool FolderSearch::parse(std::string_view result, std::string& path, size_t& line, size_t& column) {
+    // the path may have colons of its own, the first ":line:column:" ends it
+    for (size_t colon = result.find(':'); colon != std::string_view::npos; colon = result.find(':', colon+1)) {
+        size_t numbers[2] = {0, 0};
+        size_t pos = colon+1;
+        bool valid = true;
+        for (size_t& number : numbers) {
+            const size_t start = pos;
+            while (pos < result.size() && result[pos] >= '0' && result[pos] <= '9') {
+                number = number*10 + result[pos++]-'0';
+            }
+            if (pos == start || pos == result.size() || result[pos] != ':' || !number) {
+                valid = false;
+                break;
+            }
+            pos++;
+        }
+        if (valid) {
+            path = result.substr(0, colon);
+            line = numbers[0];
+            column = numbers[1];
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<size_t> FolderSearch::matches(const char* data, size_t size) const {
+    const Finder::Segments segments = [data](size_t from, size_t to, const std::function<void(const char*, size_t)>& piece) {
+        piece(data+from, to-from);
+    };
+    if (!regex) {
+        return finder->findAll(segments, size);
+    }
+    std::vector<size_t> starts;
+    for (const auto& match : regex->findAll(segments, size)) {
+        starts.push_back(match.start);
+    }
+    return starts;
+}
+
+void FolderSearch::search(FolderWalk& walk, const std::string& path) {
+    if (skip) {
+        struct stat st;
+        if (stat((walk.getPrefix()+path).c_str(), &st) || skip(path, st)) {
+            return;
+        }
+    }
+    const MappedFile file(walk.getPrefix()+path);
+    if (!file.size()) {
+        return;
+    }
+    const char* data = file.data();
+    const size_t size = file.size();
+    searched++;
+    bytes += size;
+    if (file.isBinary()) {
+        return;
+    }
+    std::string found;
+    size_t count = 0;
+    // the line of counted, from 1
+    size_t line = 1;
+    size_t counted = 0;
+    // the end of the line of the last result, further matches in it add nothing
+    size_t lastEnd = 0;
+    for (const size_t match : matches(data, size)) {
+        if (count && match <= lastEnd) {
+            continue;
+        }
+        line += countNewLines(data+counted, match-counted);
+        counted = match;
+        const char* before = static_cast<const char*>(memrchr(data, '\n', match));
+        const size_t start = before ? before-data+1 : 0;
+        const char* after = static_cast<const char*>(memchr(data+match, '\n', size-match));
+        lastEnd = after ? after-data : size;
+        size_t end = std::min(lastEnd, start+maxPreview);
+        // no half utf8 characters
+        while (end < lastEnd && end > start && (data[end] & 0xC0) == 0x80) {
+            end--;
+        }
+        if (end > start && data[end-1] == '\r') {
+            end--;
+        }
+        found += walk.getPrefix();
+        found += path;
+        found += ':';
+        found += std::to_string(line);
+        found += ':';
+        found += std::to_string(match-start+1);
+        found += ": ";
+        found.append(data+start, end-start);
+        found += '\n';
+        count++;
+    }
+    if (count) {
+        add(walk, std::move(found), count);
+    }
+}
+
+void FolderSearch::add(FolderWalk& walk, std::string&& more, size_t count) {
+    bool notify = false;
+    {
+        std::lock_guard lock(resultsMutex);
+        arrived += more;
+        notify = !notified;
+        notified = true;
+    }
+    if (notify) {
+        found();
+    }
+    if ((results += count) >= maxResults) {
+        truncated = true;
+        walk.stop();
+    }
+}
+
+void FolderSearch::finish() {
+    bool notify = false;
+    {
+        std::lock_guard lock(resultsMutex);
+        finished = true;
+        notify = !notified;
+        notified = true;
+    }
+    if (notify) {
+        found();
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "folderwalk.hpp"
+#include "regex.hpp"
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <vector>
+
+// Searches the files below a folder with a FolderWalk, the results can be taken while it runs.
+// A file is mapped and searched in place with the Finder or the Regex, binary files are skipped.
+class FolderSearch{
+    public:
+    // more results than this stop the search
+    static constexpr size_t maxResults = 100'000;
+    // a result shows this many bytes of its line at most
+    static constexpr size_t maxPreview = 200;
+    // calls found() from its threads when results arrived after the last take() and once more when it is done
+    FolderSearch(const std::string& folder, std::string_view query, bool regex, std::function<void()> found, size_t threads = 0);
+    // a file below folder, relative to it, and what stat() said about it, true if it can't have a match
+    using Skip = std::function<bool(const std::string& path, const struct stat& st)>;
+    // doesn't search the files skip() returns true for, like the ones a TrigramIndex rules out.
+    // skip() is called from the threads of the search.
+    FolderSearch(
+        const std::string& folder, Skip skip, std::string_view query, bool regex, std::function<void()> found, size_t threads = 0
+    );
+    FolderSearch(const FolderSearch&) = delete;
+    FolderSearch& operator=(const FolderSearch&) = delete;
+    // stops the walk, the files that are being searched are searched to their end
+    ~FolderSearch();
+    // nullptr if the query compiled and the search runs, otherwise what is wrong with it
+    const char* getError() const;
+    // the results since the last call, a line "path:line:column: the line" for every line with a match,
+    // counting from 1 with the column in bytes. The results of a file are together, the files in no order.
+    std::string take();
+    // every file was searched and take() returned all results
+    bool isDone() const;
+    // stopped after maxResults
+    bool isTruncated() const {
+        return truncated;
+    }
+    size_t getResultCount() const {
+        return results;
+    }
+    size_t getFileCount() const {
+        return searched;
+    }
+    // the bytes of the files searched so far
+    size_t getByteCount() const {
+        return bytes;
+    }
+    const std::string& getFolder() const {
+        return folder;
+    }
+    const std::string& getQuery() const {
+        return query;
+    }
+    // the path, line and column of a line take() returned, false if it isn't one
+    static bool parse(std::string_view result, std::string& path, size_t& line, size_t& column);
+    private:
+    // false if the query doesn't compile
+    bool compile(bool isRegex);
+    void search(FolderWalk& walk, const std::string& path);
+    // the starts of the matches in a file
+    std::vector<size_t> matches(const char* data, size_t size) const;
+    // appends the results of a file
+    void add(FolderWalk& walk, std::string&& found, size_t count);
+    void finish();
+    std::string folder;
+    std::string query;
+    std::string error;
+    // one of them, depending on the query
+    std::optional<Finder> finder;
+    std::optional<Regex> regex;
+    std::function<void()> found;
+    Skip skip;
+    std::atomic<size_t> results = 0;
+    std::atomic<size_t> searched = 0;
+    std::atomic<size_t> bytes = 0;
+    std::atomic<bool> truncated = false;
+    mutable std::mutex resultsMutex;
+    // the results that weren't taken yet
+    std::string arrived;
+    // found() was called and take() wasn't yet
+    bool notified = false;
+    bool finished = false;
+    // last, its threads use everything above
+    std::unique_ptr<FolderWalk> walk;
+};
@@ -0,0 +1,355 @@
+#include "folderwalk.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// whether name matches the glob pattern of a .gitignore: * and ? stop at a /, ** doesn't,
+// [abc], [a-z] and [!abc] are classes and \ takes the next byte as it is
+static bool glob(std::string_view pattern, std::string_view name) {
+    size_t p = 0;
+    size_t n = 0;
+    while (p < pattern.size()) {
+        if (pattern[p] == '*') {
+            if (p+1 < pattern.size() && pattern[p+1] == '*') {
+                p += 2;
+                if (p < pattern.size() && pattern[p] == '/') {
+                    // **/ stands for any number of directories, none too
+                    p++;
+                    for (size_t rest = n; rest <= name.size(); rest++) {
+                        if ((rest == n || name[rest-1] == '/') && glob(pattern.substr(p), name.substr(rest))) {
+                            return true;
+                        }
+                    }
+                    return false;
+                }
+                for (size_t rest = n; rest <= name.size(); rest++) {
+                    if (glob(pattern.substr(p), name.substr(rest))) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+            p++;
+            for (size_t rest = n; rest <= name.size(); rest++) {
+                if (glob(pattern.substr(p), name.substr(rest))) {
+                    return true;
+                }
+                if (rest < name.size() && name[rest] == '/') {
+                    return false;
+                }
+            }
+            return false;
+        }
+        if (n == name.size()) {
+            return false;
+        }
+        const char c = name[n];
+        if (pattern[p] == '?') {
+            if (c == '/') {
+                return false;
+            }
+        } else if (pattern[p] == '[' && pattern.find(']', p+2) != std::string_view::npos) {
+            const size_t end = pattern.find(']', p+2);
+            size_t i = p+1;
+            const bool negated = pattern[i] == '!' || pattern[i] == '^';
+            i += negated;
+            bool in = false;
+            for (; i < end; i++) {
+                if (i+2 < end && pattern[i+1] == '-') {
+                    in |= pattern[i] <= c && c <= pattern[i+2];
+                    i += 2;
+                } else {
+                    in |= pattern[i] == c;
+                }
+            }
+            if (in == negated || c == '/') {
+                return false;
+            }
+            p = end;
+        } else {
+            if (pattern[p] == '\\' && p+1 < pattern.size()) {
+                p++;
+            }
+            if (pattern[p] != c) {
+                return false;
+            }
+        }
+        p++;
+        n++;
+    }
+    return n == name.size();
+}
+
+// the rules of one .gitignore and the ones of the directories above it
+struct FolderWalk::Ignore{
+    struct Rule{
+        std::string pattern;
+        // starts with !, what it matches is searched after all
+        bool negated;
+        // ends with /, only matches directories
+        bool directory;
+        // has a / before its end, matches the path from the .gitignore on and not only the name
+        bool anchored;
+    };
+    std::shared_ptr<const Ignore> parent;
+    // the directory of the .gitignore relative to the folder, empty or ending with a /
+    std::string base;
+    std::vector<Rule> rules;
+    // the rules of file for the directory base, parent if it has none
+    static std::shared_ptr<const Ignore> read(const std::string& file, const std::string& base, std::shared_ptr<const Ignore> parent) {
+        FILE* f = fopen(file.c_str(), "r");
+        if (!f) {
+            return parent;
+        }
+        auto ignore = std::make_shared<Ignore>(parent, base);
+        char* line = nullptr;
+        size_t capacity = 0;
+        for (ssize_t len; (len = getline(&line, &capacity, f)) >= 0;) {
+            std::string_view pattern(line, len);
+            while (!pattern.empty() && (pattern.back() == '\n' || pattern.back() == '\r')) {
+                pattern.remove_suffix(1);
+            }
+            // trailing spaces don't count unless they are escaped
+            while (pattern.ends_with(' ') && !pattern.ends_with("\\ ")) {
+                pattern.remove_suffix(1);
+            }
+            if (pattern.empty() || pattern[0] == '#') {
+                continue;
+            }
+            Rule rule{};
+            if (pattern[0] == '!') {
+                rule.negated = true;
+                pattern.remove_prefix(1);
+            }
+            if (pattern.ends_with('/')) {
+                rule.directory = true;
+                pattern.remove_suffix(1);
+            }
+            rule.anchored = pattern.find('/') != std::string_view::npos;
+            if (pattern.starts_with('/')) {
+                pattern.remove_prefix(1);
+            }
+            if (!pattern.empty()) {
+                rule.pattern = pattern;
+                ignore->rules.push_back(std::move(rule));
+            }
+        }
+        free(line);
+        fclose(f);
+        if (ignore->rules.empty()) {
+            return parent;
+        }
+        return ignore;
+    }
+    // whether path relative to the folder is ignored, the last rule that matches decides
+    // and the rules of a directory come before the ones above it
+    bool ignores(std::string_view path, bool isDirectory) const {
+        for (const Ignore* ignore = this; ignore; ignore = ignore->parent.get()) {
+            const std::string_view relative = path.substr(ignore->base.size());
+            const std::string_view name = relative.substr(relative.rfind('/')+1);
+            for (auto rule = ignore->rules.rbegin(); rule != ignore->rules.rend(); rule++) {
+                if (rule->directory && !isDirectory) {
+                    continue;
+                }
+                if (glob(rule->pattern, rule->anchored ? relative : name)) {
+                    return !rule->negated;
+                }
+            }
+        }
+        return false;
+    }
+};
+
+FolderWalk::FolderWalk(const std::string& folder, Visit visit, std::function<void()> done, size_t count)
+    : visit(std::move(visit)), done(std::move(done)) {
+    if (!folder.empty() && folder != ".") {
+        prefix = folder.ends_with('/') ? folder : folder+'/';
+    }
+    start(count);
+    push(0, Job{"", nullptr, true});
+    for (size_t i = 0; i < queues.size(); i++) {
+        threads.emplace_back([this, i] {
+            work(i);
+        });
+    }
+}
+
+FolderWalk::FolderWalk(const std::string& folder, const std::vector<std::string>& files, Visit visit, std::function<void()> done, size_t count)
+    : visit(std::move(visit)), done(std::move(done)) {
+    if (!folder.empty() && folder != ".") {
+        prefix = folder.ends_with('/') ? folder : folder+'/';
+    }
+    start(count);
+    // dealt out, so no thread has to steal to begin with
+    for (size_t i = 0; i < files.size(); i++) {
+        push(i % queues.size(), Job{files[i], nullptr, false});
+    }
+    for (size_t i = 0; i < queues.size(); i++) {
+        threads.emplace_back([this, i] {
+            work(i);
+        });
+    }
+}
+
+void FolderWalk::start(size_t count) {
+    if (!count) {
+        count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < count; i++) {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    running = count;
+    threads.reserve(count);
+}
+
+FolderWalk::~FolderWalk() {
+    stop();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void FolderWalk::stop() {
+    {
+        std::lock_guard lock(idleMutex);
+        stopping = true;
+    }
+    available.notify_all();
+}
+
+void FolderWalk::push(size_t self, Job&& job) {
+    pending++;
+    {
+        Queue& queue = *queues[self];
+        std::lock_guard lock(queue.mutex);
+        queue.jobs.push_back(std::move(job));
+        queued++;
+    }
+    available.notify_one();
+}
+
+bool FolderWalk::pop(size_t self, Job& job) {
+    {
+        // the newest of its own
+        Queue& queue = *queues[self];
+        std::lock_guard lock(queue.mutex);
+        if (!queue.jobs.empty()) {
+            job = std::move(queue.jobs.back());
+            queue.jobs.pop_back();
+            queued--;
+            return true;
+        }
+    }
+    // the oldest of another thread
+    for (size_t i = 1; i < queues.size(); i++) {
+        Queue& queue = *queues[(self+i) % queues.size()];
+        std::lock_guard lock(queue.mutex);
+        if (!queue.jobs.empty()) {
+            job = std::move(queue.jobs.front());
+            queue.jobs.pop_front();
+            queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void FolderWalk::work(size_t self) {
+    Job job;
+    while (!stopping && pending) {
+        if (pop(self, job)) {
+            if (job.directory) {
+                list(self, job);
+            } else {
+                visit(*this, job.path);
+            }
+            if (!--pending) {
+                std::lock_guard lock(idleMutex);
+                available.notify_all();
+            }
+            continue;
+        }
+        std::unique_lock lock(idleMutex);
+        // push() doesn't take the lock, a thread that missed its notification looks again after a while
+        available.wait_for(lock, std::chrono::milliseconds(1), [&] {
+            return stopping || !pending || queued;
+        });
+    }
+    if (!--running && done) {
+        done();
+    }
+}
+
+void FolderWalk::list(size_t self, const Job& job) {
+    const std::string directory = prefix+job.path;
+    DIR* dir = opendir(directory.empty() ? "." : directory.c_str());
+    if (!dir) {
+        return;
+    }
+    const std::shared_ptr<const Ignore> ignore = Ignore::read(directory+".gitignore", job.path, job.ignore);
+    while (const dirent* entry = readdir(dir)) {
+        const char* name = entry->d_name;
+        if (!strcmp(name, ".") || !strcmp(name, "..") || !strcmp(name, ".git")) {
+            continue;
+        }
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            // some file systems don't tell
+            struct stat st;
+            if (fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW)) {
+                continue;
+            }
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if (type != DT_DIR && type != DT_REG) {
+            continue;
+        }
+        const bool isDirectory = type == DT_DIR;
+        std::string path = job.path+name;
+        if (ignore && ignore->ignores(path, isDirectory)) {
+            continue;
+        }
+        if (isDirectory) {
+            path += '/';
+            push(self, Job{std::move(path), ignore, true});
+        } else {
+            push(self, Job{std::move(path), nullptr, false});
+        }
+    }
+    closedir(dir);
+}
+
+MappedFile::MappedFile(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size) {
+        close(fd);
+        return;
+    }
+    void* region = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        return;
+    }
+    madvise(region, st.st_size, MADV_WILLNEED);
+    mapped = static_cast<const char*>(region);
+    length = st.st_size;
+}
+
+MappedFile::~MappedFile() {
+    if (mapped) {
+        munmap(const_cast<char*>(mapped), length);
+    }
+}
+
+bool MappedFile::isBinary() const {
+    return memchr(mapped, 0, std::min(length, binaryProbe));
+}
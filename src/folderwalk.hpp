@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+// Visits the files below a folder on threads of its own.
+// Every thread has a deque of jobs, a directory to list or a file to visit. It takes the newest job of
+// its own, so it goes depth first and stays in one directory, and steals the oldest job of another thread
+// when it has none left, those are closest to the root and bring the most work with them.
+// What the .gitignore files on the way ignore is skipped, so are .git and symbolic links.
+class FolderWalk{
+    public:
+    // path is relative to the folder, walk.getPrefix()+path opens it
+    using Visit = std::function<void(FolderWalk& walk, const std::string& path)>;
+    // calls done() from the last thread when every file was visited or it was stopped
+    FolderWalk(const std::string& folder, Visit visit, std::function<void()> done, size_t threads = 0);
+    // visits files, relative to folder, instead of the files below it
+    FolderWalk(const std::string& folder, const std::vector<std::string>& files, Visit visit, std::function<void()> done, size_t threads = 0);
+    FolderWalk(const FolderWalk&) = delete;
+    FolderWalk& operator=(const FolderWalk&) = delete;
+    // stops and waits for the visits that run
+    ~FolderWalk();
+    // no more visits start, a visit may call it
+    void stop();
+    // folder with a / at the end, empty for the working directory
+    const std::string& getPrefix() const {
+        return prefix;
+    }
+    private:
+    struct Ignore;
+    struct Job{
+        std::string path;
+        // the rules of the .gitignore files of the directory and the ones above it
+        std::shared_ptr<const Ignore> ignore;
+        bool directory;
+    };
+    struct Queue{
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+    void start(size_t threads);
+    void work(size_t self);
+    void push(size_t self, Job&& job);
+    bool pop(size_t self, Job& job);
+    void list(size_t self, const Job& job);
+    std::string prefix;
+    Visit visit;
+    std::function<void()> done;
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    // threads that didn't return yet, the last one calls done()
+    std::atomic<size_t> running = 0;
+    // jobs that were pushed and didn't finish yet, the walk is over when none are left
+    std::atomic<size_t> pending = 0;
+    // jobs waiting in the queues
+    std::atomic<size_t> queued = 0;
+    std::atomic<bool> stopping = false;
+    std::mutex idleMutex;
+    std::condition_variable available;
+};
+
+// A file mapped read-only, the kernel reads ahead the rest while the start is looked at.
+// Empty if it can't be mapped or has no bytes.
+class MappedFile{
+    public:
+    // files with a NUL in this many first bytes are taken for binary
+    static constexpr size_t binaryProbe = 8 << 10;
+    explicit MappedFile(const std::string& path);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+    const char* data() const {
+        return mapped;
+    }
+    size_t size() const {
+        return length;
+    }
+    // what fstat said about it, zeros if it couldn't be opened
+    const struct stat& getStat() const {
+        return st;
+    }
+    bool isBinary() const;
+    private:
+    const char* mapped = nullptr;
+    size_t length = 0;
+    struct stat st{};
+};
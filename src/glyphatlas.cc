@@ -0,0 +1,161 @@
+#include "glyphatlas.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+// a white block in the top left corner of the texture, fill() samples it
+static constexpr int whiteSize = 2;
+
+size_t GlyphAtlas::KeyHash::operator()(const Key& key) const {
+    return std::hash<const void*>{}(key.font)
+        ^ (key.codepoint * 0x9E3779B97F4A7C15ull)
+        ^ (std::hash<float>{}(key.size) << 1);
+}
+
+GlyphAtlas::GlyphAtlas(GlyphAtlas&& moveFrom) {
+    *this = std::move(moveFrom);
+}
+
+GlyphAtlas& GlyphAtlas::operator=(GlyphAtlas&& moveFrom) {
+    std::swap(texture, moveFrom.texture);
+    std::swap(owner, moveFrom.owner);
+    glyphs.swap(moveFrom.glyphs);
+    vertices.swap(moveFrom.vertices);
+    indices.swap(moveFrom.indices);
+    std::swap(shelfX, moveFrom.shelfX);
+    std::swap(shelfY, moveFrom.shelfY);
+    std::swap(shelfHeight, moveFrom.shelfHeight);
+    std::swap(uploads, moveFrom.uploads);
+    return *this;
+}
+
+GlyphAtlas::~GlyphAtlas() {
+    clear();
+}
+
+void GlyphAtlas::clear() {
+    if (texture) {
+        SDL_DestroyTexture(texture);
+        texture = nullptr;
+    }
+    owner = nullptr;
+    glyphs.clear();
+    vertices.clear();
+    indices.clear();
+    shelfX = shelfY = shelfHeight = 0;
+}
+
+size_t GlyphAtlas::getUploads() const {
+    return uploads;
+}
+
+bool GlyphAtlas::createTexture(SDL_Renderer* renderer) {
+    if (owner == renderer && texture) {
+        return false;
+    }
+    clear();
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, atlasSize, atlasSize);
+    SDL_CHK(!!texture);
+    SDL_CHK(SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND));
+    SDL_CHK(SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST));
+    Uint32 white[whiteSize*whiteSize];
+    std::fill(std::begin(white), std::end(white), 0xFFFFFFFF);
+    const SDL_Rect whiteRect{0, 0, whiteSize, whiteSize};
+    SDL_CHK(SDL_UpdateTexture(texture, &whiteRect, white, whiteSize*sizeof(Uint32)));
+    owner = renderer;
+    shelfX = whiteSize;
+    shelfY = 0;
+    shelfHeight = whiteSize;
+    return true;
+}
+
+const GlyphAtlas::Glyph& GlyphAtlas::lookup(SDL_Renderer* renderer, TTF_Font* font, Uint32 codepoint) {
+    createTexture(renderer);
+    const Key key{font, codepoint, TTF_GetFontSize(font)};
+    if (const auto found = glyphs.find(key); found != glyphs.end()) {
+        return found->second;
+    }
+    int advance = 0;
+    if (!TTF_GetGlyphMetrics(font, codepoint, NULL, NULL, NULL, NULL, &advance)) {
+        advance = 0;
+    }
+    Glyph glyph{{0, 0, 0, 0}, static_cast<float>(advance)};
+    // whitespace has nothing to render and may come back as NULL
+    SDL_Surface* rendered = TTF_RenderGlyph_Blended(font, codepoint, SDL_Color{255, 255, 255, 255});
+    if (rendered) {
+        SDL_Surface* rgba = SDL_ConvertSurface(rendered, SDL_PIXELFORMAT_RGBA32);
+        SDL_DestroySurface(rendered);
+        SDL_CHK(!!rgba);
+        const int w = std::min(rgba->w, atlasSize-whiteSize);
+        const int h = std::min(rgba->h, atlasSize);
+        if (shelfX + w > atlasSize) {
+            shelfY += shelfHeight;
+            shelfX = 0;
+            shelfHeight = 0;
+        }
+        if (shelfY + h > atlasSize) {
+            // full, draw everything that still uses the old glyphs and start over
+            flush(renderer);
+            glyphs.clear();
+            shelfX = whiteSize;
+            shelfY = 0;
+            shelfHeight = whiteSize;
+        }
+        const SDL_Rect dst{shelfX, shelfY, w, h};
+        SDL_CHK(SDL_UpdateTexture(texture, &dst, rgba->pixels, rgba->pitch));
+        SDL_DestroySurface(rgba);
+        glyph.src = {static_cast<float>(shelfX), static_cast<float>(shelfY), static_cast<float>(w), static_cast<float>(h)};
+        shelfX += w;
+        shelfHeight = std::max(shelfHeight, h);
+        uploads++;
+    }
+    return glyphs.emplace(key, glyph).first->second;
+}
+
+void GlyphAtlas::quad(const SDL_FRect& dst, const SDL_FRect& src, SDL_FColor color) {
+    const int base = vertices.size();
+    const float u0 = src.x / atlasSize;
+    const float v0 = src.y / atlasSize;
+    const float u1 = (src.x+src.w) / atlasSize;
+    const float v1 = (src.y+src.h) / atlasSize;
+    vertices.push_back({{dst.x, dst.y}, color, {u0, v0}});
+    vertices.push_back({{dst.x+dst.w, dst.y}, color, {u1, v0}});
+    vertices.push_back({{dst.x, dst.y+dst.h}, color, {u0, v1}});
+    vertices.push_back({{dst.x+dst.w, dst.y+dst.h}, color, {u1, v1}});
+    indices.insert(indices.end(), {base, base+1, base+2, base+2, base+1, base+3});
+}
+
+float GlyphAtlas::draw(SDL_Renderer* renderer, TTF_Font* font, Uint32 codepoint, float x, float y, SDL_FColor color) {
+    const Glyph& glyph = lookup(renderer, font, codepoint);
+    if (glyph.src.w > 0) {
+        quad({x, y, glyph.src.w, glyph.src.h}, glyph.src, color);
+    }
+    return glyph.advance;
+}
+
+float GlyphAtlas::draw(SDL_Renderer* renderer, TTF_Font* font, const char* str, size_t len, float x, float y, SDL_FColor color) {
+    float width = 0;
+    while (len) {
+        width += draw(renderer, font, SDL_StepUTF8(&str, &len), x+width, y, color);
+    }
+    return width;
+}
+
+void GlyphAtlas::fill(SDL_Renderer* renderer, const SDL_FRect& rect, SDL_FColor color) {
+    createTexture(renderer);
+    quad(rect, {0, 0, whiteSize, whiteSize}, color);
+}
+
+float GlyphAtlas::advance(SDL_Renderer* renderer, TTF_Font* font, Uint32 codepoint) {
+    return lookup(renderer, font, codepoint).advance;
+}
+
+void GlyphAtlas::flush(SDL_Renderer* renderer) {
+    if (vertices.empty()) {
+        return;
+    }
+    SDL_CHK(SDL_RenderGeometry(renderer, texture, vertices.data(), vertices.size(), indices.data(), indices.size()));
+    vertices.clear();
+    indices.clear();
+}
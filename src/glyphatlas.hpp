@@ -0,0 +1,61 @@
+#pragma once
+
+#include <SDL3/SDL.h>
+#include <SDL3_ttf/SDL_ttf.h>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+// Every glyph is rasterized once (in white) into one texture.
+// draw() and fill() only append textured quads, flush() submits all of them
+// with a single SDL_RenderGeometry call. Colors are applied per vertex.
+class GlyphAtlas{
+    public:
+    static constexpr int atlasSize = 1024;
+    GlyphAtlas() = default;
+    GlyphAtlas(GlyphAtlas&&);
+    GlyphAtlas& operator=(GlyphAtlas&&);
+    GlyphAtlas(const GlyphAtlas&) = delete;
+    GlyphAtlas& operator=(const GlyphAtlas&) = delete;
+    ~GlyphAtlas();
+    // queues the glyph with its top left corner at (x, y), returns how far the pen moves
+    float draw(SDL_Renderer* renderer, TTF_Font* font, Uint32 codepoint, float x, float y, SDL_FColor color);
+    // queues a UTF-8 string, returns its width
+    float draw(SDL_Renderer* renderer, TTF_Font* font, const char* str, size_t len, float x, float y, SDL_FColor color);
+    // queues a solid rectangle in the same batch
+    void fill(SDL_Renderer* renderer, const SDL_FRect& rect, SDL_FColor color);
+    float advance(SDL_Renderer* renderer, TTF_Font* font, Uint32 codepoint);
+    // renders everything queued since the last flush
+    void flush(SDL_Renderer* renderer);
+    // drops the texture and all cached glyphs
+    void clear();
+    // how many glyphs have been uploaded to the texture so far
+    size_t getUploads() const;
+    private:
+    struct Key{
+        TTF_Font* font;
+        Uint32 codepoint;
+        float size;
+        bool operator==(const Key&) const = default;
+    };
+    struct KeyHash{
+        size_t operator()(const Key& key) const;
+    };
+    struct Glyph{
+        SDL_FRect src;
+        float advance;
+    };
+    const Glyph& lookup(SDL_Renderer* renderer, TTF_Font* font, Uint32 codepoint);
+    bool createTexture(SDL_Renderer* renderer);
+    void quad(const SDL_FRect& dst, const SDL_FRect& src, SDL_FColor color);
+    SDL_Texture* texture = nullptr;
+    SDL_Renderer* owner = nullptr;
+    std::unordered_map<Key, Glyph, KeyHash> glyphs{};
+    std::vector<SDL_Vertex> vertices{};
+    std::vector<int> indices{};
+    // shelf packing: glyphs are placed left to right in rows of shelfHeight
+    int shelfX = 0;
+    int shelfY = 0;
+    int shelfHeight = 0;
+    size_t uploads = 0;
+};
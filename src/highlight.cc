@@ -0,0 +1,382 @@
+#include "highlight.hpp"
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+// where a line starts, what the last line left open
+enum Open : uint8_t{
+    OPEN_NOTHING,
+    OPEN_BLOCK_COMMENT,
+    // a // comment ending in a backslash goes on in the next line
+    OPEN_LINE_COMMENT,
+    // so does a string
+    OPEN_STRING,
+    OPEN_RAW_STRING,
+    OPEN_MASK = 7,
+    // inside of a preprocessor directive that goes on in the next line
+    IN_DIRECTIVE = 8,
+    // an open raw string keeps the length of its delimiter in the upper bits instead
+    DELIMITER_SHIFT = 4,
+    MAX_DELIMITER = 15,
+};
+
+// sorted for binary_search
+static constexpr std::string_view keywords[] = {
+    "alignas", "alignof", "and", "and_eq", "asm", "bitand", "bitor", "break", "case", "catch", "class", "co_await",
+    "co_return", "co_yield", "compl", "concept", "const", "const_cast", "consteval", "constexpr", "constinit",
+    "continue", "decltype", "default", "delete", "do", "dynamic_cast", "else", "enum", "explicit", "export",
+    "extern", "false", "final", "for", "friend", "goto", "if", "inline", "mutable", "namespace", "new", "noexcept",
+    "not", "not_eq", "nullptr", "operator", "or", "or_eq", "override", "private", "protected", "public", "register",
+    "reinterpret_cast", "requires", "restrict", "return", "sizeof", "static", "static_assert", "static_cast",
+    "struct", "switch", "template", "this", "thread_local", "throw", "true", "try", "typedef", "typeid", "typename",
+    "union", "using", "virtual", "volatile", "while",
+};
+static constexpr std::string_view types[] = {
+    "auto", "bool", "char", "char16_t", "char32_t", "char8_t", "double", "float", "int", "int16_t", "int32_t",
+    "int64_t", "int8_t", "intptr_t", "long", "ptrdiff_t", "short", "signed", "size_t", "ssize_t", "uint16_t",
+    "uint32_t", "uint64_t", "uint8_t", "uintptr_t", "unsigned", "void", "wchar_t",
+};
+static_assert(std::is_sorted(std::begin(keywords), std::end(keywords)) && std::is_sorted(std::begin(types), std::end(types)));
+
+static bool isIdentifier(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || (c & 0x80);
+}
+
+static bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static Highlighter::Kind kindOf(std::string_view word) {
+    if (std::binary_search(std::begin(keywords), std::end(keywords), word)) {
+        return Highlighter::KEYWORD;
+    }
+    if (std::binary_search(std::begin(types), std::end(types), word)) {
+        return Highlighter::TYPE;
+    }
+    return Highlighter::TEXT;
+}
+
+// behind the ) and the delimiter and the " that end a raw string, searched from from on.
+// Only the length of the delimiter is known in the lines after the one that opened the string,
+// delimiter is nullptr there and any one of that length ends it.
+static size_t rawStringEnd(std::string_view line, size_t from, size_t length, const char* delimiter) {
+    while ((from = line.find(')', from)) != std::string_view::npos) {
+        const size_t quote = from+1+length;
+        if (quote < line.size() && line[quote] == '"' && (!delimiter || !line.compare(from+1, length, delimiter, length))) {
+            return quote+1;
+        }
+        from++;
+    }
+    return std::string_view::npos;
+}
+
+Highlighter::Language Highlighter::languageOf(std::string_view filename) {
+    static constexpr std::string_view extensions[] = {".c", ".h", ".cc", ".hh", ".cpp", ".hpp", ".cxx", ".hxx", ".inl", ".ipp"};
+    for (const std::string_view extension : extensions) {
+        if (filename.ends_with(extension)) {
+            return CPP;
+        }
+    }
+    return PLAIN;
+}
+
+void Highlighter::setLanguage(Language newLanguage) {
+    language = newLanguage;
+    states.assign(1, OPEN_NOTHING);
+    pending.clear();
+    cached.clear();
+    recolored = 0;
+}
+
+Highlighter::State Highlighter::lex(std::string_view line, State state, Tokens* tokens) const {
+    if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+    }
+    const bool continued = !line.empty() && line.back() == '\\';
+    uint8_t open = state & OPEN_MASK;
+    bool directive = open != OPEN_RAW_STRING && (state & IN_DIRECTIVE);
+    size_t delimiterLength = open == OPEN_RAW_STRING ? state >> DELIMITER_SHIFT : 0;
+    const char* delimiter = nullptr;
+    const size_t n = line.size();
+    size_t i = 0;
+    if (!open && !directive) {
+        while (i < n && (line[i] == ' ' || line[i] == '\t')) {
+            i++;
+        }
+        directive = i < n && line[i] == '#';
+    }
+    i = 0;
+    auto emit = [&](size_t at, Kind kind) {
+        if (!tokens) {
+            return;
+        }
+        if (directive && (kind == TEXT || kind == KEYWORD || kind == TYPE || kind == NUMBER)) {
+            kind = PREPROCESSOR;
+        }
+        if (!tokens->empty() && tokens->back().kind == kind) {
+            return;
+        }
+        if (!tokens->empty() && tokens->back().start == at) {
+            tokens->back().kind = kind;
+            return;
+        }
+        tokens->push_back({at, kind});
+    };
+    while (i < n) {
+        switch (open) {
+            case OPEN_BLOCK_COMMENT: {
+                emit(i, COMMENT);
+                const size_t end = line.find("*/", i);
+                if (end == std::string_view::npos) {
+                    i = n;
+                } else {
+                    i = end+2;
+                    open = OPEN_NOTHING;
+                }
+                continue;
+            }
+            case OPEN_LINE_COMMENT:
+                emit(i, COMMENT);
+                i = n;
+                continue;
+            case OPEN_STRING:
+                emit(i, STRING);
+                while (i < n && line[i] != '"') {
+                    i += line[i] == '\\' ? 2 : 1;
+                }
+                if (i < n) {
+                    i++;
+                    open = OPEN_NOTHING;
+                }
+                i = std::min(i, n);
+                continue;
+            case OPEN_RAW_STRING: {
+                emit(i, STRING);
+                const size_t end = rawStringEnd(line, i, delimiterLength, delimiter);
+                if (end == std::string_view::npos) {
+                    i = n;
+                } else {
+                    i = end;
+                    open = OPEN_NOTHING;
+                }
+                continue;
+            }
+            default:
+                break;
+        }
+        const char c = line[i];
+        const char next = i+1 < n ? line[i+1] : 0;
+        if (c == '/' && next == '/') {
+            open = OPEN_LINE_COMMENT;
+            continue;
+        }
+        if (c == '/' && next == '*') {
+            emit(i, COMMENT);
+            i += 2;
+            open = OPEN_BLOCK_COMMENT;
+            continue;
+        }
+        if (c == '"') {
+            emit(i, STRING);
+            i++;
+            open = OPEN_STRING;
+            continue;
+        }
+        if (c == '\'') {
+            // a character literal, digit separators are taken care of by the numbers
+            emit(i, STRING);
+            i++;
+            while (i < n && line[i] != '\'') {
+                i += line[i] == '\\' ? 2 : 1;
+            }
+            i = std::min(i+1, n);
+            continue;
+        }
+        if (isDigit(c) || (c == '.' && isDigit(next))) {
+            emit(i, NUMBER);
+            i++;
+            while (i < n && (isIdentifier(line[i]) || line[i] == '.' || line[i] == '\'' ||
+                ((line[i] == '+' || line[i] == '-') && (line[i-1] == 'e' || line[i-1] == 'E' || line[i-1] == 'p' || line[i-1] == 'P')))) {
+                i++;
+            }
+            continue;
+        }
+        if (isIdentifier(c)) {
+            const size_t start = i;
+            while (i < n && isIdentifier(line[i])) {
+                i++;
+            }
+            const std::string_view word = line.substr(start, i-start);
+            if (i < n && line[i] == '"') {
+                // the prefixes of string literals, R"delimiter( starts a raw string
+                if (word == "R" || word == "u8R" || word == "uR" || word == "UR" || word == "LR") {
+                    emit(start, STRING);
+                    const size_t paren = line.find('(', i);
+                    delimiter = line.data()+i+1;
+                    delimiterLength = (paren == std::string_view::npos ? n : paren)-i-1;
+                    i = paren == std::string_view::npos ? n : paren+1;
+                    open = OPEN_RAW_STRING;
+                    continue;
+                }
+                if (word == "u8" || word == "u" || word == "U" || word == "L") {
+                    emit(start, STRING);
+                    i++;
+                    open = OPEN_STRING;
+                    continue;
+                }
+            }
+            if (tokens) {
+                emit(start, kindOf(word));
+            }
+            continue;
+        }
+        emit(i, TEXT);
+        i++;
+    }
+    switch (open) {
+        case OPEN_BLOCK_COMMENT:
+            // a comment doesn't end a directive, the line break in it doesn't count
+            return OPEN_BLOCK_COMMENT | (directive ? IN_DIRECTIVE : 0);
+        case OPEN_RAW_STRING:
+            // a delimiter can have 16 characters, those are taken as 15 and never end the string, hardly anyone uses them
+            return OPEN_RAW_STRING | std::min<size_t>(delimiterLength, MAX_DELIMITER) << DELIMITER_SHIFT;
+        case OPEN_LINE_COMMENT:
+        case OPEN_STRING:
+            if (!continued) {
+                return OPEN_NOTHING;
+            }
+            return open | (directive ? IN_DIRECTIVE : 0);
+        default:
+            return directive && continued ? IN_DIRECTIVE : OPEN_NOTHING;
+    }
+}
+
+void Highlighter::edited(size_t line, size_t removedLines, size_t insertedLines) {
+    if (!isActive()) {
+        return;
+    }
+    const ssize_t moved = static_cast<ssize_t>(insertedLines) - static_cast<ssize_t>(removedLines);
+    dropCached(line, removedLines+1, moved);
+    if (line >= states.size()) {
+        return;
+    }
+    if (line+removedLines+1 >= states.size()) {
+        // nothing that was lexed is left behind the edit
+        forgetBehind(line);
+    } else {
+        // the removed lines are gone, the states of the new ones are unknown
+        if (insertedLines > removedLines) {
+            states.insert(states.begin()+line+1, insertedLines-removedLines, UNKNOWN);
+        } else {
+            states.erase(states.begin()+line+1, states.begin()+line+1+(removedLines-insertedLines));
+        }
+        std::fill(states.begin()+line+1, states.begin()+line+1+insertedLines, UNKNOWN);
+        const auto from = std::upper_bound(pending.begin(), pending.end(), line);
+        const auto behind = std::upper_bound(from, pending.end(), line+removedLines);
+        for (auto it = behind; it != pending.end(); ++it) {
+            *it += moved;
+        }
+        pending.erase(from, behind);
+    }
+    const auto at = std::lower_bound(pending.begin(), pending.end(), line);
+    if (at == pending.end() || *at != line) {
+        pending.insert(at, line);
+    }
+    if (pending.size() > maxPending) {
+        // edits all over the file, lexing everything behind the first of them when it is needed costs the same
+        forgetBehind(pending.front());
+    }
+}
+
+void Highlighter::settle(const Lines& lines, size_t upTo) {
+    size_t lexed = 0;
+    size_t done = 0;
+    for (; done < pending.size(); done++) {
+        size_t line = pending[done];
+        if (line > upTo) {
+            break;
+        }
+        if (line < lexed) {
+            // the lexing of an edit in front of it went through it
+            continue;
+        }
+        State state = states[line];
+        while (true) {
+            const State next = lex(lines(line, line, scratch), state, nullptr);
+            dropCached(line, 1);
+            line++;
+            if (line >= states.size() || states[line] == next) {
+                break;
+            }
+            states[line] = next;
+            recolored = std::min(recolored, line);
+            if (line > upTo) {
+                // the rest is lexed when it is looked at
+                dropCached(line, 1);
+                forgetBehind(line);
+                pending.clear();
+                return;
+            }
+            state = next;
+        }
+        lexed = line;
+    }
+    pending.erase(pending.begin(), pending.begin()+done);
+}
+
+const Highlighter::Tokens& Highlighter::tokens(const Lines& lines, size_t line) {
+    if (!isActive()) {
+        return empty;
+    }
+    settle(lines, line);
+    for (const Cached& entry : cached) {
+        if (entry.line == line) {
+            return entry.tokens;
+        }
+    }
+    while (states.size() <= line) {
+        const size_t first = states.size()-1;
+        std::string_view block = lines(first, std::min(line-1, first+linesPerBlock-1), scratch);
+        State state = states[first];
+        while (true) {
+            const size_t end = block.find('\n');
+            state = lex(block.substr(0, end), state, nullptr);
+            states.push_back(state);
+            if (end == std::string_view::npos) {
+                break;
+            }
+            block.remove_prefix(end+1);
+        }
+    }
+    if (cached.size() >= maxCachedLines) {
+        cached.clear();
+    }
+    Cached& entry = cached.emplace_back(Cached{line, {}});
+    lex(lines(line, line, scratch), states[line], &entry.tokens);
+    return entry.tokens;
+}
+
+size_t Highlighter::takeRecolored() {
+    return std::exchange(recolored, SIZE_MAX);
+}
+
+void Highlighter::forgetBehind(size_t line) {
+    // they are lexed again from a state that may differ
+    recolored = std::min(recolored, line+1);
+    states.resize(line+1);
+    pending.erase(std::upper_bound(pending.begin(), pending.end(), line), pending.end());
+    dropCached(line+1, SIZE_MAX-line-1);
+}
+
+void Highlighter::dropCached(size_t first, size_t count, ssize_t moved) {
+    std::erase_if(cached, [&](const Cached& entry) {
+        return entry.line >= first && entry.line < first+count;
+    });
+    if (moved) {
+        for (Cached& entry : cached) {
+            if (entry.line >= first+count) {
+                entry.line += moved;
+            }
+        }
+    }
+}
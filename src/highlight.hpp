@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+// Syntax highlighting that only lexes what changed. The state of the lexer at the start of every line
+// is kept from the first line down to the last line that was asked for, a line is lexed from its state alone.
+// An edit marks its first line and makes the states of the lines it added unknown. The next lookup lexes
+// from a marked line until the state at the start of a line is the one that was kept for it, or until it
+// gets past the lookup, then everything behind that line is forgotten and lexed again when it is needed.
+// The tokens of the last lines that were asked for are kept, drawing the same lines again lexes nothing.
+class Highlighter{
+    public:
+    enum Language : uint8_t{
+        PLAIN,
+        CPP,
+    };
+    enum Kind : uint8_t{
+        TEXT,
+        KEYWORD,
+        TYPE,
+        NUMBER,
+        STRING,
+        COMMENT,
+        PREPROCESSOR,
+    };
+    // the bytes of the line from start on, up to the next token, are of kind
+    struct Token{
+        size_t start;
+        Kind kind;
+    };
+    using Tokens = std::vector<Token>;
+    // the content of the lines [first, last] without the '\n' of the last one, scratch can hold it if it isn't in one piece
+    using Lines = std::function<std::string_view(size_t first, size_t last, std::string& scratch)>;
+    // edits this many lines apart before the next lookup are lexed again from the first of them on
+    static constexpr size_t maxPending = 64;
+    static constexpr size_t maxCachedLines = 512;
+    // lines that haven't been lexed yet are asked for this many at once
+    static constexpr size_t linesPerBlock = 1024;
+    // the language of a file by its name
+    static Language languageOf(std::string_view filename);
+    void setLanguage(Language language);
+    bool isActive() const {
+        return language != PLAIN;
+    }
+    // line had removedLines '\n' in the removed bytes and insertedLines in the inserted ones
+    void edited(size_t line, size_t removedLines, size_t insertedLines);
+    // the tokens of line, which has to exist, empty for plain text
+    const Tokens& tokens(const Lines& lines, size_t line);
+    // the first line whose tokens may have changed other than by an edit to it since the last call, SIZE_MAX if none did
+    size_t takeRecolored();
+    private:
+    using State = uint8_t;
+    // the lines behind an edit until the edit is lexed
+    static constexpr State UNKNOWN = 0xFF;
+    // lexes a line that starts in state, returns the state the next line starts in
+    State lex(std::string_view line, State state, Tokens* tokens) const;
+    // lexes from the pending lines on until the states converge or the lines behind upTo
+    void settle(const Lines& lines, size_t upTo);
+    // everything behind line is lexed again when it is needed
+    void forgetBehind(size_t line);
+    // forgets the tokens of [first, first+count) and moves the ones behind them by moved lines
+    void dropCached(size_t first, size_t count, ssize_t moved = 0);
+    Language language = PLAIN;
+    // the state at the start of every line up to the last one that was needed
+    std::vector<State> states{0};
+    // lines whose content changed but that weren't lexed since, sorted
+    std::vector<size_t> pending{};
+    struct Cached{
+        size_t line;
+        Tokens tokens;
+    };
+    std::vector<Cached> cached{};
+    // see takeRecolored()
+    size_t recolored = SIZE_MAX;
+    std::string scratch{};
+    Tokens empty{};
+};
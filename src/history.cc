@@ -0,0 +1,220 @@
+#include "history.hpp"
+#include <cassert>
+#include <cstring>
+
+const History::Record* History::undo() {
+    if (!applied) {
+        return nullptr;
+    }
+    records[applied-1].open = false;
+    return &records[--applied];
+}
+
+const History::Record* History::redo() {
+    if (applied == records.size()) {
+        return nullptr;
+    }
+    return &records[applied++];
+}
+
+void History::close() {
+    if (!records.empty()) {
+        records.back().open = false;
+    }
+}
+
+void History::beginBatch() {
+    batch = BATCH_STARTED;
+}
+
+void History::endBatch() {
+    batch = NO_BATCH;
+    close();
+}
+
+bool History::redoJoined() const {
+    return applied < records.size() && records[applied].joined;
+}
+
+void History::clear() {
+    records.clear();
+    chunks.clear();
+    applied = 0;
+    first = 0;
+    end = 0;
+    largeMemory = 0;
+}
+
+size_t History::getMemoryUsage() const {
+    return chunks.size()*chunkSize + records.size()*sizeof(Record) + largeMemory;
+}
+
+size_t History::getRecordCount() const {
+    return records.size();
+}
+
+bool History::eraseTyped(size_t offset, size_t removed, size_t len) {
+    if (len || !removed || records.empty() || applied != records.size()) {
+        return false;
+    }
+    Record& last = records.back();
+    if (!last.open || offset < last.offset || offset+removed != last.offset+last.inserted) {
+        return false;
+    }
+    // the typed bytes are the last ones in the arena
+    last.inserted -= removed;
+    truncate(end-removed);
+    if (!last.removed && !last.inserted) {
+        records.pop_back();
+        applied--;
+    }
+    return true;
+}
+
+bool History::extend(size_t offset, size_t removed, size_t len, bool backspace) {
+    if (records.empty() || applied != records.size()) {
+        return false;
+    }
+    Record& last = records.back();
+    if (!last.open || removed+len > maxCoalesced) {
+        return false;
+    }
+    if (!removed) {
+        // typing, the new bytes go right behind what the record inserted so far
+        if (offset != last.offset+last.inserted) {
+            return false;
+        }
+        last.inserted += len;
+        return true;
+    }
+    // removed bytes can only be added while nothing was typed, they are stored in front of the typed ones
+    if (len || last.inserted) {
+        return false;
+    }
+    if (backspace && last.backwards && offset+removed == last.offset) {
+        last.offset = offset;
+        last.removed += removed;
+        return true;
+    }
+    if (!backspace && !last.backwards && offset == last.offset) {
+        last.removed += removed;
+        return true;
+    }
+    return false;
+}
+
+void History::add(size_t offset, size_t removed, size_t len, bool backspace) {
+    // a new edit makes everything that was undone unreachable
+    if (applied < records.size()) {
+        truncate(records[applied].data);
+        for (size_t i = applied; i < records.size(); i++) {
+            forget(records[i]);
+        }
+        records.resize(applied);
+    }
+    close();
+    records.push_back({
+        .offset = offset,
+        .removed = removed,
+        .inserted = len,
+        .data = end,
+        .backwards = backspace,
+        .open = removed+len <= maxCoalesced,
+    });
+    applied++;
+}
+
+void History::addToBatch(size_t offset, size_t removed, size_t len, bool backspace) {
+    add(offset, removed, len, backspace);
+    records.back().open = false;
+    records.back().joined = batch == BATCH_JOINING;
+    batch = BATCH_JOINING;
+}
+
+void History::closeAfterNewLine() {
+    // one record per typed line, undoing a long session of typing shouldn't take all of it back at once
+    if (!records.empty() && records.back().inserted && byteAt(end-1) == '\n') {
+        records.back().open = false;
+    }
+}
+
+std::unique_ptr<char[]> History::inflate(const Record& record) const {
+    auto bytes = std::make_unique_for_overwrite<char[]>(record.large->size());
+    const bool inflated = record.large->inflate(bytes.get());
+    assert(inflated);
+    (void)inflated;
+    return bytes;
+}
+
+void History::forget(const Record& record) {
+    if (record.large) {
+        largeMemory -= record.large->memory();
+    }
+}
+
+void History::trim() {
+    // the last edit stays, even if it is larger than limit by itself
+    while (getMemoryUsage() > limit && records.size() > 1) {
+        if (!applied) {
+            // only undone records are left, the first of them can't be dropped without the others
+            clear();
+            return;
+        }
+        forget(records.front());
+        records.pop_front();
+        applied--;
+        // the rest of a step can't be undone without its first record either
+        while (!records.empty() && records.front().joined && applied) {
+            forget(records.front());
+            records.pop_front();
+            applied--;
+        }
+        const uint64_t keep = records.empty() ? end : records.front().data;
+        while (!chunks.empty() && keep-first >= chunkSize) {
+            chunks.pop_front();
+            first += chunkSize;
+        }
+    }
+}
+
+void History::append(const char* data, size_t len) {
+    while (len) {
+        if (end-first == chunks.size()*chunkSize) {
+            chunks.push_back(std::make_unique_for_overwrite<char[]>(chunkSize));
+        }
+        const size_t n = std::min(len, chunkSize - (end-first) % chunkSize);
+        std::memcpy(&byteAt(end), data, n);
+        end += n;
+        data += n;
+        len -= n;
+    }
+}
+
+void History::reserve(size_t len) {
+    end += len;
+    while (end-first > chunks.size()*chunkSize) {
+        chunks.push_back(std::make_unique_for_overwrite<char[]>(chunkSize));
+    }
+}
+
+void History::writeReversed(uint64_t pos, const char* data, size_t len) {
+    while (len) {
+        // the chunk of the byte in front of pos is filled from its back
+        const size_t inChunk = std::min<size_t>(len, (pos-1-first) % chunkSize + 1);
+        std::reverse_copy(data, data+inChunk, &byteAt(pos-inChunk));
+        pos -= inChunk;
+        data += inChunk;
+        len -= inChunk;
+    }
+}
+
+void History::truncate(uint64_t pos) {
+    end = pos;
+    while (!chunks.empty() && (chunks.size()-1)*chunkSize >= end-first) {
+        chunks.pop_back();
+    }
+}
+
+char& History::byteAt(uint64_t pos) const {
+    return chunks[(pos-first) / chunkSize][(pos-first) % chunkSize];
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "compressed.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Undo log of a Text. Every edit is one Record saying that the bytes at offset were
+// replaced, the removed and the inserted bytes are appended to an arena of fixed size chunks.
+// Typing and deleting one character after the other extends the last record instead of adding one.
+// The records of a batch, like one key typed at many cursors, are undone and redone together.
+// The oldest records are dropped when the log would use more than limit bytes.
+// An edit that is larger than limit by itself is deflated into its record instead of the arena, it stays
+// undoable even if everything in front of it has to go.
+class History{
+    public:
+    static constexpr size_t chunkSize = 64 << 10;
+    static constexpr size_t defaultLimit = 64 << 20;
+    // edits up to this size can extend the record in front of them
+    static constexpr size_t maxCoalesced = 64;
+    struct Record{
+        size_t offset = 0;
+        size_t removed = 0;
+        size_t inserted = 0;
+        // arena position of the removed bytes, the inserted ones follow them
+        uint64_t data = 0;
+        // the removed bytes are stored back to front, backspacing prepends to them
+        bool backwards = false;
+        // typing next to it still extends it
+        bool open = true;
+        // belongs to the same step as the record in front of it
+        bool joined = false;
+        // the removed and the inserted bytes of an edit too large for the arena, data is unused
+        std::shared_ptr<const Compressed> large{};
+    };
+    History(size_t limit = defaultLimit) : limit(limit) {}
+    History(History&&) = default;
+    History& operator=(History&&) = default;
+    // bytes [offset, offset+removed) were replaced by len bytes of inserted,
+    // removedSegments(f) has to call f(pointer, length) for the removed bytes in order
+    template <typename F>
+    void record(size_t offset, size_t removed, F&& removedSegments, const char* inserted, size_t len, bool backspace = false) {
+        if (removed+len > limit) {
+            addLarge(offset, removed, removedSegments, inserted, len);
+            trim();
+            return;
+        }
+        if (batch != NO_BATCH) {
+            addToBatch(offset, removed, len, backspace);
+        } else if (eraseTyped(offset, removed, len)) {
+            return;
+        } else if (!extend(offset, removed, len, backspace)) {
+            add(offset, removed, len, backspace);
+        }
+        if (backspace) {
+            // the segments come front to back, all of them are reversed as one
+            uint64_t back = end+removed;
+            reserve(removed);
+            removedSegments([&](const char* data, size_t n) {
+                writeReversed(back, data, n);
+                back -= n;
+            });
+        } else {
+            removedSegments([&](const char* data, size_t n) {
+                append(data, n);
+            });
+        }
+        append(inserted, len);
+        closeAfterNewLine();
+        trim();
+    }
+    // the record to revert, nullptr if there is nothing to undo
+    const Record* undo();
+    // the record to apply again, nullptr if there is nothing to redo
+    const Record* redo();
+    // the next edit starts a new record even if it is right next to the last one
+    void close();
+    // the records until endBatch() are one step, none of them is extended by later edits
+    void beginBatch();
+    void endBatch();
+    // the record redo() would return next belongs to the same step as the one it returned last
+    bool redoJoined() const;
+    void clear();
+    // calls f(pointer, length) for what record removed, in document order
+    template <typename F>
+    void removedBytes(const Record& record, F&& f) const {
+        if (record.large) {
+            const std::unique_ptr<char[]> bytes = inflate(record);
+            return f(bytes.get(), record.removed);
+        }
+        if (!record.backwards) {
+            return read(record.data, record.removed, f);
+        }
+        std::string forward;
+        forward.reserve(record.removed);
+        read(record.data, record.removed, [&](const char* data, size_t n) {
+            forward.append(data, n);
+        });
+        std::reverse(forward.begin(), forward.end());
+        f(forward.data(), forward.size());
+    }
+    // calls f(pointer, length) for what record inserted
+    template <typename F>
+    void insertedBytes(const Record& record, F&& f) const {
+        if (record.large) {
+            const std::unique_ptr<char[]> bytes = inflate(record);
+            return f(bytes.get()+record.removed, record.inserted);
+        }
+        read(record.data+record.removed, record.inserted, f);
+    }
+    // bytes used by the arena and the records
+    size_t getMemoryUsage() const;
+    size_t getRecordCount() const;
+    private:
+    // deleting what was just typed shortens the last record
+    bool eraseTyped(size_t offset, size_t removed, size_t len);
+    bool extend(size_t offset, size_t removed, size_t len, bool backspace);
+    void add(size_t offset, size_t removed, size_t len, bool backspace);
+    void addToBatch(size_t offset, size_t removed, size_t len, bool backspace);
+    template <typename F>
+    void addLarge(size_t offset, size_t removed, F&& removedSegments, const char* inserted, size_t len) {
+        std::vector<std::string_view> pieces;
+        removedSegments([&](const char* data, size_t n) {
+            pieces.emplace_back(data, n);
+        });
+        pieces.emplace_back(inserted, len);
+        if (batch != NO_BATCH) {
+            addToBatch(offset, removed, len, false);
+        } else {
+            add(offset, removed, len, false);
+        }
+        records.back().open = false;
+        records.back().large = std::make_shared<const Compressed>(pieces);
+        largeMemory += records.back().large->memory();
+    }
+    // the removed bytes of a large record followed by the inserted ones
+    std::unique_ptr<char[]> inflate(const Record& record) const;
+    // takes the memory of a record that is dropped off the books
+    void forget(const Record& record);
+    void closeAfterNewLine();
+    // drops the oldest records until the log fits into limit
+    void trim();
+    void append(const char* data, size_t len);
+    // len more bytes at the end of the arena that are written later
+    void reserve(size_t len);
+    // writes len bytes of data back to front in front of pos
+    void writeReversed(uint64_t pos, const char* data, size_t len);
+    // forgets everything from pos on
+    void truncate(uint64_t pos);
+    char& byteAt(uint64_t pos) const;
+    template <typename F>
+    void read(uint64_t pos, size_t len, F&& f) const {
+        while (len) {
+            const size_t inChunk = std::min<size_t>(len, chunkSize - (pos-first) % chunkSize);
+            f(&byteAt(pos), inChunk);
+            pos += inChunk;
+            len -= inChunk;
+        }
+    }
+    std::deque<Record> records;
+    // records[0, applied) are done, the rest was undone and can be redone
+    size_t applied = 0;
+    enum Batch{
+        NO_BATCH,
+        // the next record starts the step
+        BATCH_STARTED,
+        BATCH_JOINING,
+    };
+    Batch batch = NO_BATCH;
+    std::deque<std::unique_ptr<char[]>> chunks;
+    // arena position of the first byte of chunks.front() and behind the last appended byte
+    uint64_t first = 0;
+    uint64_t end = 0;
+    // what the large records hold
+    size_t largeMemory = 0;
+    size_t limit;
+};
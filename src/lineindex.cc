@@ -0,0 +1,485 @@
+#include "lineindex.hpp"
+#include "scan.hpp"
+#include <cassert>
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+struct LineIndex::Node{
+    size_t count = 0;
+    // levels is the number of inner levels from node down to its leafs, 0 means node is a leaf
+    static void summarize(const Node* node, size_t levels, size_t& bytes, size_t& lines);
+    static Node* insert(Node* node, size_t levels, size_t index, size_t length, size_t nodeLines);
+    static size_t erase(Node* node, size_t levels, size_t index);
+    static void free(Node* node, size_t levels);
+    template <typename F>
+    static void forEachLength(const Node* node, size_t levels, F&& f);
+};
+
+struct LineIndex::Leaf : Node{
+    size_t lengths[maxEntries+1];
+};
+
+struct LineIndex::Inner : Node{
+    size_t bytes[maxEntries+1];
+    size_t lines[maxEntries+1];
+    Node* children[maxEntries+1];
+    void removeAt(size_t i) {
+        std::memmove(bytes+i, bytes+i+1, (count-i-1)*sizeof(*bytes));
+        std::memmove(lines+i, lines+i+1, (count-i-1)*sizeof(*lines));
+        std::memmove(children+i, children+i+1, (count-i-1)*sizeof(*children));
+        count--;
+    }
+    void insertAt(size_t i, Node* child, size_t childBytes, size_t childLines) {
+        std::memmove(bytes+i+1, bytes+i, (count-i)*sizeof(*bytes));
+        std::memmove(lines+i+1, lines+i, (count-i)*sizeof(*lines));
+        std::memmove(children+i+1, children+i, (count-i)*sizeof(*children));
+        bytes[i] = childBytes;
+        lines[i] = childLines;
+        children[i] = child;
+        count++;
+    }
+    // merges children[left+1] into children[left] if they fit into one node
+    void merge(size_t left, size_t childLevels) {
+        Node* l = children[left];
+        Node* r = children[left+1];
+        if (l->count + r->count > maxEntries) {
+            return;
+        }
+        if (!childLevels) {
+            Leaf* ll = static_cast<Leaf*>(l);
+            Leaf* rl = static_cast<Leaf*>(r);
+            std::memcpy(ll->lengths+ll->count, rl->lengths, rl->count*sizeof(*rl->lengths));
+        } else {
+            Inner* li = static_cast<Inner*>(l);
+            Inner* ri = static_cast<Inner*>(r);
+            std::memcpy(li->bytes+li->count, ri->bytes, ri->count*sizeof(*ri->bytes));
+            std::memcpy(li->lines+li->count, ri->lines, ri->count*sizeof(*ri->lines));
+            std::memcpy(li->children+li->count, ri->children, ri->count*sizeof(*ri->children));
+        }
+        l->count += r->count;
+        r->count = 0;
+        bytes[left] += bytes[left+1];
+        lines[left] += lines[left+1];
+        Node::free(r, childLevels);
+        removeAt(left+1);
+    }
+};
+
+void LineIndex::Node::summarize(const Node* node, size_t levels, size_t& bytes, size_t& lines) {
+    bytes = 0;
+    lines = 0;
+    if (!levels) {
+        const Leaf* leaf = static_cast<const Leaf*>(node);
+        for (size_t i = 0; i < leaf->count; i++) {
+            bytes += leaf->lengths[i];
+        }
+        lines = leaf->count;
+        return;
+    }
+    const Inner* inner = static_cast<const Inner*>(node);
+    for (size_t i = 0; i < inner->count; i++) {
+        bytes += inner->bytes[i];
+        lines += inner->lines[i];
+    }
+}
+
+// returns the new right sibling if node had to be split
+LineIndex::Node* LineIndex::Node::insert(Node* node, size_t levels, size_t index, size_t length, size_t nodeLines) {
+    if (!levels) {
+        Leaf* leaf = static_cast<Leaf*>(node);
+        assert(index <= leaf->count);
+        std::memmove(leaf->lengths+index+1, leaf->lengths+index, (leaf->count-index)*sizeof(*leaf->lengths));
+        leaf->lengths[index] = length;
+        leaf->count++;
+        if (leaf->count <= maxEntries) {
+            return nullptr;
+        }
+        // appending keeps the left node full, so that indexing a file front to back doesn't leave half empty leafs
+        const size_t keep = index == leaf->count-1 ? maxEntries : leaf->count/2;
+        Leaf* right = new Leaf;
+        right->count = leaf->count-keep;
+        std::memcpy(right->lengths, leaf->lengths+keep, right->count*sizeof(*leaf->lengths));
+        leaf->count = keep;
+        return right;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    size_t c = 0;
+    if (index == nodeLines) {
+        c = inner->count-1;
+        index = inner->lines[c];
+    } else {
+        while (index > inner->lines[c]) {
+            index -= inner->lines[c];
+            c++;
+        }
+    }
+    const size_t childLines = inner->lines[c];
+    inner->bytes[c] += length;
+    inner->lines[c]++;
+    Node* split = insert(inner->children[c], levels-1, index, length, childLines);
+    if (!split) {
+        return nullptr;
+    }
+    size_t splitBytes, splitLines;
+    summarize(split, levels-1, splitBytes, splitLines);
+    inner->bytes[c] -= splitBytes;
+    inner->lines[c] -= splitLines;
+    inner->insertAt(c+1, split, splitBytes, splitLines);
+    if (inner->count <= maxEntries) {
+        return nullptr;
+    }
+    const size_t keep = c+2 == inner->count ? maxEntries : inner->count/2;
+    Inner* right = new Inner;
+    right->count = inner->count-keep;
+    std::memcpy(right->bytes, inner->bytes+keep, right->count*sizeof(*inner->bytes));
+    std::memcpy(right->lines, inner->lines+keep, right->count*sizeof(*inner->lines));
+    std::memcpy(right->children, inner->children+keep, right->count*sizeof(*inner->children));
+    inner->count = keep;
+    return right;
+}
+
+// returns the length of the erased line
+size_t LineIndex::Node::erase(Node* node, size_t levels, size_t index) {
+    if (!levels) {
+        Leaf* leaf = static_cast<Leaf*>(node);
+        assert(index < leaf->count);
+        const size_t length = leaf->lengths[index];
+        std::memmove(leaf->lengths+index, leaf->lengths+index+1, (leaf->count-index-1)*sizeof(*leaf->lengths));
+        leaf->count--;
+        return length;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    size_t c = 0;
+    while (index >= inner->lines[c]) {
+        index -= inner->lines[c];
+        c++;
+    }
+    assert(c < inner->count);
+    const size_t length = erase(inner->children[c], levels-1, index);
+    inner->bytes[c] -= length;
+    inner->lines[c]--;
+    if (!inner->children[c]->count) {
+        free(inner->children[c], levels-1);
+        inner->removeAt(c);
+    } else if (inner->children[c]->count < maxEntries/4 && inner->count > 1) {
+        inner->merge(c+1 < inner->count ? c : c-1, levels-1);
+    }
+    return length;
+}
+
+void LineIndex::Node::free(Node* node, size_t levels) {
+    if (!levels) {
+        delete static_cast<Leaf*>(node);
+        return;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    for (size_t i = 0; i < inner->count; i++) {
+        free(inner->children[i], levels-1);
+    }
+    delete inner;
+}
+
+template <typename F>
+void LineIndex::Node::forEachLength(const Node* node, size_t levels, F&& f) {
+    if (!levels) {
+        const Leaf* leaf = static_cast<const Leaf*>(node);
+        for (size_t i = 0; i < leaf->count; i++) {
+            f(leaf->lengths[i]);
+        }
+        return;
+    }
+    const Inner* inner = static_cast<const Inner*>(node);
+    for (size_t i = 0; i < inner->count; i++) {
+        forEachLength(inner->children[i], levels-1, f);
+    }
+}
+
+// bottom up construction from line lengths in order, nodes are left 3/4 full to leave room for edits
+class LineIndex::Builder{
+    static constexpr size_t fill = maxEntries - maxEntries/4;
+    std::vector<Node*> nodes;
+    Leaf* leaf = nullptr;
+    size_t bytes = 0;
+    size_t lines = 0;
+    public:
+    void push(size_t length) {
+        if (!leaf || leaf->count == fill) {
+            leaf = new Leaf;
+            nodes.push_back(leaf);
+        }
+        leaf->lengths[leaf->count++] = length;
+        bytes += length;
+        lines++;
+    }
+    void finish(LineIndex& index) {
+        if (!lines) {
+            push(0);
+        }
+        size_t height = 0;
+        while (nodes.size() > 1) {
+            std::vector<Node*> parents;
+            Inner* parent = nullptr;
+            for (Node* child : nodes) {
+                if (!parent || parent->count == fill) {
+                    parent = new Inner;
+                    parents.push_back(parent);
+                }
+                Node::summarize(child, height, parent->bytes[parent->count], parent->lines[parent->count]);
+                parent->children[parent->count++] = child;
+            }
+            nodes.swap(parents);
+            height++;
+        }
+        index.destroy(index.root, index.height);
+        index.root = nodes[0];
+        index.height = height;
+        index.totalBytes = bytes;
+        index.totalLines = lines;
+    }
+};
+
+// calls f with the offset of every '\n' in content
+template <typename F>
+static void forEachNewLine(const char* content, size_t len, F&& f) {
+    size_t positions[256];
+    size_t offset = 0;
+    while (offset < len) {
+        size_t scanned;
+        const size_t found = findBytes(content+offset, len-offset, '\n', positions, std::size(positions), scanned);
+        for (size_t i = 0; i < found; i++) {
+            f(offset+positions[i]);
+        }
+        offset += scanned;
+    }
+}
+
+LineIndex::LineIndex() {
+    Leaf* leaf = new Leaf;
+    leaf->count = 1;
+    leaf->lengths[0] = 0;
+    root = leaf;
+}
+
+LineIndex::LineIndex(LineIndex&& moveFrom) : LineIndex() {
+    *this = std::move(moveFrom);
+}
+
+LineIndex& LineIndex::operator=(LineIndex&& moveFrom) {
+    std::swap(root, moveFrom.root);
+    std::swap(height, moveFrom.height);
+    std::swap(totalBytes, moveFrom.totalBytes);
+    std::swap(totalLines, moveFrom.totalLines);
+    return *this;
+}
+
+LineIndex::~LineIndex() {
+    destroy(root, height);
+}
+
+void LineIndex::destroy(Node* node, size_t depth) {
+    if (node) {
+        Node::free(node, depth);
+    }
+}
+
+void LineIndex::assign(const char* content, size_t len) {
+    Builder builder;
+    size_t from = 0;
+    forEachNewLine(content, len, [&](size_t newLine) {
+        builder.push(newLine+1-from);
+        from = newLine+1;
+    });
+    builder.push(len-from);
+    builder.finish(*this);
+}
+
+void LineIndex::append(const char* content, size_t len) {
+    size_t from = 0;
+    forEachNewLine(content, len, [&](size_t newLine) {
+        addLength(totalLines-1, newLine+1-from);
+        insertLine(totalLines, 0);
+        from = newLine+1;
+    });
+    addLength(totalLines-1, len-from);
+}
+
+void LineIndex::inserted(size_t offset, const char* content, size_t len) {
+    if (!len) {
+        return;
+    }
+    const size_t line = lineOf(offset);
+    std::vector<size_t> lengths;
+    size_t from = 0;
+    forEachNewLine(content, len, [&](size_t newLine) {
+        lengths.push_back(newLine+1-from);
+        from = newLine+1;
+    });
+    if (lengths.empty()) {
+        addLength(line, len);
+        return;
+    }
+    const size_t head = offset - startOf(line);
+    const size_t tail = lengthOf(line) - head;
+    lengths.front() += head;
+    lengths.push_back(len-from + tail);
+    replace(line, 1, lengths);
+}
+
+void LineIndex::erased(size_t offset, size_t len) {
+    if (!len) {
+        return;
+    }
+    assert(offset+len <= totalBytes);
+    const size_t first = lineOf(offset);
+    const size_t last = lineOf(offset+len);
+    if (first == last) {
+        addLength(first, -static_cast<ssize_t>(len));
+        return;
+    }
+    const size_t head = offset - startOf(first);
+    const size_t tail = startOf(last) + lengthOf(last) - (offset+len);
+    replace(first, last-first+1, {head+tail});
+}
+
+void LineIndex::replace(size_t first, size_t count, const std::vector<size_t>& lengths) {
+    assert(count && !lengths.empty());
+    assert(first+count <= totalLines);
+    if ((count + lengths.size()) * 8 > totalLines) {
+        // touching a big part of the tree anyway, building it again is cheaper
+        Builder builder;
+        size_t line = 0;
+        Node::forEachLength(root, height, [&](size_t length) {
+            if (line == first) {
+                for (const size_t l : lengths) {
+                    builder.push(l);
+                }
+            }
+            if (line < first || line >= first+count) {
+                builder.push(length);
+            }
+            line++;
+        });
+        builder.finish(*this);
+        return;
+    }
+    for (size_t i = 1; i < count; i++) {
+        eraseLine(first+1);
+    }
+    addLength(first, lengths[0] - lengthOf(first));
+    for (size_t i = 1; i < lengths.size(); i++) {
+        insertLine(first+i, lengths[i]);
+    }
+}
+
+void LineIndex::addLength(size_t line, ssize_t delta) {
+    assert(line < totalLines);
+    Node* node = root;
+    for (size_t level = height; level; level--) {
+        Inner* inner = static_cast<Inner*>(node);
+        size_t c = 0;
+        while (line >= inner->lines[c]) {
+            line -= inner->lines[c];
+            c++;
+        }
+        inner->bytes[c] += delta;
+        node = inner->children[c];
+    }
+    static_cast<Leaf*>(node)->lengths[line] += delta;
+    totalBytes += delta;
+}
+
+void LineIndex::insertLine(size_t before, size_t length) {
+    Node* split = Node::insert(root, height, before, length, totalLines);
+    totalLines++;
+    totalBytes += length;
+    if (!split) {
+        return;
+    }
+    Inner* newRoot = new Inner;
+    Node::summarize(root, height, newRoot->bytes[0], newRoot->lines[0]);
+    Node::summarize(split, height, newRoot->bytes[1], newRoot->lines[1]);
+    newRoot->children[0] = root;
+    newRoot->children[1] = split;
+    newRoot->count = 2;
+    root = newRoot;
+    height++;
+}
+
+void LineIndex::eraseLine(size_t line) {
+    assert(totalLines > 1);
+    totalBytes -= Node::erase(root, height, line);
+    totalLines--;
+    while (height && root->count == 1) {
+        Inner* oldRoot = static_cast<Inner*>(root);
+        root = oldRoot->children[0];
+        delete oldRoot;
+        height--;
+    }
+}
+
+size_t LineIndex::lines() const {
+    return totalLines;
+}
+
+size_t LineIndex::bytes() const {
+    return totalBytes;
+}
+
+size_t LineIndex::lineOf(size_t offset) const {
+    size_t line = 0;
+    const Node* node = root;
+    for (size_t level = height; level; level--) {
+        const Inner* inner = static_cast<const Inner*>(node);
+        size_t c = 0;
+        while (c+1 < inner->count && offset >= inner->bytes[c]) {
+            offset -= inner->bytes[c];
+            line += inner->lines[c];
+            c++;
+        }
+        node = inner->children[c];
+    }
+    const Leaf* leaf = static_cast<const Leaf*>(node);
+    size_t c = 0;
+    while (c+1 < leaf->count && offset >= leaf->lengths[c]) {
+        offset -= leaf->lengths[c];
+        c++;
+    }
+    return line + c;
+}
+
+size_t LineIndex::startOf(size_t line) const {
+    assert(line < totalLines);
+    size_t offset = 0;
+    const Node* node = root;
+    for (size_t level = height; level; level--) {
+        const Inner* inner = static_cast<const Inner*>(node);
+        size_t c = 0;
+        while (line >= inner->lines[c]) {
+            line -= inner->lines[c];
+            offset += inner->bytes[c];
+            c++;
+        }
+        node = inner->children[c];
+    }
+    const Leaf* leaf = static_cast<const Leaf*>(node);
+    for (size_t c = 0; c < line; c++) {
+        offset += leaf->lengths[c];
+    }
+    return offset;
+}
+
+size_t LineIndex::lengthOf(size_t line) const {
+    assert(line < totalLines);
+    const Node* node = root;
+    for (size_t level = height; level; level--) {
+        const Inner* inner = static_cast<const Inner*>(node);
+        size_t c = 0;
+        while (line >= inner->lines[c]) {
+            line -= inner->lines[c];
+            c++;
+        }
+        node = inner->children[c];
+    }
+    return static_cast<const Leaf*>(node)->lengths[line];
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+#include <vector>
+
+// Lengths of all lines (including their '\n') in a B+tree whose inner nodes
+// know how many bytes and lines are below each child.
+// offset <-> line lookups and edits are O(log n).
+// There is always at least one (possibly empty) line, the last line has no '\n'.
+class LineIndex{
+    public:
+    static constexpr size_t maxEntries = 64;
+    LineIndex();
+    LineIndex(LineIndex&&);
+    LineIndex& operator=(LineIndex&&);
+    LineIndex(const LineIndex&) = delete;
+    LineIndex& operator=(const LineIndex&) = delete;
+    ~LineIndex();
+    // index the whole content from scratch
+    void assign(const char* content, size_t len);
+    // append to the end of the last line, adding a line for each '\n'
+    void append(const char* content, size_t len);
+    // len bytes of content were inserted at offset
+    void inserted(size_t offset, const char* content, size_t len);
+    // the bytes [offset, offset+len) were removed
+    void erased(size_t offset, size_t len);
+    size_t lines() const;
+    size_t bytes() const;
+    // the line containing offset, a '\n' belongs to the line it ends
+    size_t lineOf(size_t offset) const;
+    size_t startOf(size_t line) const;
+    // including the '\n'
+    size_t lengthOf(size_t line) const;
+    private:
+    struct Node;
+    struct Leaf;
+    struct Inner;
+    class Builder;
+    void addLength(size_t line, ssize_t delta);
+    void insertLine(size_t before, size_t length);
+    void eraseLine(size_t line);
+    // replaces the lines [first, first+count) with lines of the given lengths
+    void replace(size_t first, size_t count, const std::vector<size_t>& lengths);
+    void destroy(Node* node, size_t depth);
+    Node* root = nullptr;
+    size_t height = 0; // number of inner levels above the leafs
+    size_t totalBytes = 0;
+    size_t totalLines = 1;
+};
@@ -6,73 +6,270 @@
 #include <util.hpp>
 #include <logging.hpp>
 #include <options.hpp>
+#include <profiler.hpp>
+#include <recording.hpp>
+#include <snapshot.hpp>
+#include <memory>
+#include <vector>
 
 Editor editor;
 Options options;
 
+// F3 shows the frame times, see Profiler
+static bool showProfile = false;
+// --record writes the events that are handled into a file, --replay dispatches them again, see Recorder
+static std::unique_ptr<Recorder> recorder;
+static bool replaying = false;
+// --latency, or a recording or replay, reports how long it took from the events to the frame that showed them
+static bool measureLatency = false;
+static const char* latencyCsv = NULL;
+static Latencies latencies;
+// the events handled since the last frame that was presented, with when they happened
+static std::vector<std::pair<Uint32, Uint64>> unpresented;
+
+// the editor compresses the tabs that weren't looked at for a while when it is woken up by this
+static Uint32 SDLCALL idleTimer(void* userdata, SDL_TimerID timer, Uint32 interval) {
+    UNUSED(userdata);
+    UNUSED(timer);
+    SDL_Event event{};
+    event.type = SDL_EVENT_USER;
+    event.user.code = Editor::USER_EVENT_IDLE;
+    SDL_PushEvent(&event);
+    return interval;
+}
+
 void keyDown(SDL_KeyboardEvent key) {
+    if (key.key == SDLK_F3) {
+        showProfile = !showProfile;
+        editor.changed(Editor::DIRTY_WINDOW);
+        return;
+    }
+    if (key.key == SDLK_F12) {
+        // F12 writes what the profiler recorded for chrome://tracing
+        if (Profiler::exportTrace("trace.json")) {
+            SDL_LogInfo(CUSTOM_LOG_CATEGORY_EDITOR, "wrote trace.json\n");
+        } else {
+            SDL_LogWarn(CUSTOM_LOG_CATEGORY_EDITOR, "Error while writing trace.json\n");
+        }
+        return;
+    }
+    if (replaying && (key.mod & SDL_KMOD_LCTRL) && (key.key == SDLK_S || key.key == SDLK_O)) {
+        // a replay neither overwrites files nor waits for dialogs
+        return;
+    }
     editor.write(key);
 }
 
+bool dispatch(const SDL_Event& event) {
+    if (measureLatency && event.type != SDL_EVENT_USER) {
+        unpresented.emplace_back(event.type, event.common.timestamp);
+    }
+    switch(event.type) {
+        case SDL_EVENT_QUIT:
+            return false;
+        case SDL_EVENT_MOUSE_MOTION:
+            editor.mouseMotion(event.motion);
+            break;
+        case SDL_EVENT_MOUSE_BUTTON_DOWN:
+            editor.buttonDown(event.button);
+            break;
+        // case SDL_EVENT_MOUSE_BUTTON_UP:
+        case SDL_EVENT_MOUSE_WHEEL:
+            editor.scroll(event.wheel);
+            break;
+        case SDL_EVENT_KEY_DOWN:
+            keyDown(event.key);
+            break;
+        // case SDL_EVENT_KEY_UP:
+        case SDL_EVENT_TEXT_INPUT:
+            editor.write(event.text.text);
+            break;
+        case SDL_EVENT_USER:
+            editor.userEvent(event.user);
+            break;
+        case SDL_EVENT_DROP_FILE:
+            editor.open(event.drop.data);
+            break;
+        case SDL_EVENT_WINDOW_EXPOSED:
+        case SDL_EVENT_WINDOW_RESTORED:
+            editor.changed(Editor::DIRTY_WINDOW);
+            break;
+        // resizes are picked up by render() when the output size changes
+        // case SDL_EVENT_WINDOW_CLOSE_REQUESTED:
+        // case SDL_EVENT_TEXT_EDITING:
+        default:
+            break;
+    }
+    return true;
+}
+
+bool handleEvent(const SDL_Event& event) {
+    if (event.type == SDL_EVENT_KEY_DOWN && !SDL_GetKeyboardState(NULL)[event.key.scancode]) {
+        // the key was released before it was handled, the program was too slow
+        return true;
+    }
+    if (recorder) {
+        recorder->event(event, SDL_GetModState());
+    }
+    return dispatch(event);
+}
+
 bool handleEvents() {
     SDL_Event event;
+    // nothing to draw, sleep until something happens
+    const bool waited = !editor.needsRedraw() && SDL_WaitEvent(&event);
+    // the sleep isn't part of the frame
+    Zone zone("handleEvents");
+    if (waited && !handleEvent(event)) {
+        return false;
+    }
     while (SDL_PollEvent(&event)) {
-        switch(event.type) {
-            case SDL_EVENT_QUIT:
-                return false;
-            // case SDL_EVENT_MOUSE_MOTION:
-            case SDL_EVENT_MOUSE_BUTTON_DOWN:
-                editor.buttonDown(event.button);
-                break;
-            // case SDL_EVENT_MOUSE_BUTTON_UP:
-            case SDL_EVENT_MOUSE_WHEEL:
-                editor.scroll(event.wheel);
-                break;
-            case SDL_EVENT_KEY_DOWN:
-                keyDown(event.key);
-                break;
-            // case SDL_EVENT_KEY_UP:
-            case SDL_EVENT_TEXT_INPUT:
-                editor.write(event.text.text);
-                break;
-            // case SDL_EVENT_WINDOW_RESIZED:
-            // case SDL_EVENT_WINDOW_RESTORED:
-            // case SDL_EVENT_WINDOW_CLOSE_REQUESTED:
-            // case SDL_EVENT_DROP_FILE:
-            // case SDL_EVENT_MOUSE_WHEEL:
-            // case SDL_EVENT_TEXT_INPUT:
-            // case SDL_EVENT_TEXT_EDITING:
-            default:
-                break;
+        if (!handleEvent(event)) {
+            return false;
         }
     }
     return true;
 }
 
-void update() {
-    editor.update();
-}
+// the editor only redraws what changed, the rest of the last frame is kept in here
+static SDL_Texture* frame = NULL;
 
-void render(SDL_Renderer* renderer) {
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    SDL_RenderClear(renderer);
+// false if nothing changed and nothing was presented
+bool render(SDL_Renderer* renderer) {
+    Zone zone("render");
     int width, height;
-    SDL_GetWindowSize(SDL_GetRenderWindow(renderer), &width, &height);
+    SDL_CHK(SDL_GetRenderOutputSize(renderer, &width, &height));
+    float frameWidth = 0, frameHeight = 0;
+    if (frame) {
+        SDL_CHK(SDL_GetTextureSize(frame, &frameWidth, &frameHeight));
+    }
+    if (!frame || frameWidth != width || frameHeight != height) {
+        if (frame) {
+            SDL_DestroyTexture(frame);
+        }
+        frame = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_TARGET, width, height);
+        SDL_CHK(!!frame);
+        editor.changed(Editor::DIRTY_WINDOW);
+    }
+    if (!editor.needsRedraw()) {
+        return false;
+    }
+    SDL_CHK(SDL_SetRenderTarget(renderer, frame));
     editor.render(
         renderer,
         SDL_FRect{0, 0, (float)width, (float)height}
     );
+    SDL_CHK(SDL_SetRenderTarget(renderer, NULL));
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderClear(renderer);
+    SDL_CHK(SDL_RenderTexture(renderer, frame, NULL, NULL));
+    if (showProfile) {
+        // on top of the frame, the editor never draws over it
+        editor.renderProfile(renderer, SDL_FRect{0, 0, (float)width, (float)height});
+    }
     SDL_RenderPresent(renderer);
+    return true;
+}
+
+// after render(), the events that were handled before it are on the screen if it presented. If it didn't
+// they changed nothing, a later present is not theirs and would count the time the editor slept.
+void endFrame(bool presented) {
+    const Uint64 now = SDL_GetTicksNS();
+    for (const auto& [type, timestamp] : unpresented) {
+        if (presented) {
+            latencies.add(type, now > timestamp ? now-timestamp : 0);
+        } else {
+            latencies.addUnpresented(type);
+        }
+    }
+    unpresented.clear();
+    if (recorder) {
+        recorder->frame();
+    }
+    Profiler::endFrame();
+}
+
+// dispatches the frames of a recording one after the other, as fast as they are drawn.
+// 1 if a frame without events drew something afterwards, the editor has to sleep when nothing happens.
+int replay(Replay& recording, SDL_Renderer* renderer) {
+    std::vector<Replay::Event> events;
+    SDL_Event event;
+    while (recording.nextFrame(events)) {
+        // the session went on once its files were there
+        while (editor.isLoadingAny() && SDL_WaitEvent(&event)) {
+            if (event.type == SDL_EVENT_USER) {
+                dispatch(event);
+            }
+        }
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_EVENT_USER) {
+                dispatch(event);
+            }
+        }
+        // the latency of a replayed event starts when its frame does
+        const Uint64 start = SDL_GetTicksNS();
+        bool quit = false;
+        for (Replay::Event& recorded : events) {
+            recorded.event.common.timestamp = start;
+            // the editor asks SDL for the modifiers of clicks
+            SDL_SetModState(recorded.mod);
+            if (!dispatch(recorded.event)) {
+                quit = true;
+                break;
+            }
+        }
+        endFrame(render(renderer));
+        if (quit) {
+            break;
+        }
+    }
+    // what is still dirty is drawn once, after that nothing happens and nothing may be drawn
+    endFrame(render(renderer));
+    const size_t drawn = editor.getFrameCount();
+    endFrame(render(renderer));
+    if (editor.getFrameCount() != drawn) {
+        SDL_LogError(CUSTOM_LOG_CATEGORY_EDITOR, "a frame without events was drawn\n");
+        return 1;
+    }
+    return 0;
 }
 
 static TTF_Font* FreeMono30;
 TTF_Font* &selectedFont = FreeMono30;
 
 int main(int argc, char* argv[]) {
+    const char* recordPath = NULL;
+    const char* replayPath = NULL;
     for (int i = 1; i < argc; i++) {
         if (!strcmp(argv[i], "--underscore")) {
             options.underscore_is_word_break = true;
+        } else if (!strcmp(argv[i], "--index")) {
+            options.index_folder = true;
+        } else if (!strcmp(argv[i], "--profile")) {
+            showProfile = true;
+        } else if (!strcmp(argv[i], "--record") && i+1 < argc) {
+            recordPath = argv[++i];
+            measureLatency = true;
+        } else if (!strcmp(argv[i], "--replay") && i+1 < argc) {
+            replayPath = argv[++i];
+            measureLatency = true;
+        } else if (!strcmp(argv[i], "--latency")) {
+            measureLatency = true;
+            if (i+1 < argc && strncmp(argv[i+1], "--", 2)) {
+                latencyCsv = argv[++i];
+            }
+        }
+    }
+    std::unique_ptr<Replay> recording;
+    if (replayPath) {
+        recording = std::make_unique<Replay>(replayPath);
+        if (recording->getError()) {
+            SDL_LogCritical(SDL_LOG_CATEGORY_ERROR, "%s\n", recording->getError());
+            exit(1);
         }
+        replaying = true;
+        // nothing is shown, the frames are drawn into a surface
+        SDL_SetHint(SDL_HINT_VIDEO_DRIVER, "offscreen,dummy");
     }
     SDL_CHK(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS));
     SDL_CHK(TTF_Init());
@@ -84,8 +281,17 @@ int main(int argc, char* argv[]) {
     
     SDL_Window* window = NULL;
     SDL_Renderer* renderer = NULL;
-    SDL_CHK(SDL_CreateWindowAndRenderer("text editor", 1600, 900, SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE | SDL_WINDOW_MAXIMIZED | SDL_WINDOW_TRANSPARENT, &window, &renderer));
-    SDL_StartTextInput(window);
+    SDL_Surface* surface = NULL;
+    if (replaying) {
+        // the software renderer draws the same pixels on every machine
+        surface = SDL_CreateSurface(recording->getWidth(), recording->getHeight(), SDL_PIXELFORMAT_RGBA32);
+        SDL_CHK(!!surface);
+        renderer = SDL_CreateSoftwareRenderer(surface);
+        SDL_CHK(!!renderer);
+    } else {
+        SDL_CHK(SDL_CreateWindowAndRenderer("text editor", 1600, 900, SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE | SDL_WINDOW_MAXIMIZED | SDL_WINDOW_TRANSPARENT, &window, &renderer));
+        SDL_StartTextInput(window);
+    }
     
     FreeMono30 = TTF_OpenFont("/usr/share/fonts/truetype/freefont/FreeMono.ttf", 30);
     if (!FreeMono30) {
@@ -95,15 +301,46 @@ int main(int argc, char* argv[]) {
 
     editor = Editor(selectedFont);
     editor.open("src/main.cc");
-    while (handleEvents()) {
-        // Timer t("=================================\nframe");
-        update();
-        render(renderer);
+    const SDL_TimerID idle = SDL_AddTimer(Editor::compressAfterMs / 2, idleTimer, NULL);
+    int status = 0;
+    if (replaying) {
+        status = replay(*recording, renderer);
+    } else {
+        if (recordPath) {
+            int width, height;
+            SDL_CHK(SDL_GetRenderOutputSize(renderer, &width, &height));
+            recorder = std::make_unique<Recorder>(recordPath, width, height);
+            if (!recorder->isOpen()) {
+                SDL_LogWarn(CUSTOM_LOG_CATEGORY_EDITOR, "can't record into %s\n", recordPath);
+                recorder.reset();
+            }
+        }
+        while (handleEvents()) {
+            endFrame(render(renderer));
+        }
+        recorder.reset();
+    }
+    if (!latencies.empty()) {
+        latencies.report(stdout);
+    }
+    if (latencyCsv && !latencies.writeCsv(latencyCsv)) {
+        SDL_LogWarn(CUSTOM_LOG_CATEGORY_EDITOR, "Error while writing %s\n", latencyCsv);
+    }
+    SDL_RemoveTimer(idle);
+    // releases the glyph atlas while the renderer still exists
+    editor = Editor();
+    // the tabs are gone, the files they were saving to aren't written yet
+    Snapshot::waitForAll();
+    SDL_DestroyTexture(frame);
+    frame = NULL;
+    if (surface) {
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroySurface(surface);
     }
     TTF_CloseFont(FreeMono30);
     FreeMono30 = NULL;
     
     TTF_Quit();
     SDL_Quit();
-    return 0;
+    return status;
 }
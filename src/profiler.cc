@@ -0,0 +1,203 @@
+#include "profiler.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+// the slots are atomics so that exporting can read a ring while its thread writes, relaxed stores are plain stores
+struct Slot{
+    std::atomic<const char*> name{nullptr};
+    std::atomic<uint64_t> start{0};
+    std::atomic<uint64_t> end{0};
+    std::atomic<uint32_t> depth{0};
+};
+
+struct Ring{
+    std::array<Slot, Profiler::ringSize> slots{};
+    // zones ever written, the one at written-1 is in slots[(written-1) % ringSize]
+    std::atomic<uint64_t> written{0};
+    // a thread writes into it, rings of finished threads are taken over by new ones
+    std::atomic<bool> owned{true};
+};
+
+struct Recorded{
+    const char* name;
+    uint64_t start;
+    uint64_t end;
+    uint32_t depth;
+};
+
+// what stats() reports about one name
+struct Series{
+    const char* name;
+    std::array<float, Profiler::historySize> ms{};
+    size_t count = 0;
+    // the sum of the frame that is still running
+    float current = 0;
+    bool seen = false;
+};
+
+static const Profiler::Clock::time_point epoch = Profiler::Clock::now();
+static std::mutex ringsMutex;
+// never shrinks, the rings stay valid until the program ends
+static std::vector<std::unique_ptr<Ring>> rings;
+// what the main thread already summed up, only endFrame() touches it
+static uint64_t summed = 0;
+static std::vector<Series> series;
+
+static Ring* claimRing() {
+    std::lock_guard lock(ringsMutex);
+    for (auto& ring : rings) {
+        bool owned = false;
+        if (ring->owned.compare_exchange_strong(owned, true)) {
+            return ring.get();
+        }
+    }
+    rings.push_back(std::make_unique<Ring>());
+    return rings.back().get();
+}
+
+// gives the ring back when its thread ends, so a pool that starts threads over and over doesn't pile up rings
+struct ThreadRing{
+    Ring* ring = claimRing();
+    ~ThreadRing() {
+        ring->owned.store(false, std::memory_order_release);
+    }
+};
+
+static thread_local ThreadRing threadRing;
+static thread_local uint32_t depth = 0;
+
+static uint64_t sinceEpoch(Profiler::Clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time-epoch).count();
+}
+
+// the zones of ring in [from, written), the oldest ones are skipped if they were overwritten
+static void readRing(const Ring& ring, uint64_t from, std::vector<Recorded>& into) {
+    const uint64_t written = ring.written.load(std::memory_order_acquire);
+    from = std::max(from, written > Profiler::ringSize ? written-Profiler::ringSize : 0);
+    const size_t first = into.size();
+    for (uint64_t i = from; i < written; i++) {
+        const Slot& slot = ring.slots[i % Profiler::ringSize];
+        into.push_back({
+            slot.name.load(std::memory_order_relaxed),
+            slot.start.load(std::memory_order_relaxed),
+            slot.end.load(std::memory_order_relaxed),
+            slot.depth.load(std::memory_order_relaxed),
+        });
+    }
+    // the writer may have lapped what was read in the meantime
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t after = ring.written.load(std::memory_order_relaxed);
+    if (after > from + Profiler::ringSize) {
+        const size_t torn = std::min<uint64_t>(after - Profiler::ringSize - from, into.size()-first);
+        into.erase(into.begin()+first, into.begin()+first+torn);
+    }
+}
+
+static Series& seriesOf(const char* name) {
+    for (auto& s : series) {
+        // the same literal can have different addresses in different translation units
+        if (s.name == name || !strcmp(s.name, name)) {
+            return s;
+        }
+    }
+    return series.emplace_back(Series{name});
+}
+
+static float percentile(const std::vector<float>& sorted, float p) {
+    return sorted[std::min<size_t>(sorted.size()-1, p*sorted.size())];
+}
+
+uint32_t Profiler::enter() {
+    return depth++;
+}
+
+void Profiler::leave(const char* name, Clock::time_point start, Clock::time_point end, uint32_t zoneDepth) {
+    depth = zoneDepth;
+    Ring& ring = *threadRing.ring;
+    const uint64_t written = ring.written.load(std::memory_order_relaxed);
+    Slot& slot = ring.slots[written % ringSize];
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.start.store(sinceEpoch(start), std::memory_order_relaxed);
+    slot.end.store(sinceEpoch(end), std::memory_order_relaxed);
+    slot.depth.store(zoneDepth, std::memory_order_relaxed);
+    ring.written.store(written+1, std::memory_order_release);
+}
+
+void Profiler::endFrame() {
+    static std::vector<Recorded> zones;
+    zones.clear();
+    const Ring& ring = *threadRing.ring;
+    readRing(ring, summed, zones);
+    summed = ring.written.load(std::memory_order_relaxed);
+    if (series.empty()) {
+        series.push_back(Series{"frame"});
+    }
+    float frame = 0;
+    for (const Recorded& zone : zones) {
+        const float ms = (zone.end-zone.start) / 1e6f;
+        if (!zone.depth) {
+            frame += ms;
+        }
+        Series& s = seriesOf(zone.name);
+        s.current += ms;
+        s.seen = true;
+    }
+    if (!zones.empty()) {
+        series[0].current = frame;
+        series[0].seen = true;
+    }
+    for (auto& s : series) {
+        if (s.seen) {
+            s.ms[s.count++ % historySize] = s.current;
+        }
+        s.current = 0;
+        s.seen = false;
+    }
+}
+
+std::vector<Profiler::Stats> Profiler::stats() {
+    std::vector<Stats> result;
+    std::vector<float> sorted;
+    for (const auto& s : series) {
+        if (!s.count) {
+            continue;
+        }
+        sorted.assign(s.ms.begin(), s.ms.begin()+std::min(s.count, historySize));
+        std::sort(sorted.begin(), sorted.end());
+        result.push_back({
+            s.name, sorted.size(),
+            percentile(sorted, 0.5), percentile(sorted, 0.9), percentile(sorted, 0.99), sorted.back(),
+        });
+    }
+    return result;
+}
+
+bool Profiler::exportTrace(const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        return false;
+    }
+    std::vector<Recorded> zones;
+    fputs("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n", f);
+    bool first = true;
+    std::lock_guard lock(ringsMutex);
+    for (size_t thread = 0; thread < rings.size(); thread++) {
+        zones.clear();
+        readRing(*rings[thread], 0, zones);
+        for (const Recorded& zone : zones) {
+            // the names are literals from the code, nothing in them needs escaping
+            fprintf(
+                f, "%s{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %zu}",
+                first ? "" : ",\n", zone.name, zone.start / 1e3, (zone.end-zone.start) / 1e3, thread
+            );
+            first = false;
+        }
+    }
+    fputs("\n]}\n", f);
+    return !fclose(f);
+}
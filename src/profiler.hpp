@@ -0,0 +1,51 @@
+#pragma once
+
+#include <util.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Records where the time of a frame goes. A Zone is a Timer that writes what it measured into a ring
+// of its thread instead of printing it, zones nest and the ring keeps the last ringSize of them.
+// Only the thread that owns a ring writes to it, so recording takes no lock.
+// The main loop calls endFrame() once per iteration, the zones of the main thread in that frame are
+// summed up by name and the last historySize sums of every name give the percentiles of stats().
+// exportTrace() writes the zones of all threads as Chrome trace events, chrome://tracing and Perfetto open them.
+class Profiler{
+    public:
+    static constexpr size_t ringSize = 1 << 14;
+    static constexpr size_t historySize = 256;
+    using Clock = std::chrono::high_resolution_clock;
+    struct Stats{
+        const char* name;
+        // how many of the last frames had the zone
+        size_t frames;
+        // milliseconds per frame
+        float p50;
+        float p90;
+        float p99;
+        float max;
+    };
+    // how deep the zone that starts now is nested
+    static uint32_t enter();
+    static void leave(const char* name, Clock::time_point start, Clock::time_point end, uint32_t depth);
+    static void endFrame();
+    // "frame" is the sum of the outermost zones, the other names follow in the order they first ended
+    static std::vector<Stats> stats();
+    // false if path couldn't be written
+    static bool exportTrace(const char* path);
+};
+
+// the Report of a Zone
+struct ProfileZone{
+    uint32_t depth = Profiler::enter();
+    template <class Rep>
+    void operator()(const char* name, Profiler::Clock::time_point start, Profiler::Clock::time_point end, Rep elapsed) {
+        UNUSED(elapsed);
+        Profiler::leave(name, start, end, depth);
+    }
+};
+
+// Zone zone("name"); measures the rest of the scope, name has to outlive the profiler like a string literal does
+using Zone = Timer<std::chrono::nanoseconds, ProfileZone>;
@@ -0,0 +1,360 @@
+#include "recording.hpp"
+#include <algorithm>
+#include <cstring>
+
+static_assert(SDL_BYTEORDER == SDL_LIL_ENDIAN, "recordings are written as they are in memory");
+
+// what the header says about the session
+struct Header{
+    char magic[sizeof(Recorder::magic)];
+    int32_t width;
+    int32_t height;
+};
+
+Recorder::Recorder(const char* path, int width, int height) {
+    file = fopen(path, "wb");
+    if (!file) {
+        return;
+    }
+    Header header{};
+    memcpy(header.magic, magic, sizeof(magic));
+    header.width = width;
+    header.height = height;
+    put(&header, sizeof(header));
+}
+
+Recorder::~Recorder() {
+    if (file) {
+        frame();
+        fclose(file);
+    }
+}
+
+void Recorder::put(const void* data, size_t len) {
+    fwrite(data, 1, len, file);
+}
+
+void Recorder::putVarint(uint64_t value) {
+    uint8_t bytes[10];
+    size_t len = 0;
+    do {
+        bytes[len] = value & 0x7F;
+        value >>= 7;
+        bytes[len++] |= value ? 0x80 : 0;
+    } while (value);
+    put(bytes, len);
+}
+
+void Recorder::putString(const char* str) {
+    const size_t len = str ? strlen(str) : 0;
+    putVarint(len);
+    put(str, len);
+}
+
+void Recorder::event(const SDL_Event& event, SDL_Keymod mod) {
+    Tag tag;
+    switch (event.type) {
+        case SDL_EVENT_KEY_DOWN: tag = TAG_KEY_DOWN; break;
+        case SDL_EVENT_TEXT_INPUT: tag = TAG_TEXT_INPUT; break;
+        case SDL_EVENT_MOUSE_MOTION: tag = TAG_MOUSE_MOTION; break;
+        case SDL_EVENT_MOUSE_BUTTON_DOWN: tag = TAG_MOUSE_BUTTON_DOWN; break;
+        case SDL_EVENT_MOUSE_WHEEL: tag = TAG_MOUSE_WHEEL; break;
+        case SDL_EVENT_DROP_FILE: tag = TAG_DROP_FILE; break;
+        case SDL_EVENT_WINDOW_EXPOSED: tag = TAG_WINDOW_EXPOSED; break;
+        case SDL_EVENT_WINDOW_RESTORED: tag = TAG_WINDOW_RESTORED; break;
+        case SDL_EVENT_QUIT: tag = TAG_QUIT; break;
+        // the workers' events come again when the replay does the same work
+        default: return;
+    }
+    if (!file) {
+        return;
+    }
+    put(&tag, 1);
+    const uint64_t timestamp = event.common.timestamp;
+    putVarint(lastTimestamp && timestamp > lastTimestamp ? (timestamp-lastTimestamp) / 1000 : 0);
+    lastTimestamp = timestamp;
+    put(&mod, sizeof(mod));
+    switch (tag) {
+        case TAG_KEY_DOWN: {
+            const SDL_KeyboardEvent& key = event.key;
+            putVarint(key.key);
+            putVarint(key.scancode);
+            put(&key.mod, sizeof(key.mod));
+            put(&key.repeat, 1);
+            break;
+        }
+        case TAG_TEXT_INPUT:
+            putString(event.text.text);
+            break;
+        case TAG_MOUSE_MOTION: {
+            const SDL_MouseMotionEvent& motion = event.motion;
+            put(&motion.x, sizeof(float));
+            put(&motion.y, sizeof(float));
+            putVarint(motion.state);
+            break;
+        }
+        case TAG_MOUSE_BUTTON_DOWN: {
+            const SDL_MouseButtonEvent& button = event.button;
+            put(&button.button, 1);
+            put(&button.clicks, 1);
+            put(&button.x, sizeof(float));
+            put(&button.y, sizeof(float));
+            break;
+        }
+        case TAG_MOUSE_WHEEL: {
+            const SDL_MouseWheelEvent& wheel = event.wheel;
+            const uint8_t direction = wheel.direction;
+            put(&wheel.x, sizeof(float));
+            put(&wheel.y, sizeof(float));
+            put(&wheel.integer_x, sizeof(int32_t));
+            put(&wheel.integer_y, sizeof(int32_t));
+            put(&direction, 1);
+            put(&wheel.mouse_x, sizeof(float));
+            put(&wheel.mouse_y, sizeof(float));
+            break;
+        }
+        case TAG_DROP_FILE:
+            putString(event.drop.data);
+            break;
+        default:
+            break;
+    }
+    framed = false;
+}
+
+void Recorder::frame() {
+    // iterations that only handled the workers' events are merged into the next frame
+    if (!file || framed) {
+        return;
+    }
+    const Tag tag = TAG_FRAME;
+    put(&tag, 1);
+    framed = true;
+}
+
+Replay::Replay(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        error = std::string("can't open ") + path;
+        return;
+    }
+    uint8_t buffer[1 << 16];
+    size_t len;
+    while ((len = fread(buffer, 1, sizeof(buffer), file))) {
+        content.insert(content.end(), buffer, buffer+len);
+    }
+    fclose(file);
+    Header header;
+    if (!get(&header, sizeof(header)) || memcmp(header.magic, Recorder::magic, sizeof(header.magic))) {
+        error = std::string(path) + " isn't a recording";
+        return;
+    }
+    if (header.width <= 0 || header.height <= 0) {
+        error = std::string(path) + " has no output size";
+        return;
+    }
+    width = header.width;
+    height = header.height;
+}
+
+const char* Replay::getError() const {
+    return error.empty() ? nullptr : error.c_str();
+}
+
+bool Replay::get(void* data, size_t len) {
+    if (content.size()-read < len) {
+        read = content.size();
+        return false;
+    }
+    memcpy(data, content.data()+read, len);
+    read += len;
+    return true;
+}
+
+bool Replay::getVarint(uint64_t& value) {
+    value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        uint8_t byte;
+        if (!get(&byte, 1)) {
+            return false;
+        }
+        value |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Replay::getString(std::string& str) {
+    uint64_t len;
+    if (!getVarint(len) || len > content.size()-read) {
+        return false;
+    }
+    str.assign((const char*)content.data()+read, len);
+    read += len;
+    return true;
+}
+
+bool Replay::nextFrame(std::vector<Event>& events) {
+    events.clear();
+    if (!error.empty()) {
+        return false;
+    }
+    while (read < content.size()) {
+        uint8_t tag;
+        get(&tag, 1);
+        if (tag == Recorder::TAG_FRAME) {
+            break;
+        }
+        Event& recorded = events.emplace_back();
+        SDL_Event& event = recorded.event;
+        memset(&event, 0, sizeof(event));
+        bool complete = getVarint(recorded.delay) && get(&recorded.mod, sizeof(recorded.mod));
+        uint64_t value;
+        switch (tag) {
+            case Recorder::TAG_KEY_DOWN: {
+                SDL_KeyboardEvent& key = event.key;
+                key.type = SDL_EVENT_KEY_DOWN;
+                key.down = true;
+                complete = complete && getVarint(value);
+                key.key = value;
+                complete = complete && getVarint(value);
+                key.scancode = (SDL_Scancode)value;
+                complete = complete && get(&key.mod, sizeof(key.mod)) && get(&key.repeat, 1);
+                break;
+            }
+            case Recorder::TAG_TEXT_INPUT:
+                event.type = SDL_EVENT_TEXT_INPUT;
+                complete = complete && getString(recorded.data);
+                break;
+            case Recorder::TAG_MOUSE_MOTION: {
+                SDL_MouseMotionEvent& motion = event.motion;
+                motion.type = SDL_EVENT_MOUSE_MOTION;
+                complete = complete && get(&motion.x, sizeof(float)) && get(&motion.y, sizeof(float)) && getVarint(value);
+                motion.state = value;
+                break;
+            }
+            case Recorder::TAG_MOUSE_BUTTON_DOWN: {
+                SDL_MouseButtonEvent& button = event.button;
+                button.type = SDL_EVENT_MOUSE_BUTTON_DOWN;
+                button.down = true;
+                complete = complete && get(&button.button, 1) && get(&button.clicks, 1)
+                    && get(&button.x, sizeof(float)) && get(&button.y, sizeof(float));
+                break;
+            }
+            case Recorder::TAG_MOUSE_WHEEL: {
+                SDL_MouseWheelEvent& wheel = event.wheel;
+                wheel.type = SDL_EVENT_MOUSE_WHEEL;
+                uint8_t direction = 0;
+                complete = complete && get(&wheel.x, sizeof(float)) && get(&wheel.y, sizeof(float))
+                    && get(&wheel.integer_x, sizeof(int32_t)) && get(&wheel.integer_y, sizeof(int32_t))
+                    && get(&direction, 1) && get(&wheel.mouse_x, sizeof(float)) && get(&wheel.mouse_y, sizeof(float));
+                wheel.direction = (SDL_MouseWheelDirection)direction;
+                break;
+            }
+            case Recorder::TAG_DROP_FILE:
+                event.type = SDL_EVENT_DROP_FILE;
+                complete = complete && getString(recorded.data);
+                break;
+            case Recorder::TAG_WINDOW_EXPOSED:
+                event.type = SDL_EVENT_WINDOW_EXPOSED;
+                break;
+            case Recorder::TAG_WINDOW_RESTORED:
+                event.type = SDL_EVENT_WINDOW_RESTORED;
+                break;
+            case Recorder::TAG_QUIT:
+                event.type = SDL_EVENT_QUIT;
+                break;
+            default:
+                complete = false;
+                break;
+        }
+        if (!complete) {
+            // a session that ended without closing the recording, the rest is lost
+            events.pop_back();
+            read = content.size();
+            break;
+        }
+    }
+    // only now that events doesn't grow anymore
+    for (Event& recorded : events) {
+        if (recorded.event.type == SDL_EVENT_TEXT_INPUT) {
+            recorded.event.text.text = recorded.data.c_str();
+        } else if (recorded.event.type == SDL_EVENT_DROP_FILE) {
+            recorded.event.drop.data = recorded.data.c_str();
+        }
+    }
+    return !events.empty() || read < content.size();
+}
+
+static const char* typeName(uint32_t type) {
+    switch (type) {
+        case SDL_EVENT_KEY_DOWN: return "key down";
+        case SDL_EVENT_TEXT_INPUT: return "text input";
+        case SDL_EVENT_MOUSE_MOTION: return "mouse motion";
+        case SDL_EVENT_MOUSE_BUTTON_DOWN: return "mouse button";
+        case SDL_EVENT_MOUSE_WHEEL: return "mouse wheel";
+        case SDL_EVENT_DROP_FILE: return "drop file";
+        case SDL_EVENT_WINDOW_EXPOSED: return "window exposed";
+        case SDL_EVENT_WINDOW_RESTORED: return "window restored";
+        case SDL_EVENT_QUIT: return "quit";
+        default: return "other";
+    }
+}
+
+static double percentile(const std::vector<uint64_t>& sorted, double p) {
+    return sorted[std::min<size_t>(sorted.size()-1, p*sorted.size())] / 1e3;
+}
+
+void Latencies::add(uint32_t type, uint64_t ns) {
+    samples.push_back({type, ns});
+}
+
+void Latencies::addUnpresented(uint32_t type) {
+    unpresented.push_back(type);
+}
+
+void Latencies::report(FILE* out) const {
+    std::vector<uint32_t> types(unpresented.begin(), unpresented.end());
+    for (const Sample& sample : samples) {
+        types.push_back(sample.type);
+    }
+    std::sort(types.begin(), types.end());
+    types.erase(std::unique(types.begin(), types.end()), types.end());
+    fprintf(
+        out, "%-16s %8s %10s %10s %10s %10s %10s\n", "event to present", "count", "p50 us", "p90 us", "p99 us", "max us",
+        "no present"
+    );
+    std::vector<uint64_t> sorted;
+    for (const uint32_t type : types) {
+        sorted.clear();
+        for (const Sample& sample : samples) {
+            if (sample.type == type) {
+                sorted.push_back(sample.ns);
+            }
+        }
+        const size_t none = std::count(unpresented.begin(), unpresented.end(), type);
+        if (sorted.empty()) {
+            fprintf(out, "%-16s %8zu %10s %10s %10s %10s %10zu\n", typeName(type), sorted.size(), "-", "-", "-", "-", none);
+            continue;
+        }
+        std::sort(sorted.begin(), sorted.end());
+        fprintf(
+            out, "%-16s %8zu %10.1f %10.1f %10.1f %10.1f %10zu\n", typeName(type), sorted.size(),
+            percentile(sorted, 0.5), percentile(sorted, 0.9), percentile(sorted, 0.99), sorted.back() / 1e3, none
+        );
+    }
+}
+
+bool Latencies::writeCsv(const char* path) const {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        return false;
+    }
+    fputs("event,type,latency_us\n", f);
+    for (size_t i = 0; i < samples.size(); i++) {
+        fprintf(f, "%zu,%s,%.1f\n", i, typeName(samples[i].type), samples[i].ns / 1e3);
+    }
+    return !fclose(f);
+}
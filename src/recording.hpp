@@ -0,0 +1,106 @@
+#pragma once
+
+#include <SDL3/SDL.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Input sessions as compact binary files, to replay them and see how long the editor takes for them.
+// A recording is a header followed by records. Every record starts with its tag. An event is followed by
+// the microseconds since the event before it as a varint, the modifier keys that were held and the fields
+// the editor reads. A frame record ends the events the main loop handled before it drew a frame.
+// All numbers are little endian.
+class Recorder{
+    public:
+    static constexpr char magic[8] = {'t', 'e', 'r', 'e', 'c', '0', '1', '\n'};
+    enum Tag : uint8_t{
+        TAG_FRAME,
+        TAG_KEY_DOWN,
+        TAG_TEXT_INPUT,
+        TAG_MOUSE_MOTION,
+        TAG_MOUSE_BUTTON_DOWN,
+        TAG_MOUSE_WHEEL,
+        TAG_DROP_FILE,
+        TAG_WINDOW_EXPOSED,
+        TAG_WINDOW_RESTORED,
+        TAG_QUIT,
+    };
+    // the session is drawn into width x height pixels
+    Recorder(const char* path, int width, int height);
+    Recorder(const Recorder&) = delete;
+    Recorder& operator=(const Recorder&) = delete;
+    ~Recorder();
+    bool isOpen() const {
+        return file;
+    }
+    // events the editor doesn't handle aren't recorded
+    void event(const SDL_Event& event, SDL_Keymod mod);
+    void frame();
+    private:
+    void put(const void* data, size_t len);
+    void putVarint(uint64_t value);
+    void putString(const char* str);
+    FILE* file = nullptr;
+    uint64_t lastTimestamp = 0;
+    bool framed = true;
+};
+
+// Reads a recording back frame by frame.
+class Replay{
+    public:
+    struct Event{
+        SDL_Event event;
+        SDL_Keymod mod;
+        // microseconds since the event before it while it was recorded
+        uint64_t delay;
+        // what text or drop events point to
+        std::string data;
+    };
+    explicit Replay(const char* path);
+    // nullptr if the recording could be read, otherwise what is wrong with it
+    const char* getError() const;
+    int getWidth() const {
+        return width;
+    }
+    int getHeight() const {
+        return height;
+    }
+    // the events of the next frame, false if there are none left. They point into events, it mustn't be changed.
+    bool nextFrame(std::vector<Event>& events);
+    private:
+    bool get(void* data, size_t len);
+    bool getVarint(uint64_t& value);
+    bool getString(std::string& str);
+    std::vector<uint8_t> content{};
+    size_t read = 0;
+    int width = 0;
+    int height = 0;
+    std::string error{};
+};
+
+// How long it took from an event to the SDL_RenderPresent that showed what it did.
+// Events after which nothing was presented, a key up or a key that does nothing, have no latency,
+// they are only counted.
+class Latencies{
+    public:
+    void add(uint32_t type, uint64_t ns);
+    // an event of type changed nothing on the screen
+    void addUnpresented(uint32_t type);
+    // count and percentiles of every event type, and how many of them presented nothing
+    void report(FILE* out) const;
+    // one line per event that was presented: its number, its type and the latency in microseconds
+    bool writeCsv(const char* path) const;
+    bool empty() const {
+        return samples.empty() && unpresented.empty();
+    }
+    private:
+    struct Sample{
+        uint32_t type;
+        uint64_t ns;
+    };
+    std::vector<Sample> samples{};
+    // the types of the events that presented nothing
+    std::vector<uint32_t> unpresented{};
+};
@@ -0,0 +1,837 @@
+#include "regex.hpp"
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <unordered_set>
+#include <utility>
+
+using Bytes = std::bitset<256>;
+
+// the syntax tree of a pattern
+struct Node{
+    enum Kind{
+        BYTES,
+        CONCAT,
+        ALTERNATE,
+        REPEAT,
+        LINE_START,
+        LINE_END,
+    };
+    Kind kind = CONCAT;
+    Bytes bytes{};
+    std::vector<Node> children{};
+    // REPEAT only, max < 0 is unbounded
+    int min = 0;
+    int max = -1;
+};
+
+// the NFA and the expression tree can't grow without bounds from something like (a{1000}){1000}
+static constexpr size_t maxNfaStates = 1 << 18;
+static constexpr int maxRepeat = 1000;
+
+static Node bytesNode(const Bytes& bytes) {
+    Node node{Node::BYTES};
+    node.bytes = bytes;
+    return node;
+}
+
+static Bytes range(unsigned char first, unsigned char last) {
+    Bytes bytes;
+    for (unsigned c = first; c <= last; c++) {
+        bytes.set(c);
+    }
+    return bytes;
+}
+
+// one utf8 character that is not in ascii, or one ascii byte of ascii, never the '\n'
+static Node characterNode(Bytes ascii) {
+    ascii &= range(0, 0x7F);
+    ascii.reset('\n');
+    const Bytes continuation = range(0x80, 0xBF);
+    Node any{Node::ALTERNATE};
+    any.children.push_back(bytesNode(ascii));
+    for (const auto& [lead, length] : {std::pair{range(0xC2, 0xDF), 1}, {range(0xE0, 0xEF), 2}, {range(0xF0, 0xF4), 3}}) {
+        Node sequence{Node::CONCAT};
+        sequence.children.push_back(bytesNode(lead));
+        for (int i = 0; i < length; i++) {
+            sequence.children.push_back(bytesNode(continuation));
+        }
+        any.children.push_back(std::move(sequence));
+    }
+    return any;
+}
+
+static Bytes digits() {
+    return range('0', '9');
+}
+
+static Bytes wordBytes() {
+    return range('a', 'z') | range('A', 'Z') | digits() | range('_', '_');
+}
+
+static Bytes spaces() {
+    Bytes bytes;
+    for (const char c : {' ', '\t', '\r', '\f', '\v'}) {
+        bytes.set(static_cast<unsigned char>(c));
+    }
+    return bytes;
+}
+
+class Parser{
+    std::string_view pattern;
+    size_t pos = 0;
+    std::string& error;
+    bool fail(const char* what) {
+        if (error.empty()) {
+            error = what;
+        }
+        return false;
+    }
+    bool done() const {
+        return pos >= pattern.size();
+    }
+    unsigned char peek() const {
+        return pattern[pos];
+    }
+    // a utf8 character of the pattern as the sequence of its bytes
+    Node literal() {
+        Node sequence{Node::CONCAT};
+        do {
+            Bytes byte;
+            byte.set(static_cast<unsigned char>(pattern[pos++]));
+            sequence.children.push_back(bytesNode(byte));
+        } while (!done() && (peek() & 0xC0) == 0x80);
+        return sequence;
+    }
+    // \d, \w and \s and their negations, negated is set for the upper case ones
+    bool shorthand(char c, Bytes& bytes, bool& negated) {
+        negated = c >= 'A' && c <= 'Z';
+        switch (c | 0x20) {
+            case 'd': bytes = digits(); return true;
+            case 'w': bytes = wordBytes(); return true;
+            case 's': bytes = spaces(); return true;
+            default: return false;
+        }
+    }
+    // the byte an escape like \t or \. stands for
+    bool escapedByte(char c, unsigned char& byte) {
+        switch (c) {
+            case 't': byte = '\t'; return true;
+            case 'n': byte = '\n'; return true;
+            case 'r': byte = '\r'; return true;
+            case 'f': byte = '\f'; return true;
+            case 'v': byte = '\v'; return true;
+            case '0': byte = 0; return true;
+            default: break;
+        }
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || (c & 0x80)) {
+            return fail("unknown escape sequence");
+        }
+        byte = c;
+        return true;
+    }
+    bool escape(Node& node) {
+        if (done()) {
+            return fail("trailing backslash");
+        }
+        const char c = pattern[pos++];
+        Bytes bytes;
+        bool negated;
+        if (shorthand(c, bytes, negated)) {
+            node = negated ? characterNode(~bytes) : bytesNode(bytes);
+            return true;
+        }
+        unsigned char byte;
+        if (!escapedByte(c, byte)) {
+            return false;
+        }
+        bytes.set(byte);
+        node = bytesNode(bytes);
+        return true;
+    }
+    bool classMember(unsigned char& byte) {
+        if (peek() == '\\') {
+            pos++;
+            if (done()) {
+                return fail("trailing backslash");
+            }
+            return escapedByte(pattern[pos++], byte);
+        }
+        byte = pattern[pos++];
+        return true;
+    }
+    bool characterClass(Node& node) {
+        const bool negated = !done() && peek() == '^';
+        pos += negated;
+        Bytes bytes;
+        // characters outside of ascii are alternatives next to the bytes
+        Node alternatives{Node::ALTERNATE};
+        for (bool leading = true; !done() && (leading || peek() != ']'); leading = false) {
+            if (peek() & 0x80) {
+                if (negated) {
+                    return fail("negated classes can only hold ascii characters");
+                }
+                alternatives.children.push_back(literal());
+                if (!done() && peek() == '-' && pos+1 < pattern.size() && pattern[pos+1] != ']') {
+                    return fail("ranges can only hold ascii characters");
+                }
+                continue;
+            }
+            if (peek() == '\\' && pos+1 < pattern.size()) {
+                Bytes shorthandBytes;
+                bool negatedShorthand;
+                if (shorthand(pattern[pos+1], shorthandBytes, negatedShorthand)) {
+                    if (negatedShorthand) {
+                        return fail("\\D, \\W and \\S can't be used in classes");
+                    }
+                    bytes |= shorthandBytes;
+                    pos += 2;
+                    continue;
+                }
+            }
+            unsigned char first;
+            if (!classMember(first)) {
+                return false;
+            }
+            unsigned char last = first;
+            if (!done() && peek() == '-' && pos+1 < pattern.size() && pattern[pos+1] != ']') {
+                pos++;
+                if (peek() & 0x80) {
+                    return fail("ranges can only hold ascii characters");
+                }
+                if (!classMember(last)) {
+                    return false;
+                }
+                if (last < first) {
+                    return fail("range out of order");
+                }
+            }
+            bytes |= range(first, last);
+        }
+        if (done()) {
+            return fail("missing ]");
+        }
+        pos++;
+        if (negated) {
+            node = characterNode(~bytes);
+            return true;
+        }
+        bytes.reset('\n');
+        alternatives.children.push_back(bytesNode(bytes));
+        node = std::move(alternatives);
+        return true;
+    }
+    bool atom(Node& node) {
+        const char c = pattern[pos];
+        if (c & 0x80) {
+            node = literal();
+            return true;
+        }
+        pos++;
+        switch (c) {
+            case '.':
+                node = characterNode(~Bytes());
+                return true;
+            case '^':
+                node = Node{Node::LINE_START};
+                return true;
+            case '$':
+                node = Node{Node::LINE_END};
+                return true;
+            case '\\':
+                return escape(node);
+            case '[':
+                return characterClass(node);
+            case '(':
+                if (pattern.substr(pos, 2) == "?:") {
+                    pos += 2;
+                }
+                if (!alternation(node)) {
+                    return false;
+                }
+                if (done() || peek() != ')') {
+                    return fail("missing )");
+                }
+                pos++;
+                return true;
+            case ')':
+                return fail("unmatched )");
+            case '*':
+            case '+':
+            case '?':
+                return fail("nothing to repeat");
+            default:
+                Bytes byte;
+                byte.set(static_cast<unsigned char>(c));
+                node = bytesNode(byte);
+                return true;
+        }
+    }
+    bool number(int& n) {
+        if (done() || peek() < '0' || peek() > '9') {
+            return false;
+        }
+        n = 0;
+        while (!done() && peek() >= '0' && peek() <= '9') {
+            n = std::min(n*10 + (peek()-'0'), maxRepeat+1);
+            pos++;
+        }
+        return true;
+    }
+    // {n}, {n,} or {n,m}, a { that doesn't start one of them is a literal
+    bool bounds(int& min, int& max) {
+        const size_t start = pos;
+        pos++;
+        if (!number(min)) {
+            pos = start;
+            return false;
+        }
+        max = min;
+        if (!done() && peek() == ',') {
+            pos++;
+            max = -1;
+            number(max);
+        }
+        if (done() || peek() != '}') {
+            pos = start;
+            return false;
+        }
+        pos++;
+        return true;
+    }
+    bool repetition(Node& node) {
+        if (!atom(node)) {
+            return false;
+        }
+        while (!done()) {
+            int min, max;
+            if (peek() == '*') {
+                min = 0, max = -1;
+                pos++;
+            } else if (peek() == '+') {
+                min = 1, max = -1;
+                pos++;
+            } else if (peek() == '?') {
+                min = 0, max = 1;
+                pos++;
+            } else if (peek() == '{' && bounds(min, max)) {
+                if (min > maxRepeat || max > maxRepeat) {
+                    return fail("repetition too large");
+                }
+                if (max >= 0 && max < min) {
+                    return fail("repetition out of order");
+                }
+            } else {
+                break;
+            }
+            // lazy quantifiers find the same matches, the longest one is taken anyway
+            if (!done() && peek() == '?') {
+                pos++;
+            }
+            Node repeat{Node::REPEAT};
+            repeat.min = min;
+            repeat.max = max;
+            repeat.children.push_back(std::move(node));
+            node = std::move(repeat);
+        }
+        return true;
+    }
+    bool concatenation(Node& node) {
+        node = Node{Node::CONCAT};
+        while (!done() && peek() != '|' && peek() != ')') {
+            Node child;
+            if (!repetition(child)) {
+                return false;
+            }
+            node.children.push_back(std::move(child));
+        }
+        return true;
+    }
+    public:
+    Parser(std::string_view pattern, std::string& error) : pattern(pattern), error(error) {}
+    bool alternation(Node& node) {
+        if (!concatenation(node)) {
+            return false;
+        }
+        if (done() || peek() != '|') {
+            return true;
+        }
+        Node alternate{Node::ALTERNATE};
+        alternate.children.push_back(std::move(node));
+        while (!done() && peek() == '|') {
+            pos++;
+            Node child;
+            if (!concatenation(child)) {
+                return false;
+            }
+            alternate.children.push_back(std::move(child));
+        }
+        node = std::move(alternate);
+        return true;
+    }
+    bool parse(Node& node) {
+        if (!alternation(node)) {
+            return false;
+        }
+        if (!done()) {
+            return fail("unmatched )");
+        }
+        return true;
+    }
+};
+
+struct Nfa{
+    struct State{
+        enum Kind : uint8_t{
+            // to out on a byte in sets[set]
+            BYTES,
+            // to out and out1 without reading anything
+            SPLIT,
+            // to out if at the start or the end of a line
+            LINE_START,
+            LINE_END,
+            MATCH,
+        };
+        Kind kind;
+        int set = -1;
+        int out = -1;
+        int out1 = -1;
+    };
+    std::vector<State> states;
+    std::vector<Bytes> sets;
+    int start = -1;
+    int add(State::Kind kind, int out = -1, int out1 = -1) {
+        states.push_back({kind, -1, out, out1});
+        return states.size()-1;
+    }
+    // the states of node followed by next, with the concatenations reversed for the reversed expression.
+    // Everything is built back to front so every state knows where it goes when it is added.
+    int compile(const Node& node, int next, bool reversed) {
+        if (states.size() > maxNfaStates) {
+            return next;
+        }
+        switch (node.kind) {
+            case Node::BYTES: {
+                const int state = add(State::BYTES, next);
+                states[state].set = sets.size();
+                sets.push_back(node.bytes);
+                return state;
+            }
+            case Node::CONCAT:
+                if (reversed) {
+                    for (const Node& child : node.children) {
+                        next = compile(child, next, reversed);
+                    }
+                } else {
+                    for (auto child = node.children.rbegin(); child != node.children.rend(); ++child) {
+                        next = compile(*child, next, reversed);
+                    }
+                }
+                return next;
+            case Node::ALTERNATE: {
+                int entry = compile(node.children.back(), next, reversed);
+                for (auto child = node.children.rbegin()+1; child != node.children.rend(); ++child) {
+                    entry = add(State::SPLIT, compile(*child, next, reversed), entry);
+                }
+                return entry;
+            }
+            case Node::REPEAT: {
+                const Node& child = node.children[0];
+                int entry = next;
+                if (node.max < 0) {
+                    // a loop: the split either runs the child again or leaves
+                    const int loop = add(State::SPLIT);
+                    states[loop].out = compile(child, loop, reversed);
+                    states[loop].out1 = next;
+                    entry = loop;
+                } else {
+                    // (child(child)?)? for the optional ones
+                    for (int i = node.min; i < node.max && states.size() <= maxNfaStates; i++) {
+                        entry = add(State::SPLIT, compile(child, entry, reversed), next);
+                    }
+                }
+                for (int i = 0; i < node.min && states.size() <= maxNfaStates; i++) {
+                    entry = compile(child, entry, reversed);
+                }
+                return entry;
+            }
+            case Node::LINE_START:
+                return add(reversed ? State::LINE_END : State::LINE_START, next);
+            case Node::LINE_END:
+                return add(reversed ? State::LINE_START : State::LINE_END, next);
+        }
+        return next;
+    }
+};
+
+// bytes that no set tells apart share a column in the transition tables
+struct ByteClasses{
+    std::array<uint16_t, 256> of{};
+    size_t count = 1;
+    explicit ByteClasses(const std::vector<Bytes>& sets) {
+        std::unordered_set<Bytes> seen;
+        for (const Bytes& set : sets) {
+            if (!seen.insert(set).second) {
+                continue;
+            }
+            // splits every class into the part inside of set and the part outside of it
+            std::map<std::pair<uint16_t, bool>, uint16_t> split;
+            for (unsigned c = 0; c < 256; c++) {
+                of[c] = split.try_emplace({of[c], set.test(c)}, split.size()).first->second;
+            }
+            count = split.size();
+        }
+    }
+};
+
+struct Regex::Program{
+    Nfa forward;
+    Nfa reversed;
+    ByteClasses classes{{}};
+};
+
+// A DFA whose states are sets of NFA states, added the first time a byte leads to them.
+// Unanchored it starts a new attempt at every byte, anchored only at the start.
+// '\n' is never fed to it, the caller restarts at every line.
+class Dfa{
+    public:
+    Dfa(const Nfa& nfa, const ByteClasses& classes, bool unanchored) : nfa(nfa), classes(classes), unanchored(unanchored) {}
+    int start(bool atLineStart) {
+        int& id = starts[atLineStart];
+        if (id < 0) {
+            std::vector<int> set;
+            closure({nfa.start}, atLineStart, set);
+            id = find(std::move(set));
+        }
+        return id;
+    }
+    int next(int state, unsigned char c) {
+        const int cached = table[state + classes.of[c]];
+        return cached >= 0 ? cached : step(state, c);
+    }
+    // feeds data to the DFA until a state matches or a '\n' comes, returns how many bytes it took
+    size_t run(int& state, const char* data, size_t len) {
+        int current = state;
+        size_t i = 0;
+        while (i < len) {
+            const unsigned char c = data[i];
+            if (c == '\n') {
+                break;
+            }
+            const int cached = table[current + classes.of[c]];
+            current = cached >= 0 ? cached : step(current, c);
+            i++;
+            if (flags[current] & MATCHES) {
+                break;
+            }
+        }
+        state = current;
+        return i;
+    }
+    bool matches(int state) const {
+        return flags[state] & MATCHES;
+    }
+    // matches once the line ends here
+    bool matchesAtLineEnd(int state) const {
+        return flags[state] & MATCHES_AT_LINE_END;
+    }
+    bool dead(int state) const {
+        return flags[state] & DEAD;
+    }
+    private:
+    enum Flags : uint8_t{
+        MATCHES = 1,
+        MATCHES_AT_LINE_END = 2,
+        DEAD = 4,
+    };
+    const Nfa& nfa;
+    const ByteClasses& classes;
+    const bool unanchored;
+    // A state is the offset of its row of transitions in table, so following one doesn't need a multiplication.
+    // sets holds what every state was made of, flags is indexed like table and only the first byte of a row is used.
+    std::vector<std::vector<int>> sets;
+    std::vector<int> table;
+    std::vector<uint8_t> flags;
+    std::map<std::vector<int>, int> index;
+    int starts[2] = {-1, -1};
+    // the states reachable from from without reading a byte, BYTES, LINE_END and MATCH states are kept
+    void closure(const std::vector<int>& from, bool atLineStart, std::vector<int>& set, bool atLineEnd = false) const {
+        std::vector<int> stack(from.rbegin(), from.rend());
+        std::vector<bool> seen(nfa.states.size());
+        while (!stack.empty()) {
+            const int id = stack.back();
+            stack.pop_back();
+            if (id < 0 || seen[id]) {
+                continue;
+            }
+            seen[id] = true;
+            const Nfa::State& state = nfa.states[id];
+            switch (state.kind) {
+                case Nfa::State::SPLIT:
+                    stack.push_back(state.out1);
+                    stack.push_back(state.out);
+                    break;
+                case Nfa::State::LINE_START:
+                    if (atLineStart) {
+                        stack.push_back(state.out);
+                    }
+                    break;
+                case Nfa::State::LINE_END:
+                    if (atLineEnd) {
+                        stack.push_back(state.out);
+                    }
+                    set.push_back(id);
+                    break;
+                default:
+                    set.push_back(id);
+                    break;
+            }
+        }
+        std::sort(set.begin(), set.end());
+        set.erase(std::unique(set.begin(), set.end()), set.end());
+    }
+    int find(std::vector<int>&& set) {
+        const auto known = index.find(set);
+        if (known != index.end()) {
+            return known->second;
+        }
+        if (sets.size() >= Regex::maxCachedStates) {
+            // start over, the state the caller is in is added again by step()
+            sets.clear();
+            table.clear();
+            flags.clear();
+            index.clear();
+            starts[0] = starts[1] = -1;
+        }
+        uint8_t flag = set.empty() && !unanchored ? DEAD : 0;
+        bool hasLineEnd = false;
+        for (const int id : set) {
+            const Nfa::State::Kind kind = nfa.states[id].kind;
+            if (kind == Nfa::State::MATCH) {
+                flag |= MATCHES | MATCHES_AT_LINE_END;
+            }
+            hasLineEnd |= kind == Nfa::State::LINE_END;
+        }
+        if (hasLineEnd && !(flag & MATCHES_AT_LINE_END)) {
+            // at the end of the line every $ holds, a ^ behind one would need the next line
+            std::vector<int> atEnd;
+            closure(set, false, atEnd, true);
+            for (const int id : atEnd) {
+                if (nfa.states[id].kind == Nfa::State::MATCH) {
+                    flag |= MATCHES_AT_LINE_END;
+                }
+            }
+        }
+        const int id = table.size();
+        index.emplace(set, id);
+        sets.push_back(std::move(set));
+        table.resize(table.size()+classes.count, -1);
+        flags.resize(table.size());
+        flags[id] = flag;
+        return id;
+    }
+    int step(int state, unsigned char c) {
+        std::vector<int> moved;
+        for (const int id : sets[state / classes.count]) {
+            const Nfa::State& nfaState = nfa.states[id];
+            if (nfaState.kind == Nfa::State::BYTES && nfa.sets[nfaState.set].test(c)) {
+                moved.push_back(nfaState.out);
+            }
+        }
+        if (unanchored) {
+            moved.push_back(nfa.start);
+        }
+        std::vector<int> set;
+        closure(moved, false, set);
+        const size_t before = sets.size();
+        std::vector<int> from = sets[state / classes.count];
+        int next = find(std::move(set));
+        if (sets.size() < before) {
+            // the cache was flushed, the state we came from is gone too
+            state = find(std::move(from));
+        }
+        table[state + classes.of[c]] = next;
+        return next;
+    }
+};
+
+Regex::Regex(std::string_view pattern) {
+    Node root;
+    if (!Parser(pattern, error).parse(root)) {
+        return;
+    }
+    program = std::make_unique<Program>();
+    for (const bool reversed : {false, true}) {
+        Nfa& nfa = reversed ? program->reversed : program->forward;
+        nfa.start = nfa.compile(root, nfa.add(Nfa::State::MATCH), reversed);
+    }
+    if (program->forward.states.size() > maxNfaStates || program->reversed.states.size() > maxNfaStates) {
+        error = "pattern too large";
+        program.reset();
+        return;
+    }
+    program->classes = ByteClasses(program->forward.sets);
+}
+
+Regex::Regex(Regex&&) = default;
+Regex& Regex::operator=(Regex&&) = default;
+Regex::~Regex() = default;
+
+const char* Regex::getError() const {
+    return program ? nullptr : error.c_str();
+}
+
+// the pieces of one line, walked forwards or backwards without copying them
+class LinePieces{
+    std::vector<std::pair<const char*, size_t>> pieces;
+    size_t start;
+    public:
+    LinePieces(const Finder::Segments& segments, size_t start, size_t end) : start(start) {
+        segments(start, end, [&](const char* data, size_t len) {
+            pieces.emplace_back(data, len);
+        });
+    }
+    // calls f(pos, byte) from from on until it returns false
+    template <typename F>
+    void forward(size_t from, F&& f) const {
+        size_t pos = start;
+        for (const auto& [data, len] : pieces) {
+            for (size_t i = from > pos ? from-pos : 0; i < len; i++) {
+                if (!f(pos+i, static_cast<unsigned char>(data[i]))) {
+                    return;
+                }
+            }
+            pos += len;
+        }
+    }
+    // calls f(pos, byte) from the end of the line back to its start
+    template <typename F>
+    void backward(F&& f) const {
+        size_t pos = start;
+        for (const auto& piece : pieces) {
+            pos += piece.second;
+        }
+        for (auto piece = pieces.rbegin(); piece != pieces.rend(); ++piece) {
+            for (size_t i = piece->second; i--;) {
+                f(--pos, static_cast<unsigned char>(piece->first[i]));
+            }
+        }
+    }
+};
+
+// searches the lines that start in one chunk, each thread has its own DFAs
+class LineSearch{
+    const Finder::Segments& segments;
+    const size_t size;
+    Dfa lines;
+    Dfa starts;
+    Dfa ends;
+    std::vector<Regex::Match>& found;
+    // the matches of the line [start, end), which has a match
+    void search(size_t start, size_t end) {
+        const LinePieces pieces(segments, start, end);
+        // where the reversed expression matches backwards from the end of the line, a match starts
+        std::vector<size_t> matchStarts;
+        int state = starts.start(true);
+        pieces.backward([&](size_t pos, unsigned char c) {
+            state = starts.next(state, c);
+            if (pos == start ? starts.matchesAtLineEnd(state) : starts.matches(state)) {
+                matchStarts.push_back(pos);
+            }
+        });
+        size_t from = start;
+        for (auto matchStart = matchStarts.rbegin(); matchStart != matchStarts.rend(); ++matchStart) {
+            if (*matchStart < from) {
+                continue;
+            }
+            // the longest match from there
+            size_t matchEnd = *matchStart;
+            state = ends.start(*matchStart == start);
+            pieces.forward(*matchStart, [&](size_t pos, unsigned char c) {
+                state = ends.next(state, c);
+                if (ends.dead(state)) {
+                    return false;
+                }
+                if (pos+1 == end ? ends.matchesAtLineEnd(state) : ends.matches(state)) {
+                    matchEnd = pos+1;
+                }
+                return true;
+            });
+            if (matchEnd > *matchStart) {
+                found.push_back({*matchStart, matchEnd});
+                from = matchEnd;
+            }
+        }
+    }
+    public:
+    LineSearch(const Regex::Program& program, const Finder::Segments& segments, size_t size, std::vector<Regex::Match>& found) :
+        segments(segments), size(size),
+        lines(program.forward, program.classes, true),
+        starts(program.reversed, program.classes, true),
+        ends(program.forward, program.classes, false),
+        found(found) {}
+    // the lines starting in [from, to)
+    void run(size_t from, size_t to) {
+        const Finder newLine("\n");
+        size_t line = from;
+        if (from) {
+            // a line that started in front of from belongs to the chunk before
+            line = newLine.findNext(segments, size, from-1)+1;
+        }
+        if (line >= to || line > size) {
+            return;
+        }
+        int state = lines.start(true);
+        bool matched = lines.matches(state);
+        bool finished = false;
+        size_t pos = line;
+        auto feed = [&](const char* data, size_t len) {
+            size_t i = 0;
+            while (i < len && !finished) {
+                if (matched) {
+                    // the rest of the line doesn't matter, search() looks at all of it
+                    const void* lineEnd = std::memchr(data+i, '\n', len-i);
+                    i = lineEnd ? static_cast<const char*>(lineEnd)-data : len;
+                } else {
+                    i += lines.run(state, data+i, len-i);
+                    matched = lines.matches(state);
+                }
+                if (i < len && data[i] == '\n') {
+                    if (matched || lines.matchesAtLineEnd(state)) {
+                        search(line, pos+i);
+                    }
+                    line = pos+i+1;
+                    finished = line >= to;
+                    state = lines.start(true);
+                    matched = lines.matches(state);
+                    i++;
+                }
+            }
+            pos += len;
+        };
+        segments(line, std::min(to, size), feed);
+        // the last line may go on behind to
+        static constexpr size_t step = 1 << 16;
+        while (!finished && pos < size) {
+            const size_t next = std::min(size, pos+step);
+            segments(pos, next, feed);
+        }
+        if (!finished && line < size && (matched || lines.matchesAtLineEnd(state))) {
+            search(line, size);
+        }
+    }
+};
+
+std::vector<Regex::Match> Regex::findAll(const Finder::Segments& segments, size_t size) const {
+    if (!program) {
+        return {};
+    }
+    std::vector<std::vector<Match>> found((size+chunkSize-1) / chunkSize);
+    forEachChunk(found.size(), [&](size_t chunk) {
+        LineSearch(*program, segments, size, found[chunk]).run(chunk*chunkSize, (chunk+1)*chunkSize);
+    });
+    return joinChunks(found);
+}
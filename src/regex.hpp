@@ -0,0 +1,39 @@
+#pragma once
+
+#include "search.hpp"
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Regular expressions over the pieces of a Text, run by DFAs that are built lazily while searching,
+// so a search is linear in the size of the text and nothing is copied.
+// Matches never span lines, ^ and $ match at the start and the end of every line.
+// The syntax is the common subset: literals, ., [classes], \d \w \s and their negations, groups,
+// |, *, +, ? and {n,m}. . and the negations match whole utf8 characters, empty matches are skipped.
+// One DFA finds the lines that contain a match. In those lines a DFA of the reversed expression
+// finds where matches start and one anchored at a start finds where the longest match ends.
+class Regex{
+    public:
+    struct Match{
+        size_t start;
+        size_t end;
+    };
+    // the lines are searched in chunks of this size on several threads
+    static constexpr size_t chunkSize = 16 << 20;
+    // states a DFA keeps before it starts over, each costs a row of transitions and its NFA states
+    static constexpr size_t maxCachedStates = 4096;
+    explicit Regex(std::string_view pattern);
+    Regex(Regex&&);
+    Regex& operator=(Regex&&);
+    ~Regex();
+    // nullptr if the pattern compiled, otherwise what is wrong with it
+    const char* getError() const;
+    // the matches in a text of size bytes, in order and not overlapping
+    std::vector<Match> findAll(const Finder::Segments& segments, size_t size) const;
+    struct Program;
+    private:
+    std::unique_ptr<Program> program;
+    std::string error;
+};
@@ -0,0 +1,492 @@
+#include "rope.hpp"
+#include "scan.hpp"
+#include <cassert>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+Rope::Summary Rope::Summary::of(const char* data, size_t len) {
+    return {len, countNewLines(data, len), countCodepoints(data, len), countTabs(data, len)};
+}
+
+Rope::Summary& Rope::Summary::operator+=(const Summary& rhs) {
+    bytes += rhs.bytes;
+    newLines += rhs.newLines;
+    codepoints += rhs.codepoints;
+    tabs += rhs.tabs;
+    return *this;
+}
+
+Rope::Summary& Rope::Summary::operator-=(const Summary& rhs) {
+    bytes -= rhs.bytes;
+    newLines -= rhs.newLines;
+    codepoints -= rhs.codepoints;
+    tabs -= rhs.tabs;
+    return *this;
+}
+
+// drops a reference, the last one deletes the leaf
+static void release(const Rope::Leaf* leaf) {
+    if (leaf->references.fetch_sub(1) == 1) {
+        delete leaf;
+    }
+}
+
+// a leaf that was shared is replaced by a copy before it changes, node is returned as it is otherwise
+static Rope::Node* unshare(Rope::Node* node, size_t levels) {
+    Rope::Leaf* leaf = static_cast<Rope::Leaf*>(node);
+    if (levels || leaf->references == 1) {
+        return node;
+    }
+    Rope::Leaf* copy = new Rope::Leaf;
+    copy->count = leaf->count;
+    std::memcpy(copy->data, leaf->data, leaf->count);
+    copy->prev = leaf->prev;
+    copy->next = leaf->next;
+    if (copy->prev) {
+        copy->prev->next = copy;
+    }
+    if (copy->next) {
+        copy->next->prev = copy;
+    }
+    release(leaf);
+    return copy;
+}
+
+// levels is the number of inner levels from a node down to its leafs, 0 means the node is a leaf
+struct Rope::Inner : Node{
+    Summary summaries[maxChildren+1];
+    Node* children[maxChildren+1];
+    static Summary summarize(const Node* node, size_t levels);
+    static Node* insert(Node* node, size_t levels, size_t pos, const char* content, size_t len, const Summary& added, size_t& moved);
+    static Summary erase(Node* node, size_t levels, size_t pos, size_t len, size_t& moved);
+    static void free(Node* node, size_t levels);
+    void removeAt(size_t i) {
+        std::memmove(summaries+i, summaries+i+1, (count-i-1)*sizeof(*summaries));
+        std::memmove(children+i, children+i+1, (count-i-1)*sizeof(*children));
+        count--;
+    }
+    void insertAt(size_t i, Node* child, const Summary& summary) {
+        std::memmove(summaries+i+1, summaries+i, (count-i)*sizeof(*summaries));
+        std::memmove(children+i+1, children+i, (count-i)*sizeof(*children));
+        summaries[i] = summary;
+        children[i] = child;
+        count++;
+    }
+    // merges children[left+1] into children[left] if they fit into one node
+    void merge(size_t left, size_t childLevels, size_t& moved) {
+        Node* l = children[left];
+        Node* r = children[left+1];
+        const size_t rightCount = r->count;
+        if (!childLevels) {
+            Leaf* ll = static_cast<Leaf*>(l);
+            Leaf* rl = static_cast<Leaf*>(r);
+            if (ll->count + rl->count > leafCapacity) {
+                return;
+            }
+            ll = static_cast<Leaf*>(unshare(ll, 0));
+            children[left] = l = ll;
+            std::memcpy(ll->data+ll->count, rl->data, rl->count);
+            moved += rl->count;
+        } else {
+            Inner* li = static_cast<Inner*>(l);
+            Inner* ri = static_cast<Inner*>(r);
+            if (li->count + ri->count > maxChildren) {
+                return;
+            }
+            std::memcpy(li->summaries+li->count, ri->summaries, ri->count*sizeof(*ri->summaries));
+            std::memcpy(li->children+li->count, ri->children, ri->count*sizeof(*ri->children));
+            // the children belong to l now
+            ri->count = 0;
+        }
+        l->count += rightCount;
+        summaries[left] += summaries[left+1];
+        free(r, childLevels);
+        removeAt(left+1);
+    }
+    // merges children[i] with a neighbor if it got small
+    void rebalance(size_t i, size_t childLevels, size_t& moved) {
+        if (i >= count || count < 2) {
+            return;
+        }
+        const size_t small = childLevels ? maxChildren/4 : leafCapacity/4;
+        if (children[i]->count >= small) {
+            return;
+        }
+        merge(i+1 < count ? i : i-1, childLevels, moved);
+    }
+};
+
+static void unlink(Rope::Leaf* leaf) {
+    if (leaf->prev) {
+        leaf->prev->next = leaf->next;
+    }
+    if (leaf->next) {
+        leaf->next->prev = leaf->prev;
+    }
+}
+
+static void linkAfter(Rope::Leaf* leaf, Rope::Leaf* right) {
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (right->next) {
+        right->next->prev = right;
+    }
+    leaf->next = right;
+}
+
+Rope::Summary Rope::Inner::summarize(const Node* node, size_t levels) {
+    if (!levels) {
+        const Leaf* leaf = static_cast<const Leaf*>(node);
+        return Summary::of(leaf->data, leaf->count);
+    }
+    const Inner* inner = static_cast<const Inner*>(node);
+    Summary summary;
+    for (size_t i = 0; i < inner->count; i++) {
+        summary += inner->summaries[i];
+    }
+    return summary;
+}
+
+// len is at most leafCapacity/2, returns the new right sibling if node had to be split
+Rope::Node* Rope::Inner::insert(Node* node, size_t levels, size_t pos, const char* content, size_t len, const Summary& added, size_t& moved) {
+    if (!levels) {
+        Leaf* leaf = static_cast<Leaf*>(node);
+        assert(pos <= leaf->count);
+        if (leaf->count + len <= leafCapacity) {
+            std::memmove(leaf->data+pos+len, leaf->data+pos, leaf->count-pos);
+            std::memcpy(leaf->data+pos, content, len);
+            moved += leaf->count-pos;
+            leaf->count += len;
+            return nullptr;
+        }
+        // appending keeps the left leaf full, so that typing at the end doesn't leave half empty leafs
+        const size_t keep = pos == leaf->count ? leaf->count : leaf->count/2;
+        Leaf* right = new Leaf;
+        right->count = leaf->count-keep;
+        std::memcpy(right->data, leaf->data+keep, right->count);
+        moved += right->count;
+        leaf->count = keep;
+        linkAfter(leaf, right);
+        if (pos <= keep && leaf->count+len <= leafCapacity) {
+            insert(leaf, 0, pos, content, len, added, moved);
+        } else {
+            insert(right, 0, pos-keep, content, len, added, moved);
+        }
+        return right;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    size_t c = 0;
+    while (c+1 < inner->count && pos > inner->summaries[c].bytes) {
+        pos -= inner->summaries[c].bytes;
+        c++;
+    }
+    inner->children[c] = unshare(inner->children[c], levels-1);
+    Node* split = insert(inner->children[c], levels-1, pos, content, len, added, moved);
+    if (!split) {
+        inner->summaries[c] += added;
+        return nullptr;
+    }
+    inner->summaries[c] = summarize(inner->children[c], levels-1);
+    inner->insertAt(c+1, split, summarize(split, levels-1));
+    if (inner->count <= maxChildren) {
+        return nullptr;
+    }
+    const size_t keep = c+1 == inner->count-1 ? maxChildren : inner->count/2;
+    Inner* right = new Inner;
+    right->count = inner->count-keep;
+    std::memcpy(right->summaries, inner->summaries+keep, right->count*sizeof(*inner->summaries));
+    std::memcpy(right->children, inner->children+keep, right->count*sizeof(*inner->children));
+    inner->count = keep;
+    return right;
+}
+
+// removes [pos, pos+len) below node, which has to keep at least one byte, returns what was removed
+Rope::Summary Rope::Inner::erase(Node* node, size_t levels, size_t pos, size_t len, size_t& moved) {
+    if (!levels) {
+        Leaf* leaf = static_cast<Leaf*>(node);
+        assert(pos+len < leaf->count || (pos && pos+len == leaf->count));
+        const Summary removed = Summary::of(leaf->data+pos, len);
+        std::memmove(leaf->data+pos, leaf->data+pos+len, leaf->count-pos-len);
+        moved += leaf->count-pos-len;
+        leaf->count -= len;
+        return removed;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    size_t c = 0;
+    while (pos >= inner->summaries[c].bytes) {
+        pos -= inner->summaries[c].bytes;
+        c++;
+    }
+    const size_t first = c;
+    Summary removed;
+    while (len) {
+        const size_t n = std::min(len, inner->summaries[c].bytes-pos);
+        if (!pos && n == inner->summaries[c].bytes) {
+            removed += inner->summaries[c];
+            free(inner->children[c], levels-1);
+            inner->removeAt(c);
+        } else {
+            inner->children[c] = unshare(inner->children[c], levels-1);
+            const Summary part = erase(inner->children[c], levels-1, pos, n, moved);
+            inner->summaries[c] -= part;
+            removed += part;
+            c++;
+        }
+        len -= n;
+        pos = 0;
+    }
+    // at most the first and the last child were cut, and they are neighbors now
+    inner->rebalance(first, levels-1, moved);
+    if (first) {
+        inner->rebalance(first-1, levels-1, moved);
+    }
+    return removed;
+}
+
+void Rope::Inner::free(Node* node, size_t levels) {
+    if (!levels) {
+        Leaf* leaf = static_cast<Leaf*>(node);
+        unlink(leaf);
+        release(leaf);
+        return;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    for (size_t i = 0; i < inner->count; i++) {
+        free(inner->children[i], levels-1);
+    }
+    delete inner;
+}
+
+Rope::Rope() : root(new Leaf) {}
+
+Rope::Rope(Rope&& moveFrom) : Rope() {
+    *this = std::move(moveFrom);
+}
+
+Rope& Rope::operator=(Rope&& moveFrom) {
+    std::swap(root, moveFrom.root);
+    std::swap(height, moveFrom.height);
+    std::swap(total, moveFrom.total);
+    std::swap(bytesMoved, moveFrom.bytesMoved);
+    return *this;
+}
+
+Rope::~Rope() {
+    destroy();
+}
+
+void Rope::destroy() {
+    if (root) {
+        Inner::free(root, height);
+    }
+    root = nullptr;
+    height = 0;
+    total = {};
+}
+
+// fill(data, capacity) writes up to capacity bytes and returns how many, 0 ends the rope.
+// Leafs and inner nodes are filled to 3/4 so that the first edits don't split them right away.
+template <typename F>
+void Rope::build(F&& fill) {
+    destroy();
+    std::vector<Node*> nodes;
+    std::vector<Summary> summaries;
+    Leaf* last = nullptr;
+    while (true) {
+        Leaf* leaf = new Leaf;
+        leaf->count = fill(leaf->data, leafCapacity/4*3);
+        if (!leaf->count && last) {
+            delete leaf;
+            break;
+        }
+        if (last) {
+            linkAfter(last, leaf);
+        }
+        last = leaf;
+        nodes.push_back(leaf);
+        summaries.push_back(Summary::of(leaf->data, leaf->count));
+        total += summaries.back();
+        if (!leaf->count) {
+            break;
+        }
+    }
+    while (nodes.size() > 1) {
+        static constexpr size_t fanOut = maxChildren/4*3;
+        std::vector<Node*> parents;
+        std::vector<Summary> parentSummaries;
+        for (size_t i = 0; i < nodes.size(); i += fanOut) {
+            Inner* inner = new Inner;
+            Summary summary;
+            for (size_t j = i; j < std::min(nodes.size(), i+fanOut); j++) {
+                inner->insertAt(inner->count, nodes[j], summaries[j]);
+                summary += summaries[j];
+            }
+            parents.push_back(inner);
+            parentSummaries.push_back(summary);
+        }
+        nodes.swap(parents);
+        summaries.swap(parentSummaries);
+        height++;
+    }
+    root = nodes.front();
+}
+
+void Rope::assign(const char* content, size_t len) {
+    build([&](char* data, size_t capacity) {
+        const size_t n = std::min(capacity, len);
+        std::memcpy(data, content, n);
+        content += n;
+        len -= n;
+        return n;
+    });
+}
+
+bool Rope::read(FILE* file) {
+    build([&](char* data, size_t capacity) {
+        return fread(data, 1, capacity, file);
+    });
+    return !ferror(file);
+}
+
+void Rope::insert(size_t pos, const char* content, size_t len) {
+    assert(pos <= total.bytes);
+    // pieces of half a leaf always fit into one of the two halves of a split leaf
+    while (len) {
+        const size_t n = std::min(len, leafCapacity/2);
+        const Summary added = Summary::of(content, n);
+        root = unshare(root, height);
+        Node* split = Inner::insert(root, height, pos, content, n, added, bytesMoved);
+        if (split) {
+            Inner* newRoot = new Inner;
+            newRoot->insertAt(0, root, Inner::summarize(root, height));
+            newRoot->insertAt(1, split, Inner::summarize(split, height));
+            root = newRoot;
+            height++;
+        }
+        total += added;
+        pos += n;
+        content += n;
+        len -= n;
+    }
+}
+
+void Rope::erase(size_t pos, size_t len) {
+    assert(pos+len <= total.bytes);
+    if (!len) {
+        return;
+    }
+    if (len == total.bytes) {
+        destroy();
+        root = new Leaf;
+        return;
+    }
+    root = unshare(root, height);
+    total -= Inner::erase(root, height, pos, len, bytesMoved);
+    while (height && root->count == 1) {
+        Inner* inner = static_cast<Inner*>(root);
+        root = inner->children[0];
+        delete inner;
+        height--;
+    }
+}
+
+size_t Rope::size() const {
+    return total.bytes;
+}
+
+size_t Rope::lines() const {
+    return total.newLines+1;
+}
+
+const Rope::Leaf* Rope::find(size_t pos, size_t& offset) const {
+    assert(pos <= total.bytes);
+    const Node* node = root;
+    for (size_t levels = height; levels; levels--) {
+        const Inner* inner = static_cast<const Inner*>(node);
+        size_t c = 0;
+        while (c+1 < inner->count && pos >= inner->summaries[c].bytes) {
+            pos -= inner->summaries[c].bytes;
+            c++;
+        }
+        node = inner->children[c];
+    }
+    offset = pos;
+    return static_cast<const Leaf*>(node);
+}
+
+Rope::Summary Rope::prefix(size_t pos) const {
+    assert(pos <= total.bytes);
+    Summary summary;
+    const Node* node = root;
+    for (size_t levels = height; levels; levels--) {
+        const Inner* inner = static_cast<const Inner*>(node);
+        size_t c = 0;
+        while (c+1 < inner->count && pos >= inner->summaries[c].bytes) {
+            pos -= inner->summaries[c].bytes;
+            summary += inner->summaries[c];
+            c++;
+        }
+        node = inner->children[c];
+    }
+    summary += Summary::of(static_cast<const Leaf*>(node)->data, pos);
+    return summary;
+}
+
+size_t Rope::afterNewLine(size_t n) const {
+    assert(n < total.newLines);
+    size_t pos = 0;
+    const Node* node = root;
+    for (size_t levels = height; levels; levels--) {
+        const Inner* inner = static_cast<const Inner*>(node);
+        size_t c = 0;
+        while (c+1 < inner->count && n >= inner->summaries[c].newLines) {
+            n -= inner->summaries[c].newLines;
+            pos += inner->summaries[c].bytes;
+            c++;
+        }
+        node = inner->children[c];
+    }
+    const Leaf* leaf = static_cast<const Leaf*>(node);
+    return pos + findNthByte(leaf->data, leaf->count, '\n', n) + 1;
+}
+
+size_t Rope::beforeColumn(size_t columns, size_t& reached) const {
+    size_t pos = 0;
+    reached = 0;
+    const Node* node = root;
+    for (size_t levels = height; levels; levels--) {
+        const Inner* inner = static_cast<const Inner*>(node);
+        size_t c = 0;
+        while (c+1 < inner->count && columns >= reached+inner->summaries[c].columns()) {
+            reached += inner->summaries[c].columns();
+            pos += inner->summaries[c].bytes;
+            c++;
+        }
+        node = inner->children[c];
+    }
+    return pos;
+}
+
+char Rope::at(size_t pos) const {
+    size_t offset;
+    return find(pos, offset)->data[offset];
+}
+
+std::shared_ptr<char[]> Rope::share() const {
+    size_t offset;
+    std::vector<const Leaf*> leafs;
+    for (const Leaf* leaf = find(0, offset); leaf; leaf = leaf->next) {
+        leaf->references++;
+        leafs.push_back(leaf);
+    }
+    return std::shared_ptr<char[]>(nullptr, [leafs = std::move(leafs)](char*) {
+        for (const Leaf* leaf : leafs) {
+            release(leaf);
+        }
+    });
+}
+
+size_t Rope::getBytesMoved() const {
+    return bytesMoved;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <sys/types.h>
+
+// Text in a B-tree of chunks whose inner nodes keep a Summary of every child,
+// so finding an offset, a line or a column and editing anywhere are O(log n).
+// The leafs are linked, iterating over them doesn't need the tree.
+// There is always at least one leaf, it is only empty if the whole rope is.
+// A leaf that was shared is never written again, an edit copies it first.
+class Rope{
+    public:
+    static constexpr size_t leafCapacity = 4096;
+    static constexpr size_t maxChildren = 16;
+    struct Summary{
+        size_t bytes = 0;
+        size_t newLines = 0;
+        size_t codepoints = 0;
+        size_t tabs = 0;
+        static Summary of(const char* data, size_t len);
+        // display width, one column per utf8 character and four per tab
+        size_t columns() const {
+            return codepoints + 3*tabs;
+        }
+        Summary& operator+=(const Summary& rhs);
+        Summary& operator-=(const Summary& rhs);
+    };
+    struct Node{
+        // bytes in a leaf, children in an inner node
+        size_t count = 0;
+    };
+    struct Leaf : Node{
+        Leaf* prev = nullptr;
+        Leaf* next = nullptr;
+        // the rope and every owner from share() that still reads the leaf
+        mutable std::atomic<size_t> references = 1;
+        char data[leafCapacity];
+    };
+    Rope();
+    Rope(Rope&&);
+    Rope& operator=(Rope&&);
+    Rope(const Rope&) = delete;
+    Rope& operator=(const Rope&) = delete;
+    ~Rope();
+    void assign(const char* content, size_t len);
+    // replaces the content with the rest of file, returns false if reading failed
+    bool read(FILE* file);
+    void insert(size_t pos, const char* content, size_t len);
+    void erase(size_t pos, size_t len);
+    size_t size() const;
+    size_t lines() const;
+    // summary of [0, pos)
+    Summary prefix(size_t pos) const;
+    // the position right behind the n-th (counting from 0) '\n'
+    size_t afterNewLine(size_t n) const;
+    // the start of the leaf in which the rope has more than the given number of columns,
+    // reached is set to the columns in front of that leaf
+    size_t beforeColumn(size_t columns, size_t& reached) const;
+    // the leaf containing pos and the offset of pos in it, size() is behind the last byte of the last leaf
+    const Leaf* find(size_t pos, size_t& offset) const;
+    char at(size_t pos) const;
+    // calls f(pointer, length) for every leaf's part of [from, to)
+    template <typename F>
+    void segments(size_t from, size_t to, F&& f) const {
+        if (from >= to) {
+            return;
+        }
+        size_t offset;
+        const Leaf* leaf = find(from, offset);
+        while (from < to) {
+            const size_t len = std::min(leaf->count-offset, to-from);
+            f(leaf->data+offset, len);
+            from += len;
+            leaf = leaf->next;
+            offset = 0;
+        }
+    }
+    // keeps every leaf as it is now alive and unchanged until the returned owner and all its copies are gone,
+    // for reading the leafs from another thread
+    std::shared_ptr<char[]> share() const;
+    // total number of bytes memmoved inside of leafs so far, for benchmarks
+    size_t getBytesMoved() const;
+    private:
+    struct Inner;
+    template <typename F>
+    void build(F&& fill);
+    void destroy();
+    Node* root = nullptr;
+    size_t height = 0; // number of inner levels above the leafs
+    Summary total{};
+    size_t bytesMoved = 0;
+};
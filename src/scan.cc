@@ -0,0 +1,253 @@
+#include "scan.hpp"
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#else
+#define SCAN_X86 0
+#endif
+
+static size_t countByteScalar(const char* data, size_t len, char byte) {
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++) {
+        count += data[i] == byte;
+    }
+    return count;
+}
+
+static size_t findNthByteScalar(const char* data, size_t len, char byte, size_t n) {
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == byte && !n--) {
+            return i;
+        }
+    }
+    return len;
+}
+
+static size_t findBytesScalar(const char* data, size_t len, char byte, size_t* positions, size_t capacity, size_t& scanned) {
+    size_t count = 0;
+    size_t i;
+    for (i = 0; i < len && count < capacity; i++) {
+        if (data[i] == byte) {
+            positions[count++] = i;
+        }
+    }
+    scanned = i;
+    return count;
+}
+
+static size_t findPairsScalar(const char* data, size_t len, char first, char last, size_t distance, size_t* positions, size_t capacity, size_t& scanned) {
+    size_t count = 0;
+    size_t i = 0;
+    for (; i+distance < len && count < capacity; i++) {
+        if (data[i] == first && data[i+distance] == last) {
+            positions[count++] = i;
+        }
+    }
+    scanned = i;
+    return count;
+}
+
+static size_t countCodepointsScalar(const char* data, size_t len) {
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++) {
+        count += (data[i] & 0xC0) != 0x80;
+    }
+    return count;
+}
+
+#if SCAN_X86
+
+// every instruction set provides two functions that turn 64 bytes into a bit mask:
+// ISA##EqMask(p, byte): bit i is set if p[i] == byte
+// ISA##CodepointMask(p): bit i is set if p[i] is not a utf8 continuation byte
+// As signed chars continuation bytes are -128..-65, everything else is greater.
+// SCAN_KERNELS builds the actual kernels from them, compiled for that instruction set.
+#define SCAN_KERNELS(ISA, TARGET) \
+__attribute__((target(TARGET))) static size_t countByte##ISA(const char* data, size_t len, char byte) { \
+    size_t count = 0; \
+    size_t i = 0; \
+    for (; i+64 <= len; i += 64) { \
+        count += __builtin_popcountll(ISA##EqMask(data+i, byte)); \
+    } \
+    return count + countByteScalar(data+i, len-i, byte); \
+} \
+__attribute__((target(TARGET))) static size_t findNthByte##ISA(const char* data, size_t len, char byte, size_t n) { \
+    size_t i = 0; \
+    for (; i+64 <= len; i += 64) { \
+        uint64_t mask = ISA##EqMask(data+i, byte); \
+        const size_t found = __builtin_popcountll(mask); \
+        if (n < found) { \
+            for (; n; n--) { \
+                mask &= mask-1; \
+            } \
+            return i + __builtin_ctzll(mask); \
+        } \
+        n -= found; \
+    } \
+    return i + findNthByteScalar(data+i, len-i, byte, n); \
+} \
+__attribute__((target(TARGET))) static size_t findBytes##ISA(const char* data, size_t len, char byte, size_t* positions, size_t capacity, size_t& scanned) { \
+    size_t count = 0; \
+    size_t i = 0; \
+    for (; i+64 <= len && capacity-count >= 64; i += 64) { \
+        /* writes in groups of four without branching on every bit, the surplus lands in free slots */ \
+        uint64_t mask = ISA##EqMask(data+i, byte); \
+        const size_t found = __builtin_popcountll(mask); \
+        for (size_t j = 0; j < found; j += 4) { \
+            for (size_t k = 0; k < 4; k++) { \
+                positions[count+j+k] = i + __builtin_ctzll(mask | 1ull << 63); \
+                mask &= mask-1; \
+            } \
+        } \
+        count += found; \
+    } \
+    if (i+64 > len) { \
+        size_t tail; \
+        const size_t found = findBytesScalar(data+i, len-i, byte, positions+count, capacity-count, tail); \
+        for (size_t j = count; j < count+found; j++) { \
+            positions[j] += i; \
+        } \
+        count += found; \
+        i += tail; \
+    } \
+    scanned = i; \
+    return count; \
+} \
+__attribute__((target(TARGET))) static size_t findPairs##ISA(const char* data, size_t len, char first, char last, size_t distance, size_t* positions, size_t capacity, size_t& scanned) { \
+    size_t count = 0; \
+    size_t i = 0; \
+    for (; i+distance+64 <= len && capacity-count >= 64; i += 64) { \
+        uint64_t mask = ISA##EqMask(data+i, first) & ISA##EqMask(data+i+distance, last); \
+        while (mask) { \
+            positions[count++] = i + __builtin_ctzll(mask); \
+            mask &= mask-1; \
+        } \
+    } \
+    if (i+distance+64 > len) { \
+        size_t tail; \
+        const size_t found = findPairsScalar(data+i, len-i, first, last, distance, positions+count, capacity-count, tail); \
+        for (size_t j = count; j < count+found; j++) { \
+            positions[j] += i; \
+        } \
+        count += found; \
+        i += tail; \
+    } \
+    scanned = i; \
+    return count; \
+} \
+__attribute__((target(TARGET))) static size_t countCodepoints##ISA(const char* data, size_t len) { \
+    size_t count = 0; \
+    size_t i = 0; \
+    for (; i+64 <= len; i += 64) { \
+        count += __builtin_popcountll(ISA##CodepointMask(data+i)); \
+    } \
+    return count + countCodepointsScalar(data+i, len-i); \
+}
+
+__attribute__((target("sse2"))) static inline uint64_t sse2EqMask(const char* p, char byte) {
+    const __m128i needle = _mm_set1_epi8(byte);
+    uint64_t mask = 0;
+    for (int i = 0; i < 4; i++) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p+16*i));
+        mask |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)))) << (16*i);
+    }
+    return mask;
+}
+
+__attribute__((target("sse2"))) static inline uint64_t sse2CodepointMask(const char* p) {
+    const __m128i limit = _mm_set1_epi8(-65);
+    uint64_t mask = 0;
+    for (int i = 0; i < 4; i++) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p+16*i));
+        mask |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(v, limit)))) << (16*i);
+    }
+    return mask;
+}
+
+__attribute__((target("avx2"))) static inline uint64_t avx2EqMask(const char* p, char byte) {
+    const __m256i needle = _mm256_set1_epi8(byte);
+    const __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    const __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p+32));
+    return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, needle)))
+        | static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, needle)))) << 32;
+}
+
+__attribute__((target("avx2"))) static inline uint64_t avx2CodepointMask(const char* p) {
+    const __m256i limit = _mm256_set1_epi8(-65);
+    const __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    const __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p+32));
+    return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(lo, limit)))
+        | static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(hi, limit)))) << 32;
+}
+
+__attribute__((target("avx512f,avx512bw"))) static inline uint64_t avx512EqMask(const char* p, char byte) {
+    return _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(p), _mm512_set1_epi8(byte));
+}
+
+__attribute__((target("avx512f,avx512bw"))) static inline uint64_t avx512CodepointMask(const char* p) {
+    return _mm512_cmpgt_epi8_mask(_mm512_loadu_si512(p), _mm512_set1_epi8(-65));
+}
+
+SCAN_KERNELS(sse2, "sse2")
+SCAN_KERNELS(avx2, "avx2,popcnt,bmi")
+SCAN_KERNELS(avx512, "avx512f,avx512bw,popcnt,bmi")
+
+#undef SCAN_KERNELS
+
+#endif // SCAN_X86
+
+struct ScanKernels{
+    const char* name;
+    size_t (*countByte)(const char*, size_t, char);
+    size_t (*findNthByte)(const char*, size_t, char, size_t);
+    size_t (*findBytes)(const char*, size_t, char, size_t*, size_t, size_t&);
+    size_t (*findPairs)(const char*, size_t, char, char, size_t, size_t*, size_t, size_t&);
+    size_t (*countCodepoints)(const char*, size_t);
+};
+
+static ScanKernels pickKernels() {
+#if SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw")) {
+        return {"avx512", countByteavx512, findNthByteavx512, findBytesavx512, findPairsavx512, countCodepointsavx512};
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return {"avx2", countByteavx2, findNthByteavx2, findBytesavx2, findPairsavx2, countCodepointsavx2};
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return {"sse2", countBytesse2, findNthBytesse2, findBytessse2, findPairssse2, countCodepointssse2};
+    }
+#endif
+    return {"scalar", countByteScalar, findNthByteScalar, findBytesScalar, findPairsScalar, countCodepointsScalar};
+}
+
+static const ScanKernels& kernels() {
+    static const ScanKernels picked = pickKernels();
+    return picked;
+}
+
+size_t countByte(const char* data, size_t len, char byte) {
+    return kernels().countByte(data, len, byte);
+}
+
+size_t findNthByte(const char* data, size_t len, char byte, size_t n) {
+    return kernels().findNthByte(data, len, byte, n);
+}
+
+size_t findBytes(const char* data, size_t len, char byte, size_t* positions, size_t capacity, size_t& scanned) {
+    return kernels().findBytes(data, len, byte, positions, capacity, scanned);
+}
+
+size_t findPairs(const char* data, size_t len, char first, char last, size_t distance, size_t* positions, size_t capacity, size_t& scanned) {
+    return kernels().findPairs(data, len, first, last, distance, positions, capacity, scanned);
+}
+
+size_t countCodepoints(const char* data, size_t len) {
+    return kernels().countCodepoints(data, len);
+}
+
+const char* scanKernelName() {
+    return kernels().name;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+
+// Vectorized byte scanning kernels (AVX-512, AVX2, SSE2 or scalar), picked once at runtime.
+// They work on one contiguous segment, callers iterate the segments on both sides of the gap.
+
+// how often byte occurs in [data, data+len)
+size_t countByte(const char* data, size_t len, char byte);
+// offset of the n-th (counting from 0) occurrence of byte, len if there are fewer
+size_t findNthByte(const char* data, size_t len, char byte, size_t n);
+// writes the offsets of the occurrences of byte to positions, returns how many were written.
+// It may stop early when positions is (almost) full, scanned is set to the number of bytes looked at.
+// capacity should be at least 64.
+size_t findBytes(const char* data, size_t len, char byte, size_t* positions, size_t capacity, size_t& scanned);
+// the same for the offsets i where data[i] == first and data[i+distance] == last, scanned counts the offsets looked at
+size_t findPairs(const char* data, size_t len, char first, char last, size_t distance, size_t* positions, size_t capacity, size_t& scanned);
+// bytes that are not utf8 continuation bytes (0b10xxxxxx)
+size_t countCodepoints(const char* data, size_t len);
+// the name of the instruction set the kernels run on
+const char* scanKernelName();
+
+static inline size_t countNewLines(const char* data, size_t len) {
+    return countByte(data, len, '\n');
+}
+
+static inline size_t countTabs(const char* data, size_t len) {
+    return countByte(data, len, '\t');
+}
+
+// width on screen: one column per utf8 character, four per tab
+static inline size_t countColumns(const char* data, size_t len) {
+    return countCodepoints(data, len) + 3*countTabs(data, len);
+}
+
+static inline size_t columnsOf(char c) {
+    if (c & 0x80) {
+        return static_cast<bool>(c & 0x40);
+    }
+    return c == '\t' ? 4 : 1;
+}
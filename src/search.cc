@@ -0,0 +1,170 @@
+#include "search.hpp"
+#include "scan.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+// candidates are collected in batches of this size
+static constexpr size_t batchSize = 256;
+
+Finder::Finder(std::string_view needle) : needle(needle) {
+    // Horspool: the distance from the last occurrence of a byte (not counting the last position) to the end
+    shift.fill(needle.size());
+    for (size_t i = 0; i+1 < needle.size(); i++) {
+        shift[static_cast<unsigned char>(needle[i])] = needle.size()-1-i;
+    }
+}
+
+bool Finder::searchPiece(const char* data, size_t len, const std::function<bool(size_t)>& found) const {
+    const size_t m = needle.size();
+    if (!m || len < m) {
+        return true;
+    }
+    if (m > maxFiltered) {
+        const unsigned char last = needle[m-1];
+        for (size_t i = 0; i+m <= len;) {
+            const unsigned char c = data[i+m-1];
+            if (c == last && !std::memcmp(data+i, needle.data(), m-1) && !found(i)) {
+                return false;
+            }
+            i += shift[c];
+        }
+        return true;
+    }
+    size_t positions[batchSize];
+    for (size_t done = 0; done+m <= len;) {
+        size_t scanned;
+        const size_t count = m == 1
+            ? findBytes(data+done, len-done, needle[0], positions, batchSize, scanned)
+            : findPairs(data+done, len-done, needle[0], needle[m-1], m-1, positions, batchSize, scanned);
+        for (size_t i = 0; i < count; i++) {
+            // the first and the last byte are known to match already
+            const size_t pos = done+positions[i];
+            if ((m <= 2 || !std::memcmp(data+pos+1, needle.data()+1, m-2)) && !found(pos)) {
+                return false;
+            }
+        }
+        done += scanned;
+    }
+    return true;
+}
+
+void Finder::search(const Segments& segments, size_t size, size_t from, size_t to, const std::function<bool(size_t)>& found) const {
+    const size_t m = needle.size();
+    to = std::min(to, size);
+    if (!m || from >= to) {
+        return;
+    }
+    // the last m-1 bytes in front of the current piece, a match crossing into the piece starts in them
+    std::string carry;
+    std::string window;
+    size_t pos = from;
+    bool searching = true;
+    segments(from, std::min(size, to+m-1), [&](const char* data, size_t len) {
+        if (!searching) {
+            return;
+        }
+        if (!carry.empty()) {
+            window.assign(carry);
+            window.append(data, std::min(len, m-1));
+            const size_t windowStart = pos-carry.size();
+            searchPiece(window.data(), window.size(), [&](size_t match) {
+                if (match >= carry.size() || windowStart+match >= to) {
+                    // the piece itself has the rest
+                    return false;
+                }
+                searching = found(windowStart+match);
+                return searching;
+            });
+        }
+        if (searching) {
+            searchPiece(data, len, [&](size_t match) {
+                searching = pos+match < to && found(pos+match);
+                return searching;
+            });
+        }
+        if (m > 1) {
+            if (len >= m-1) {
+                carry.assign(data+len-(m-1), m-1);
+            } else {
+                carry.append(data, len);
+                carry.erase(0, carry.size() - std::min(carry.size(), m-1));
+            }
+        }
+        pos += len;
+    });
+}
+
+void forEachChunk(size_t chunks, const std::function<void(size_t chunk)>& work) {
+    // the chunks are handed out one after the other, a thread that was slow doesn't hold up the others
+    std::atomic<size_t> next = 0;
+    auto worker = [&] {
+        for (size_t chunk; (chunk = next++) < chunks;) {
+            work(chunk);
+        }
+    };
+    const size_t threadCount = std::min<size_t>(chunks, std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+std::vector<size_t> Finder::findAll(const Segments& segments, size_t size) const {
+    std::vector<std::vector<size_t>> found((size+chunkSize-1) / chunkSize);
+    forEachChunk(found.size(), [&](size_t chunk) {
+        search(segments, size, chunk*chunkSize, (chunk+1)*chunkSize, [&](size_t pos) {
+            found[chunk].push_back(pos);
+            return true;
+        });
+    });
+    return joinChunks(found);
+}
+
+size_t Finder::findNext(const Segments& segments, size_t size, size_t from) const {
+    size_t next = size;
+    search(segments, size, from, size, [&](size_t pos) {
+        next = pos;
+        return false;
+    });
+    return next;
+}
+
+void Finder::refine(const Segments& segments, size_t size, std::vector<size_t>& matches) const {
+    const size_t m = needle.size();
+    while (!matches.empty() && matches.back()+m > size) {
+        matches.pop_back();
+    }
+    if (matches.empty()) {
+        return;
+    }
+    // a match across a seam is put together from the pieces it touches
+    auto across = [&](size_t pos) {
+        bool equal = true;
+        size_t compared = 0;
+        segments(pos, pos+m, [&](const char* data, size_t len) {
+            equal = equal && !std::memcmp(data, needle.data()+compared, len);
+            compared += len;
+        });
+        return equal;
+    };
+    size_t kept = 0;
+    size_t next = 0;
+    size_t pos = matches.front();
+    segments(matches.front(), matches.back()+m, [&](const char* data, size_t len) {
+        for (; next < matches.size() && matches[next] < pos+len; next++) {
+            const size_t match = matches[next];
+            const bool inside = match+m <= pos+len;
+            if (inside ? !std::memcmp(data+match-pos, needle.data(), m) : across(match)) {
+                matches[kept++] = match;
+            }
+        }
+        pos += len;
+    });
+    matches.resize(kept);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Literal search over text that is stored in a few contiguous pieces, like the two sides of the gap
+// or the leafs of the rope. The pieces are searched where they are, only the bytes around the seams
+// between them are copied, so matches that cross a seam are found too.
+// Short needles look for their first and last byte with the vectorized scan kernels and compare the
+// rest of the candidates, long ones are searched with Boyer-Moore-Horspool.
+class Finder{
+    public:
+    // calls piece(pointer, length) for the pieces of [from, to) in order
+    using Segments = std::function<void(size_t from, size_t to, const std::function<void(const char*, size_t)>& piece)>;
+    // needles up to this length are searched with the first and last byte filter
+    static constexpr size_t maxFiltered = 256;
+    // find-all splits larger texts into chunks of this size and searches them on several threads
+    static constexpr size_t chunkSize = 16 << 20;
+    explicit Finder(std::string_view needle);
+    // calls found(pos) for the matches starting in [from, to) of a text of size bytes, in order,
+    // until found returns false
+    void search(const Segments& segments, size_t size, size_t from, size_t to, const std::function<bool(size_t)>& found) const;
+    // the starts of all matches in a text of size bytes, in order
+    std::vector<size_t> findAll(const Segments& segments, size_t size) const;
+    // the first match at or after from, size if there is none
+    size_t findNext(const Segments& segments, size_t size, size_t from) const;
+    // keeps the matches at which the needle matches too, for a needle that was made longer
+    void refine(const Segments& segments, size_t size, std::vector<size_t>& matches) const;
+    const std::string& getNeedle() const {
+        return needle;
+    }
+    private:
+    // the matches completely inside of [data, data+len)
+    bool searchPiece(const char* data, size_t len, const std::function<bool(size_t)>& found) const;
+    std::string needle;
+    // how far Horspool moves on for the byte under the end of the needle
+    std::array<size_t, 256> shift{};
+};
+
+// runs work(chunk) for every chunk in [0, chunks) on up to one thread per core
+void forEachChunk(size_t chunks, const std::function<void(size_t chunk)>& work);
+
+// the results of all chunks in order
+template <typename T>
+std::vector<T> joinChunks(const std::vector<std::vector<T>>& chunks) {
+    size_t total = 0;
+    for (const auto& chunk : chunks) {
+        total += chunk.size();
+    }
+    std::vector<T> joined;
+    joined.reserve(total);
+    for (const auto& chunk : chunks) {
+        joined.insert(joined.end(), chunk.begin(), chunk.end());
+    }
+    return joined;
+}
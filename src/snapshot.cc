@@ -0,0 +1,253 @@
+#include "snapshot.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+// how much the writer takes at once, preserve() waits for at most one of these
+static constexpr size_t batchSize = 1 << 20;
+static constexpr int maxIovecs = 64;
+// copying a bit around the changed bytes saves copying again for the next keystrokes
+static constexpr size_t copyAround = 64 << 10;
+
+// the writers of two saves of the same file finish in any order, the older one must not rename over the newer one
+static std::mutex renaming;
+static uint64_t started = 0;
+static std::unordered_map<std::string, uint64_t> renamed;
+// the writers that didn't finish yet, see waitForAll()
+static std::mutex running;
+static std::condition_variable stopped;
+static size_t writers = 0;
+
+Snapshot::Snapshot(const char* target, Done done) : callback(std::move(done)) {
+    // saving through a symlink replaces the file it points to, not the link
+    char* resolved = realpath(target, nullptr);
+    file = resolved ? resolved : target;
+    free(resolved);
+    struct stat st;
+    if (!stat(file.c_str(), &st)) {
+        mode = st.st_mode & 07777;
+    } else {
+        const mode_t mask = umask(0);
+        umask(mask);
+        mode = 0666 & ~mask;
+    }
+}
+
+void Snapshot::add(const char* data, size_t len, std::shared_ptr<char[]> owner) {
+    if (len) {
+        pieces.push_back({data, len, std::move(owner)});
+    }
+}
+
+void Snapshot::start(const std::shared_ptr<Snapshot>& snapshot) {
+    {
+        std::lock_guard lock(renaming);
+        snapshot->generation = ++started;
+    }
+    {
+        std::lock_guard lock(running);
+        writers++;
+    }
+    std::thread([snapshot] {
+        snapshot->write();
+    }).detach();
+}
+
+bool Snapshot::borrows(size_t first, size_t last, const char* from, size_t len) const {
+    for (size_t i = first; i < last; i++) {
+        const Piece& piece = pieces[i];
+        if (!piece.owner && piece.data < from+len && from < piece.data+piece.len) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Snapshot::preserve(const char* from, size_t len) {
+    std::unique_lock lock(mutex);
+    if (!borrows(written, pieces.size(), from, len)) {
+        return;
+    }
+    if (borrows(written, writing, from, len)) {
+        // the writer is reading them right now
+        waiting++;
+        progress.wait(lock, [&] {
+            return !borrows(written, writing, from, len);
+        });
+        waiting--;
+        progress.notify_all();
+    }
+    for (size_t i = writing; i < pieces.size(); i++) {
+        const Piece piece = pieces[i];
+        if (piece.owner || piece.data >= from+len || from >= piece.data+piece.len) {
+            continue;
+        }
+        const size_t begin = from > piece.data ? from-piece.data : 0;
+        const size_t end = std::min<size_t>(piece.len, from+len-piece.data);
+        const size_t copyBegin = begin > copyAround ? begin-copyAround : 0;
+        const size_t copyEnd = std::min(piece.len, end+copyAround);
+        auto copy = std::make_shared_for_overwrite<char[]>(copyEnd-copyBegin);
+        std::memcpy(copy.get(), piece.data+copyBegin, copyEnd-copyBegin);
+        Piece split[3];
+        size_t count = 0;
+        if (copyBegin) {
+            split[count++] = {piece.data, copyBegin, nullptr};
+        }
+        split[count++] = {copy.get(), copyEnd-copyBegin, copy};
+        if (copyEnd < piece.len) {
+            split[count++] = {piece.data+copyEnd, piece.len-copyEnd, nullptr};
+        }
+        pieces[i] = split[0];
+        pieces.insert(pieces.begin()+i+1, split+1, split+count);
+        i += count-1;
+    }
+}
+
+void Snapshot::adopt(const char* from, size_t len, const std::shared_ptr<char[]>& owner) {
+    std::lock_guard lock(mutex);
+    // the ones being written too, the writer reads them without the lock
+    for (size_t i = written; i < pieces.size(); i++) {
+        Piece& piece = pieces[i];
+        if (!piece.owner && piece.data < from+len && from < piece.data+piece.len) {
+            piece.owner = owner;
+        }
+    }
+}
+
+bool Snapshot::isDone() {
+    std::lock_guard lock(mutex);
+    return done;
+}
+
+void Snapshot::wait() {
+    std::unique_lock lock(mutex);
+    progress.wait(lock, [&] {
+        return done;
+    });
+}
+
+static bool writeAll(int fd, iovec* iov, int count) {
+    while (count) {
+        const ssize_t n = writev(fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        size_t left = n;
+        while (count && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+            iov->iov_len -= left;
+        }
+    }
+    return true;
+}
+
+// the rename only survives a crash once the directory was synced too
+static void syncDirectory(const std::string& file) {
+    const size_t slash = file.rfind('/');
+    const std::string directory = slash == std::string::npos ? "." : slash ? file.substr(0, slash) : "/";
+    const int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+void Snapshot::write() {
+    std::string temporary = file + ".XXXXXX";
+    const int fd = mkstemp(temporary.data());
+    bool saved = fd >= 0 && !fchmod(fd, mode);
+    int error = saved ? 0 : errno;
+    std::unique_lock lock(mutex);
+    while (saved && written < pieces.size()) {
+        progress.wait(lock, [&] {
+            return !waiting;
+        });
+        iovec iov[maxIovecs];
+        int count = 0;
+        size_t bytes = 0;
+        while (writing < pieces.size() && count < maxIovecs && bytes < batchSize) {
+            if (bytes+pieces[writing].len > batchSize) {
+                // only the front of a large piece, the rest can still be preserved on its own
+                const size_t take = batchSize-bytes;
+                const Piece rest{pieces[writing].data+take, pieces[writing].len-take, pieces[writing].owner};
+                pieces[writing].len = take;
+                pieces.insert(pieces.begin()+writing+1, rest);
+            }
+            iov[count++] = {const_cast<char*>(pieces[writing].data), pieces[writing].len};
+            bytes += pieces[writing].len;
+            writing++;
+        }
+        lock.unlock();
+        saved = writeAll(fd, iov, count);
+        error = saved ? 0 : errno;
+        lock.lock();
+        written = writing;
+        progress.notify_all();
+    }
+    // nothing of the Text is needed anymore, the copies can go
+    pieces.clear();
+    pieces.shrink_to_fit();
+    written = 0;
+    writing = 0;
+    lock.unlock();
+    if (fd >= 0) {
+        if (saved && fsync(fd)) {
+            saved = false;
+            error = errno;
+        }
+        if (close(fd) && saved) {
+            saved = false;
+            error = errno;
+        }
+        bool newer = false;
+        if (saved) {
+            std::lock_guard order(renaming);
+            uint64_t& last = renamed[file];
+            // a newer save is on disk already and has everything this one has
+            newer = last > generation;
+            saved = newer || !rename(temporary.c_str(), file.c_str());
+            error = saved ? 0 : errno;
+            if (saved && !newer) {
+                last = generation;
+            }
+        }
+        if (saved && !newer) {
+            syncDirectory(file);
+        } else {
+            unlink(temporary.c_str());
+        }
+    }
+    if (callback) {
+        callback(error);
+    }
+    lock.lock();
+    done = true;
+    progress.notify_all();
+    lock.unlock();
+    std::lock_guard stop(running);
+    writers--;
+    stopped.notify_all();
+}
+
+void Snapshot::waitForAll() {
+    std::unique_lock lock(running);
+    stopped.wait(lock, [] {
+        return !writers;
+    });
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+// The content of a Text at the moment saving started, written to disk by a background thread.
+// Its pieces point into the Text's buffer instead of copying it. Before the Text overwrites or
+// frees bytes it calls preserve(), which copies whatever of them wasn't written yet, or adopt(), which keeps
+// the whole allocation alive until the writer is done with it.
+// The file is written to a temporary file next to the target, synced and renamed over the target,
+// so the target is never seen half written. Of several saves of one file the newest one always ends up there.
+class Snapshot{
+    public:
+    // called from the writer thread once the file was renamed into place, with 0, or saving failed, with the errno of what failed
+    using Done = std::function<void(int error)>;
+    Snapshot(const char* file, Done done);
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+    // appends len bytes at data, they have to stay valid until preserve() was called for them,
+    // unless owner keeps them alive
+    void add(const char* data, size_t len, std::shared_ptr<char[]> owner = nullptr);
+    // starts the writer, nothing may be added afterwards
+    static void start(const std::shared_ptr<Snapshot>& snapshot);
+    // [from, from+len) is about to change, copies the part of it that still has to be written
+    void preserve(const char* from, size_t len);
+    // [from, from+len) is about to be freed, the pieces that still point into it keep owner instead of a copy
+    void adopt(const char* from, size_t len, const std::shared_ptr<char[]>& owner);
+    bool isDone();
+    // blocks until the writer finished
+    void wait();
+    // blocks until the writers of all snapshots finished, also those of Texts that are gone already
+    static void waitForAll();
+    private:
+    struct Piece{
+        const char* data;
+        size_t len;
+        // keeps data alive once it was copied out of the Text
+        std::shared_ptr<char[]> owner;
+    };
+    void write();
+    // overlap of [from, from+len) with pieces[first, last) that still point into the Text
+    bool borrows(size_t first, size_t last, const char* from, size_t len) const;
+    std::mutex mutex;
+    std::condition_variable progress;
+    std::vector<Piece> pieces;
+    // pieces[0, written) are on disk, pieces[written, writing) are being written right now
+    size_t written = 0;
+    size_t writing = 0;
+    // preserve() calls waiting for the writer to let go of the Text's bytes
+    size_t waiting = 0;
+    bool done = false;
+    std::string file;
+    // order in which the saves started, see renamed in snapshot.cc
+    uint64_t generation = 0;
+    mode_t mode;
+    Done callback;
+};
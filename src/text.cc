@@ -1,47 +1,349 @@
 #include "text.hpp"
+#include "scan.hpp"
 #include <algorithm>
 #include <cstdio>
+#include <fcntl.h>
 #include <options.hpp>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr bool isWordBreak(char from, char to) {
+    const bool fromIsUpper = 'A' <= from && from <= 'Z';
+    const bool fromIsLower = 'a' <= from && from <= 'z';
+    const bool fromIsNumber = '0' <= from && from <= '9';
+    const bool fromIsNotSpecial = from == '_' and options.underscore_is_word_break;
+    const bool fromIsAlphaNum = fromIsUpper || fromIsLower || fromIsNumber || fromIsNotSpecial;
+    const bool toIsUpper = 'A' <= to && to <= 'Z';
+    const bool toIsLower = 'a' <= to && to <= 'z';
+    const bool toIsNumber = '0' <= to && to <= '9';
+    const bool toIsNotSpecial = to == '_' and options.underscore_is_word_break;
+    const bool toIsAlphaNum = toIsUpper || toIsLower || toIsNumber || toIsNotSpecial;
+    const bool fromIsWhiteSpace =
+    0x20 == from || // SPACE
+    0x9 == from || // TAB
+    0xa == from || // LINE FEED
+    0xb == from || // LINE TABULATION
+    0xc == from || // FORM FEED
+    0xd == from; // CARRIAGE RETURN
+    const bool toIsWhiteSpace =
+    0x20 == to || // SPACE
+    0x9 == to || // TAB
+    0xa == to || // LINE FEED
+    0xb == to || // LINE TABULATION
+    0xc == to || // FORM FEED
+    0xd == to; // CARRIAGE RETURN
+    const bool fromIsSpecial = !(fromIsAlphaNum || fromIsWhiteSpace);
+    const bool toIsSpecial = !(toIsAlphaNum || toIsWhiteSpace);
+    
+    
+    //                     FROM IS ALPHA NUM | FROM IS WHITE SPACE | FROM IS SPECIAL CHAR
+    // TO IS ALPHA NUM          false                   false               true
+    // TO IS WHITE SPACE        true                    false               true
+    // TO IS SPECIAL CHAR       true                    false               false
+    return !fromIsWhiteSpace && (fromIsSpecial != toIsSpecial || fromIsAlphaNum != toIsAlphaNum);
+}
 
 #if ROPE
 
-void Rope::print() {
-    if (length < 0) {
-        printf("{\n\"length\": %ld, \"left\": ", -length);
-        children.left->print();
-        printf(", \"right\": ");
-        children.right->print();
-        printf("}\n");
-    } else {
-        printf("{\n\"length\": %ld, \"size\": %zu,\n", length, string.size);
-        printf("\"content\": \"");
-        for (ssize_t i = 0; i < length; i++) {
-            printf("%c", string.content[i]);
-        }
-        printf("\"\n}\n");
+Text::Text(const char* file) {
+    load(file);
+}
+
+Text& Text::operator=(Text&& moveFrom) {
+    std::swap(cursor, moveFrom.cursor);
+    rope = std::move(moveFrom.rope);
+    compressed = std::move(moveFrom.compressed);
+    history = std::move(moveFrom.history);
+    highlighter = std::move(moveFrom.highlighter);
+    saves = std::move(moveFrom.saves);
+    return *this;
+}
+
+Text::Text(Text&& moveFrom) :
+    cursor(moveFrom.cursor),
+    rope(std::move(moveFrom.rope)),
+    compressed(std::move(moveFrom.compressed)),
+    history(std::move(moveFrom.history)),
+    highlighter(std::move(moveFrom.highlighter)),
+    saves(std::move(moveFrom.saves)) {
+    moveFrom.cursor = 0;
+}
+
+// the saves that are still running keep the leafs they read
+Text::~Text() = default;
+
+void Text::store(Compressed&& content) {
+    assert(!content.empty() && content.size() == rope.size());
+    rope = Rope();
+    compressed = std::move(content);
+}
+
+void Text::decompress() {
+    if (compressed.empty()) {
+        return;
+    }
+    const auto content = std::make_unique_for_overwrite<char[]>(compressed.size());
+    const bool inflated = compressed.inflate(content.get());
+    assert(inflated);
+    UNUSED(inflated);
+    rope.assign(content.get(), compressed.size());
+    compressed = Compressed();
+}
+
+void Text::load(const char* file) {
+    FILE* f = fopen(file, "r");
+    assert(f);
+    const bool read = rope.read(f);
+    assert(read);
+    UNUSED(read);
+    fclose(f);
+    cursor = 0;
+    compressed = Compressed();
+    history.clear();
+    highlighter = Highlighter();
+}
+
+void Text::saveInBackground(const char* file, Snapshot::Done done) const {
+    if (!file || !*file) {
+        return;
     }
+    std::erase_if(saves, [](const auto& save) {
+        return save->isDone();
+    });
+    // the writer reads the leafs themselves, edits copy a leaf before changing it until the writer let go of them
+    auto snapshot = std::make_shared<Snapshot>(file, std::move(done));
+    const auto leafs = rope.share();
+    rope.segments(0, rope.size(), [&](const char* data, size_t len) {
+        snapshot->add(data, len, std::shared_ptr<char[]>(leafs, const_cast<char*>(data)));
+    });
+    Snapshot::start(snapshot);
+    saves.push_back(std::move(snapshot));
 }
 
-void Text::print() {
-    printf("{\"cursor\": %lu, \"rope\":\n", cursor);
-    rope.print();
-    printf("}\n");
+Text::Spans Text::spans(size_t from, size_t to) const {
+    Spans spans;
+    to = std::min(to, rope.size());
+    rope.segments(std::min(from, to), to, [&](const char* data, size_t len) {
+        spans.emplace_back(data, len);
+    });
+    return spans;
 }
+
+void Text::print() const {
+    rope.segments(0, rope.size(), [&](const char* data, size_t len) {
+        printf("%.*s", static_cast<int>(len), data);
+    });
+}
+
 void Text::insert(char c) {
-    rope.insert(c, cursor);
-    cursor++;
+    history.record(cursor, 0, [](auto&&) {}, &c, 1);
+    highlightEdit(cursor, cursor, &c, 1);
+    rope.insert(cursor++, &c, 1);
+}
+
+void Text::insert(const char* str) {
+    insert(str, strlen(str));
+}
+
+void Text::insert(const char* str, size_t len) {
+    replace(cursor, cursor, str, len);
+}
+
+void Text::erase(size_t from, size_t to) {
+    replace(from, to, nullptr, 0);
+}
+
+void Text::splice(size_t from, size_t to, const char* str, size_t len) {
+    to = std::min(to, rope.size());
+    from = std::min(from, to);
+    highlightEdit(from, to, str, len);
+    rope.erase(from, to-from);
+    rope.insert(from, str, len);
+    cursor = from+len;
+}
+
+void Text::backspace(bool wordWise) {
+    if (cursor) {
+        edit(stepLeft(cursor, wordWise), cursor, nullptr, 0, true);
+    }
+}
+
+void Text::del(bool wordWise) {
+    if (cursor < rope.size()) {
+        edit(cursor, stepRight(cursor, wordWise), nullptr, 0, false);
+    }
+}
+
+void Text::left(bool wordWise) {
+    cursor = stepLeft(cursor, wordWise);
+}
+
+void Text::right(bool wordWise) {
+    cursor = stepRight(cursor, wordWise);
+}
+
+void Text::up(ssize_t inLineOffset) {
+    const size_t line = lineOf(cursor);
+    if (!line) {
+        return beginning();
+    }
+    if (inLineOffset < 0) {
+        inLineOffset = columnOf(cursor);
+    }
+    moveTo(posAtColumn(line-1, inLineOffset));
+}
+
+void Text::down(ssize_t inLineOffset) {
+    const size_t line = lineOf(cursor);
+    if (isLastLine(line)) {
+        return ending();
+    }
+    if (inLineOffset < 0) {
+        inLineOffset = columnOf(cursor);
+    }
+    moveTo(posAtColumn(line+1, inLineOffset));
+}
+
+ssize_t Text::home() {
+    const size_t startOfThisLine = lineStart(lineOf(cursor));
+    const size_t endOfThisLine = lineEnd(lineOf(cursor));
+    size_t endOfWhiteSpace = startOfThisLine;
+    for (auto it = begin()+startOfThisLine; endOfWhiteSpace < endOfThisLine && isWhiteSpace(*it); ++it) {
+        endOfWhiteSpace++;
+    }
+    if (cursor == startOfThisLine && endOfWhiteSpace > cursor) {
+        cursor = endOfWhiteSpace;
+    } else {
+        cursor = endOfWhiteSpace < cursor ? endOfWhiteSpace : startOfThisLine;
+    }
+    return cursor - startOfThisLine;
+}
+
+void Text::ende() {
+    cursor = lineEnd(lineOf(cursor));
+}
+
+void Text::moveTo(ssize_t newPos) {
+    if (newPos < 0) {
+        return;
+    }
+    if (static_cast<size_t>(newPos) > rope.size()) {
+        newPos = rope.size();
+    }
+    // don't land inside of a utf8 character
+    while (
+        newPos && static_cast<size_t>(newPos) < rope.size() &&
+        (at(newPos-1) & 0x80) && (at(newPos) & 0xC0) == 0x80
+    ) {
+        newPos++;
+    }
+    cursor = newPos;
+}
+
+void Text::beginning() {
+    cursor = 0;
+}
+
+void Text::ending() {
+    cursor = rope.size();
+}
+
+size_t Text::getFileSize() const {
+    return rope.size();
+}
+
+size_t Text::getLineCount() const {
+    return rope.lines();
+}
+
+size_t Text::getIndexedLineCount() const {
+    return rope.lines();
+}
+
+size_t Text::clampLine(size_t line) const {
+    return std::min(line, rope.lines()-1);
+}
+
+bool Text::isMapped() const {
+    return false;
+}
+
+size_t Text::lineOf(size_t pos) const {
+    return rope.prefix(pos).newLines;
+}
+
+size_t Text::lineStart(size_t line) const {
+    return line ? rope.afterNewLine(line-1) : 0;
 }
-void Text::insert(const char* string) {
-    for (const char* c = string; *c; c++) {
-        insert(*c);
+
+size_t Text::lineEnd(size_t line) const {
+    if (isLastLine(line)) {
+        return rope.size();
     }
+    return rope.afterNewLine(line)-1;
+}
+
+bool Text::isLastLine(size_t line) const {
+    return line+1 >= rope.lines();
+}
+
+size_t Text::columnsIn(size_t from, size_t to) const {
+    size_t columns = 0;
+    rope.segments(from, to, [&](const char* data, size_t len) {
+        columns += countColumns(data, len);
+    });
+    return columns;
+}
+
+size_t Text::columnOf(size_t pos) const {
+    // the summaries count characters and tabs, no need to look at the line itself
+    return rope.prefix(pos).columns() - rope.prefix(lineStart(lineOf(pos))).columns();
 }
-// void moveRel();
-Rope::Iterator Text::getView(int startLine, int lineCount) const {
-    UNUSED(startLine);
-    UNUSED(lineCount);
-    return begin();
+
+size_t Text::posAtColumn(size_t line, size_t column) const {
+    // descend to the leaf holding the column, skip whole blocks with the vectorized count, then walk the last few bytes
+    static constexpr size_t blockSize = 256;
+    const size_t start = lineStart(line);
+    const size_t end = lineEnd(line);
+    const size_t startColumns = rope.prefix(start).columns();
+    size_t leafColumns;
+    const size_t leaf = rope.beforeColumn(startColumns+column, leafColumns);
+    if (leaf > end) {
+        return end;
+    }
+    size_t pos = std::max(start, leaf);
+    size_t reached = leaf > start ? leafColumns-startColumns : 0;
+    while (end-pos > blockSize) {
+        const size_t columns = columnsIn(pos, pos+blockSize);
+        if (reached+columns >= column) {
+            break;
+        }
+        reached += columns;
+        pos += blockSize;
+    }
+    auto it = begin()+pos;
+    while (pos < end && reached < column) {
+        reached += columnsOf(*it);
+        ++it;
+        pos++;
+    }
+    // don't stop inside of a utf8 character
+    while (pos < end && (*it & 0xC0) == 0x80) {
+        ++it;
+        pos++;
+    }
+    return pos;
 }
+
+size_t Text::getBytesMoved() const {
+    return rope.getBytesMoved();
+}
+
+char Text::at(size_t pos) const {
+    return rope.at(pos);
+}
+
 #else
 
 const char* untitled = "Untitled";
@@ -51,29 +353,36 @@ Text::Text() {
     buffer = (char*)malloc(bufferSize);
     fileSize = 0;
     cursor = 0;
+    gap = 0;
 }
 
-Text::Text(const char* file) : cursor(0) {
-    FILE* f = fopen(file, "r");
-    fseek(f, 0, SEEK_END);
-    fileSize = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    bufferSize = fileSize + 1024;
-    buffer = (char*) malloc(bufferSize);
-    assert(fread(buffer+bufferSize-fileSize, fileSize, 1, f) == 1);
-    fclose(f);
+Text::Text(const char* file) {
+    load(file);
 }
 
 Text& Text::operator=(Text&& moveFrom) {
-    this->~Text();
+    release();
     buffer = moveFrom.buffer;
     bufferSize = moveFrom.bufferSize;
     fileSize = moveFrom.fileSize;
     cursor = moveFrom.cursor;
+    gap = moveFrom.gap;
+    bytesMoved = moveFrom.bytesMoved;
+    mappedSize = moveFrom.mappedSize;
+    indexed = moveFrom.indexed;
+    lines = std::move(moveFrom.lines);
+    columns = std::move(moveFrom.columns);
+    compressed = std::move(moveFrom.compressed);
+    history = std::move(moveFrom.history);
+    highlighter = std::move(moveFrom.highlighter);
+    saves = std::move(moveFrom.saves);
     moveFrom.buffer = nullptr;
     moveFrom.cursor = 0;
+    moveFrom.gap = 0;
     moveFrom.fileSize = 0;
     moveFrom.bufferSize = 0;
+    moveFrom.mappedSize = 0;
+    moveFrom.indexed = 0;
     return *this;
 }
 
@@ -81,23 +390,133 @@ Text::Text(Text&& moveFrom) :
     buffer(moveFrom.buffer),
     bufferSize(moveFrom.bufferSize),
     cursor(moveFrom.cursor),
-    fileSize(moveFrom.fileSize) {
+    gap(moveFrom.gap),
+    fileSize(moveFrom.fileSize),
+    bytesMoved(moveFrom.bytesMoved),
+    mappedSize(moveFrom.mappedSize),
+    indexed(moveFrom.indexed),
+    lines(std::move(moveFrom.lines)),
+    columns(std::move(moveFrom.columns)),
+    compressed(std::move(moveFrom.compressed)),
+    history(std::move(moveFrom.history)),
+    highlighter(std::move(moveFrom.highlighter)),
+    saves(std::move(moveFrom.saves)) {
     moveFrom.fileSize = 0;
     moveFrom.bufferSize = 0;
     moveFrom.buffer = nullptr;
     moveFrom.cursor = 0;
+    moveFrom.gap = 0;
+    moveFrom.mappedSize = 0;
+    moveFrom.indexed = 0;
 }
 
 Text::~Text() {
+    release();
+}
+
+void Text::release() {
+    dropBuffer();
+    columns.clear();
+}
+
+void Text::dropBuffer() {
     if (buffer) {
-        free(buffer);
+        // the saves that still read from it keep it alive instead of copying it, otherwise it goes right here
+        const std::shared_ptr<char[]> owner(buffer, [mapped = mappedSize](char* bytes) {
+            if (mapped) {
+                munmap(bytes, mapped);
+            } else {
+                free(bytes);
+            }
+        });
+        if (isSaving()) {
+            for (const auto& save : saves) {
+                save->adopt(buffer, bufferSize, owner);
+            }
+        }
     }
+    buffer = nullptr;
+    mappedSize = 0;
+}
+
+void Text::store(Compressed&& content) {
+    assert(!content.empty() && content.size() == fileSize);
+    release();
+    bufferSize = 0;
+    gap = 0;
+    compressed = std::move(content);
+}
+
+void Text::decompress() {
+    if (compressed.empty()) {
+        return;
+    }
+    // the gap grows when something is typed
+    bufferSize = fileSize+1024;
+    buffer = static_cast<char*>(malloc(bufferSize));
+    assert(buffer);
+    const bool inflated = compressed.inflate(buffer);
+    assert(inflated);
+    UNUSED(inflated);
+    gap = fileSize;
+    compressed = Compressed();
+}
+
+static size_t pageSize() {
+    static const size_t size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+// address space for the gap in front of a mapped file, only pages that are written to cost memory
+static constexpr size_t mappedGapSize = 64 << 20;
+
+// The file is mapped copy-on-write right behind an anonymous region that holds the gap, with as much
+// address space again behind it for the gap to grow into. Pages of the file are only read when something
+// looks at them, edited pages become private copies and the file itself is never written to.
+// The gap starts out as whole pages, so the first edit moves the pages in front of it with remapGap()
+// instead of copying them.
+bool Text::map(const char* file) {
+    const int fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || static_cast<size_t>(st.st_size) < mapThreshold) {
+        close(fd);
+        return false;
+    }
+    const size_t size = st.st_size;
+    const size_t reserved = mappedGapSize + 2 * ((size+pageSize()-1) / pageSize() * pageSize());
+    void* region = mmap(NULL, reserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    char* const content = static_cast<char*>(region)+mappedGapSize;
+    if (mmap(content, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(region, reserved);
+        close(fd);
+        return false;
+    }
+    close(fd);
+    buffer = static_cast<char*>(region);
+    bufferSize = mappedGapSize+size;
+    mappedSize = reserved;
+    fileSize = size;
+    cursor = 0;
+    gap = 0;
+    indexed = 0;
+    lines.assign(nullptr, 0);
+    return true;
 }
 
 void Text::load(const char* file) {
-    if (buffer) {
-        free(buffer);
-        buffer = NULL;    
+    release();
+    compressed = Compressed();
+    history.clear();
+    highlighter = Highlighter();
+    if (map(file)) {
+        return;
     }
     FILE* f = fopen(file, "r");
     fseek(f, 0, SEEK_END);
@@ -105,308 +524,698 @@ void Text::load(const char* file) {
     fseek(f, 0, SEEK_SET);
     bufferSize = fileSize + 1024;
     buffer = (char*) malloc(bufferSize);
-    assert(fread(buffer, fileSize, 1, f) == 1);
+    assert(fread(buffer+bufferSize-fileSize, fileSize, 1, f) == 1);
     cursor = 0;
+    gap = 0;
     fclose(f);
+    lines.assign(buffer+bufferSize-fileSize, fileSize);
+    indexed = fileSize;
 }
 
-void Text::save(const char* file) const {
+bool Text::isMapped() const {
+    return mappedSize;
+}
+
+// Only the pointers to the two halves are taken, the writer reads them while the text is edited.
+// Typing into the gap doesn't touch them, everything else that overwrites them copies them out first.
+// A mapped file may still be read from the target itself, that works because the target is replaced
+// by renaming and the mapping keeps the old inode alive.
+void Text::saveInBackground(const char* file, Snapshot::Done done) const {
     if (!file || !*file) {
         return;
     }
-    FILE* f = fopen(file, "w+");
-    assert(f);
-    fwrite(buffer, cursor, 1, f);
-    fwrite(buffer+bufferSize-fileSize+cursor, fileSize-cursor, 1, f);
-    fclose(f);
+    std::erase_if(saves, [](const auto& save) {
+        return save->isDone();
+    });
+    auto snapshot = std::make_shared<Snapshot>(file, std::move(done));
+    snapshot->add(buffer, gap);
+    snapshot->add(buffer+bufferSize-fileSize+gap, fileSize-gap);
+    Snapshot::start(snapshot);
+    saves.push_back(std::move(snapshot));
 }
 
-void Text::insert(char c) {
-    if (bufferSize == fileSize) {
-        bufferSize += 1024;
-        const size_t gapSize = bufferSize-fileSize;
+bool Text::isSaving() const {
+    std::erase_if(saves, [](const auto& save) {
+        return save->isDone();
+    });
+    return !saves.empty();
+}
+
+void Text::preserve(const char* from, size_t len) {
+    if (!isSaving()) {
+        return;
+    }
+    for (const auto& save : saves) {
+        save->preserve(from, len);
+    }
+}
+
+// the gap grows by an eighth of the file on top of what is needed, so inserting n bytes
+// in any number of steps moves the tail O(log n) times instead of once per kilobyte
+static constexpr size_t minGapSize = 1024;
+// gaps larger than this and four times what growing would leave are given back
+static constexpr size_t shrinkThreshold = 1 << 20;
+
+static size_t spareGapSize(size_t fileSize) {
+    return std::max(minGapSize, fileSize/8);
+}
+
+void Text::grow(size_t len) {
+    if (bufferSize-fileSize >= len) {
+        return;
+    }
+    const size_t oldGapSize = bufferSize-fileSize;
+    const size_t newBufferSize = fileSize + len + spareGapSize(fileSize);
+    if ((mappedSize && newBufferSize > mappedSize) || isSaving()) {
+        // a mapping can't grow past what was reserved for it and realloc would move the buffer away under a
+        // save, the text moves to a new buffer and the saves keep the old one
+        char* grown = (char*) malloc(newBufferSize);
+        std::memcpy(grown, buffer, gap);
+        std::memcpy(grown+newBufferSize-fileSize+gap, buffer+gap+oldGapSize, fileSize-gap);
+        bytesMoved += fileSize;
+        dropBuffer();
+        buffer = grown;
+        bufferSize = newBufferSize;
+        return;
+    }
+    bufferSize = newBufferSize;
+    if (!mappedSize) {
         buffer = (char*) realloc(buffer, bufferSize);
-        std::memmove(buffer+cursor+gapSize, buffer+cursor, fileSize-cursor);
     }
-    buffer[cursor++] = c;
+    shift(buffer+gap+bufferSize-fileSize, buffer+gap+oldGapSize, fileSize-gap);
+}
+
+void Text::shrink() {
+    const size_t gapSize = bufferSize-fileSize;
+    const size_t keep = spareGapSize(fileSize);
+    if (mappedSize || gapSize < shrinkThreshold || gapSize < 4*keep) {
+        return;
+    }
+    if (isSaving()) {
+        char* shrunk = (char*) malloc(fileSize+keep);
+        std::memcpy(shrunk, buffer, gap);
+        std::memcpy(shrunk+gap+keep, buffer+gap+gapSize, fileSize-gap);
+        bytesMoved += fileSize;
+        dropBuffer();
+        buffer = shrunk;
+        bufferSize = fileSize+keep;
+        return;
+    }
+    shift(buffer+gap+keep, buffer+gap+gapSize, fileSize-gap);
+    bufferSize = fileSize+keep;
+    buffer = (char*) realloc(buffer, bufferSize);
+}
+
+void Text::remapGap(size_t to) {
+    const size_t gapSize = bufferSize-fileSize;
+    size_t from = gap;
+    // the pages behind the gap go in front of it, in steps no larger than the gap so they don't overlap
+    while (from < to) {
+        const size_t len = std::min(gapSize, to-from);
+        if (mremap(buffer+from+gapSize, len, len, MREMAP_MAYMOVE | MREMAP_FIXED, buffer+from) == MAP_FAILED) {
+            break;
+        }
+        from += len;
+    }
+    // what the pages left behind is the gap now, partly holes and partly the old gap
+    if (from != gap) {
+        void* hole = mmap(buffer+from, gapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+        assert(hole != MAP_FAILED);
+        UNUSED(hole);
+        gap = from;
+    }
+}
+
+void Text::moveGap(size_t pos) {
+    const size_t page = pos / pageSize() * pageSize();
+    if (mappedSize && page > gap && gap % pageSize() == 0 && (bufferSize-fileSize) % pageSize() == 0 && !isSaving()) {
+        remapGap(page);
+    }
+    if (pos < gap) {
+        shift(buffer+bufferSize-fileSize+pos, buffer+pos, gap-pos);
+    } else {
+        shift(buffer+gap, buffer+gap+bufferSize-fileSize, pos-gap);
+    }
+    gap = pos;
+}
+
+void Text::insert(char c) {
+    history.record(cursor, 0, [](auto&&) {}, &c, 1);
+    highlightEdit(cursor, cursor, &c, 1);
+    moveGap(cursor);
+    grow(1);
+    indexInserted(cursor, &c, 1);
+    preserve(buffer+gap, 1);
+    buffer[gap++] = c;
+    cursor++;
     fileSize++;
 }
 
 void Text::insert(const char* str) {
-    const auto len = strlen(str);
-    while (bufferSize-fileSize < len) {
-        bufferSize += 1024;
-        const size_t gapSize = bufferSize-fileSize;
-        buffer = (char*) realloc(buffer, bufferSize);
-        std::memmove(buffer+cursor+gapSize, buffer+cursor, fileSize-cursor);
-    }
-    strncpy(buffer+cursor, str, len);
-    cursor += len;
-    fileSize += len;
+    insert(str, strlen(str));
 }
 
-static constexpr bool isWordBreak(char from, char to) {
-    const bool fromIsUpper = 'A' <= from && from <= 'Z';
-    const bool fromIsLower = 'a' <= from && from <= 'z';
-    const bool fromIsNumber = '0' <= from && from <= '9';
-    const bool fromIsNotSpecial = from == '_' and options.underscore_is_word_break;
-    const bool fromIsAlphaNum = fromIsUpper || fromIsLower || fromIsNumber || fromIsNotSpecial;
-    const bool toIsUpper = 'A' <= to && to <= 'Z';
-    const bool toIsLower = 'a' <= to && to <= 'z';
-    const bool toIsNumber = '0' <= to && to <= '9';
-    const bool toIsNotSpecial = to == '_' and options.underscore_is_word_break;
-    const bool toIsAlphaNum = toIsUpper || toIsLower || toIsNumber || toIsNotSpecial;
-    const bool fromIsWhiteSpace =
-    0x20 == from || // SPACE
-    0x9 == from || // TAB
-    0xa == from || // LINE FEED
-    0xb == from || // LINE TABULATION
-    0xc == from || // FORM FEED
-    0xd == from; // CARRIAGE RETURN
-    const bool toIsWhiteSpace =
-    0x20 == to || // SPACE
-    0x9 == to || // TAB
-    0xa == to || // LINE FEED
-    0xb == to || // LINE TABULATION
-    0xc == to || // FORM FEED
-    0xd == to; // CARRIAGE RETURN
-    const bool fromIsSpecial = !(fromIsAlphaNum || fromIsWhiteSpace);
-    const bool toIsSpecial = !(toIsAlphaNum || toIsWhiteSpace);
-    
-    
-    //                     FROM IS ALPHA NUM | FROM IS WHITE SPACE | FROM IS SPECIAL CHAR
-    // TO IS ALPHA NUM          false                   false               true
-    // TO IS WHITE SPACE        true                    false               true
-    // TO IS SPECIAL CHAR       true                    false               false
-    return !fromIsWhiteSpace && (fromIsSpecial != toIsSpecial || fromIsAlphaNum != toIsAlphaNum);
+void Text::insert(const char* str, size_t len) {
+    replace(cursor, cursor, str, len);
+}
+
+void Text::erase(size_t from, size_t to) {
+    replace(from, to, nullptr, 0);
+}
+
+// the gap moves into [from, to) if it isn't there already, the erased bytes on both
+// of its sides become part of it and the new ones are copied into it
+void Text::splice(size_t from, size_t to, const char* str, size_t len) {
+    to = std::min(to, fileSize);
+    from = std::min(from, to);
+    highlightEdit(from, to, str, len);
+    moveGap(std::clamp(gap, from, to));
+    indexErased(from, to-from);
+    fileSize -= to-from;
+    gap = from;
+    if (len) {
+        grow(len);
+        indexInserted(from, str, len);
+        preserve(buffer+gap, len);
+        std::memcpy(buffer+gap, str, len);
+        gap += len;
+        fileSize += len;
+    }
+    cursor = gap;
+    shrink();
 }
 
 size_t Text::getFileSize() const {
     return fileSize;
 }
 
+size_t Text::getLineCount() const {
+    ensureIndexed(fileSize);
+    return lines.lines();
+}
+
+size_t Text::getIndexedLineCount() const {
+    return lines.lines();
+}
+
+size_t Text::clampLine(size_t line) const {
+    ensureLine(line);
+    return std::min(line, lines.lines()-1);
+}
+
+size_t Text::lineOf(size_t pos) const {
+    ensureIndexed(pos);
+    return lines.lineOf(pos);
+}
+
+size_t Text::lineStart(size_t line) const {
+    ensureLine(line);
+    return lines.startOf(line);
+}
+
+size_t Text::lineEnd(size_t line) const {
+    if (isLastLine(line)) {
+        return fileSize;
+    }
+    return lines.startOf(line) + lines.lengthOf(line) - 1;
+}
+
+// how much of a mapped file is indexed at once
+static constexpr size_t indexChunkSize = 1 << 20;
+
+void Text::ensureIndexed(size_t pos) const {
+    if (pos <= indexed) {
+        return;
+    }
+    const size_t to = std::min(fileSize, (pos+indexChunkSize-1) / indexChunkSize * indexChunkSize);
+    segments(indexed, to, [&](const char* data, size_t len) {
+        lines.append(data, len);
+    });
+    indexed = to;
+}
+
+void Text::ensureLine(size_t line) const {
+    while (lines.lines() <= line+1 && indexed < fileSize) {
+        ensureIndexed(indexed+1);
+    }
+}
+
+bool Text::isLastLine(size_t line) const {
+    ensureLine(line);
+    return line+1 >= lines.lines();
+}
+
+void Text::indexInserted(size_t pos, const char* content, size_t len) {
+    columns.inserted(pos, len, countColumns(content, len), memchr(content, '\n', len) != nullptr);
+    if (pos > indexed) {
+        return;
+    }
+    lines.inserted(pos, content, len);
+    indexed += len;
+}
+
+void Text::indexErased(size_t pos, size_t len) {
+    // the bytes are still there, counting them is only needed inside of a counted line
+    columns.erased(pos, len, columns.counts(pos, len) ? columnsIn(pos, pos+len) : 0);
+    if (pos >= indexed) {
+        return;
+    }
+    if (pos+len > indexed) {
+        // the unindexed rest starts right at pos now
+        lines.erased(pos, indexed-pos);
+        indexed = pos;
+        return;
+    }
+    lines.erased(pos, len);
+    indexed -= len;
+}
+
+size_t Text::getBytesMoved() const {
+    return bytesMoved;
+}
+
+void Text::shift(char* to, const char* from, size_t n) {
+    preserve(to, n);
+    std::memmove(to, from, n);
+    bytesMoved += n;
+}
+
 void Text::moveTo(ssize_t newPos) {
     if (newPos < 0) {
         return;
     }
-    if (static_cast<size_t>(newPos) < cursor) {
-        if (newPos) {
-            if ((buffer[newPos-1] & 0x80) && (buffer[newPos] & 0xC0) == 0x80) {
-                moveTo(newPos+1);
-                return;
-            }
-        }
-        std::memmove(buffer+bufferSize-fileSize+newPos, buffer+newPos, cursor-newPos);
-    } else {
-        if (
-            newPos &&
-            (buffer[newPos-1 + (bufferSize-fileSize)*(static_cast<size_t>(newPos) > cursor)] & 0x80)
-            && (buffer[newPos + (bufferSize-fileSize)] & 0xC0) == 0x80
-        ) {
-            moveTo(newPos+1);
-            return;
-        }
-        std::memmove(buffer+cursor, buffer+cursor+bufferSize-fileSize, newPos-cursor);
+    if (static_cast<size_t>(newPos) > fileSize) {
+        newPos = fileSize;
+    }
+    // don't land inside of a utf8 character
+    while (
+        newPos && static_cast<size_t>(newPos) < fileSize &&
+        (at(newPos-1) & 0x80) && (at(newPos) & 0xC0) == 0x80
+    ) {
+        newPos++;
     }
     cursor = newPos;
 }
 
 void Text::backspace(bool wordWise) {
-    if (!cursor) {
-        return;
+    if (cursor) {
+        edit(stepLeft(cursor, wordWise), cursor, nullptr, 0, true);
     }
-    bool needMoreForWholeWord, nonAscii;
-    do {
-        cursor--;
-        fileSize--;
-        if (!cursor) {
-            return;
-        }
-        const auto gapSize = bufferSize-fileSize;
-        needMoreForWholeWord = wordWise && !isWordBreak(buffer[cursor+gapSize-1], buffer[cursor-1]);
-        nonAscii = ((buffer[cursor] & 0xC0) == 0x80) && (buffer[cursor-1] & 0x80); // checking buffer[cursor-1] is redundant but better be safe than sorry for deleting an ascii character that preceeded a 0b10… char
-    } while (nonAscii || needMoreForWholeWord);
 }
 
 void Text::left(bool wordWise) {
-    if (!cursor) {
-        return;
-    }
-    const auto gapSize = bufferSize-fileSize;
-    bool needMoreForWholeWord, nonAscii;
-    do {
-        --cursor;
-        buffer[cursor+gapSize] = buffer[cursor];
-        if (!cursor) {
-            return;
-        }
-        needMoreForWholeWord = wordWise && !isWordBreak(buffer[cursor], buffer[cursor-1]);
-        nonAscii = buffer[cursor-1] & 0x80 && ((buffer[cursor] & 0xC0)== 0x80); // checking buffer[cursor-1] is redundant but helps if the file is not utf8
-    } while(nonAscii || needMoreForWholeWord);
+    cursor = stepLeft(cursor, wordWise);
 }
 
 void Text::right(bool wordWise) {
-    if (cursor == fileSize) {
-        return;
-    }
-    const auto gapSize = bufferSize-fileSize;
-    bool needMoreForWholeWord, nonAscii;
-    do {
-        buffer[cursor] = buffer[cursor+gapSize];
-        ++cursor;
-        if (cursor == fileSize) {
-            return;
-        }
-        needMoreForWholeWord = wordWise && !isWordBreak(buffer[cursor-1], buffer[cursor+gapSize]);
-        nonAscii = ((buffer[cursor+gapSize] & 0xC0) == 0x80) && (buffer[cursor-1] & 0x80); // checking buffer[cusor-1] is redundant
-    } while (nonAscii || needMoreForWholeWord);
+    cursor = stepRight(cursor, wordWise);
 }
 
 void Text::ending() {
-    std::memmove(buffer+cursor, buffer+cursor+bufferSize-fileSize, fileSize-cursor);
     cursor = fileSize;
 }
 
 void Text::beginning() {
-    std::memmove(buffer+bufferSize-fileSize, buffer, cursor);
     cursor = 0;
 }
 
 void Text::del(bool wordWise) {
-    if (cursor == fileSize) {
-        return;
+    if (cursor < fileSize) {
+        replace(cursor, stepRight(cursor, wordWise), nullptr, 0);
     }
-    bool needMoreForWholeWord, nonAscii;
-    do {
-        --fileSize;
-        if (cursor == fileSize) {
-            return;
-        }
-        const auto gapSize = bufferSize-fileSize;
-        needMoreForWholeWord = wordWise && !isWordBreak(buffer[cursor+gapSize], buffer[cursor-1]);
-        nonAscii = (buffer[cursor+gapSize-1] & 0x80) && ((buffer[cursor+gapSize] & 0xC0) == 0x80);
-    } while (nonAscii || needMoreForWholeWord);
 }
 
-void Text::up(std::vector<ssize_t>& newLines, ssize_t inLineOffset) {
-    const auto endOfThisLine = std::lower_bound(newLines.begin(), newLines.end(), cursor);
-    if (endOfThisLine == newLines.begin()) {
+void Text::up(ssize_t inLineOffset) {
+    const size_t line = lineOf(cursor);
+    if (!line) {
         return beginning();
     }
-    const auto startOfThisLine = endOfThisLine-1;
     if (inLineOffset < 0) {
-        // inLineOffset = cursor-*(startOfThisLine)+1;
-        for (size_t c = *(startOfThisLine)+1; c < cursor; c++) {
-            if (buffer[c] & 0x80) {
-                inLineOffset += static_cast<bool>(buffer[c] & 0x40);
-            } else if (buffer[c] == '\t') {
-                inLineOffset += 4;
-            } else {
-                inLineOffset++;
-            }
-        }
-    }
-    const size_t startOfLineAbove = startOfThisLine == newLines.begin() ? 0 : *(startOfThisLine-1) +1;
-    const auto gapSize = bufferSize-fileSize;
-    auto newPos = startOfLineAbove;
-    for (ssize_t c = 0; c < inLineOffset && static_cast<ssize_t>(newPos) < *startOfThisLine; newPos++) {
-        if (buffer[newPos+gapSize] & 0x80) {
-            c += static_cast<bool>(buffer[newPos+gapSize] & 0x40);
-        } else if (buffer[newPos+gapSize] == '\t') {
-            c += 4;
-        } else {
-            c++;
-        }
+        inLineOffset = columnOf(cursor);
     }
-    std::memmove(
-        buffer+newPos+gapSize,
-        buffer+newPos,
-        cursor-newPos);
-    cursor = newPos;
+    moveTo(posAtColumn(line-1, inLineOffset));
 }
 
-void Text::down(std::vector<ssize_t>& newLines, ssize_t inLineOffset) {
-    const auto endOfThisLine = std::lower_bound(newLines.begin(), newLines.end(), cursor);
-    if (endOfThisLine == newLines.end()) {
+void Text::down(ssize_t inLineOffset) {
+    const size_t line = lineOf(cursor);
+    if (isLastLine(line)) {
         return ending();
     }
-    const auto startOfThisLine = endOfThisLine == newLines.begin() ? 0 : *(endOfThisLine-1) +1;
     if (inLineOffset < 0) {
-        // inLineOffset = cursor-*(startOfThisLine)+1;
-        for (size_t c = startOfThisLine; c < cursor; c++) {
-            if (buffer[c] & 0x80) {
-                inLineOffset += static_cast<bool>(buffer[c] & 0x40);
-            } else if (buffer[c] == '\t') {
-                inLineOffset += 4;
-            } else {
-                inLineOffset++;
-            }
-        }
+        inLineOffset = columnOf(cursor);
     }
-    const auto startOfNextLinePosition = *endOfThisLine +1;
-    const std::vector<ssize_t>::iterator endOfNextLine = endOfThisLine+1;
-    const ssize_t endOfNextLinePosition = endOfNextLine == newLines.end() ? fileSize : *endOfNextLine;
-    const auto gapSize = bufferSize-fileSize;
-    ssize_t newPos = startOfNextLinePosition;
-    for (ssize_t c = 0; c < inLineOffset && newPos < endOfNextLinePosition; newPos++) {
-        if (buffer[newPos+gapSize] & 0x80) {
-            c += static_cast<bool>(buffer[newPos+gapSize] & 0x40);
-        } else if (buffer[newPos+gapSize] == '\t') {
-            c += 4;
-        } else {
-            c++;
+    moveTo(posAtColumn(line+1, inLineOffset));
+}
+
+size_t Text::columnsIn(size_t from, size_t to) const {
+    size_t columns = 0;
+    segments(from, to, [&](const char* data, size_t len) {
+        columns += countColumns(data, len);
+    });
+    return columns;
+}
+
+size_t Text::columnOf(size_t pos) const {
+    const size_t line = lineOf(pos);
+    const auto [from, columnsBefore] = columns.beforePos(lineStart(line), lineEnd(line), pos, [&](size_t from, size_t to) {
+        return columnsIn(from, to);
+    });
+    return columnsBefore + columnsIn(from, pos);
+}
+
+size_t Text::posAtColumn(size_t line, size_t column) const {
+    // start at the closest counted chunk, skip whole blocks with the vectorized count, then walk the last few bytes
+    static constexpr size_t blockSize = 256;
+    const size_t end = lineEnd(line);
+    auto [pos, reached] = columns.beforeColumn(lineStart(line), end, column, [&](size_t from, size_t to) {
+        return columnsIn(from, to);
+    });
+    while (end-pos > blockSize) {
+        const size_t columns = columnsIn(pos, pos+blockSize);
+        if (reached+columns >= column) {
+            break;
         }
+        reached += columns;
+        pos += blockSize;
     }
-    std::memmove(buffer+cursor, buffer+gapSize+cursor, newPos-cursor);
-    cursor = newPos;
+    while (pos < end && reached < column) {
+        reached += columnsOf(at(pos));
+        pos++;
+    }
+    // don't stop inside of a utf8 character
+    while (pos < end && (at(pos) & 0xC0) == 0x80) {
+        pos++;
+    }
+    return pos;
 }
 
-ssize_t Text::home(std::vector<ssize_t>& newLines) {
-    const auto endOfThisLine = std::lower_bound(newLines.begin(), newLines.end(), cursor);
-    const auto gapSize = bufferSize-fileSize;
-    const size_t startOfThisLine = endOfThisLine == newLines.begin() ? 0 : *(endOfThisLine-1)+1;
+ssize_t Text::home() {
+    const size_t line = lineOf(cursor);
+    const size_t startOfThisLine = lineStart(line);
+    const size_t endOfThisLine = lineEnd(line);
     size_t endOfWhiteSpace;
-    for (endOfWhiteSpace = startOfThisLine; endOfWhiteSpace < static_cast<size_t>(*endOfThisLine); endOfWhiteSpace++) {
-        if (not isWhiteSpace(buffer[endOfWhiteSpace])) {
+    for (endOfWhiteSpace = startOfThisLine; endOfWhiteSpace < endOfThisLine; endOfWhiteSpace++) {
+        if (not isWhiteSpace(at(endOfWhiteSpace))) {
             break;
         }
     }
 
     if (cursor == startOfThisLine && endOfWhiteSpace > cursor) {
-        // cursor moves right
-        std::memmove(buffer+cursor, buffer+cursor+gapSize, endOfWhiteSpace-cursor);
         cursor = endOfWhiteSpace;
         return endOfWhiteSpace-startOfThisLine;
     }
-    size_t newPos = endOfWhiteSpace < cursor ? endOfWhiteSpace : startOfThisLine;
-    // cursor moves left
-    std::memmove(
-        buffer+newPos+gapSize,
-        buffer+newPos,
-        cursor-newPos);
-    cursor = newPos;
+    cursor = endOfWhiteSpace < cursor ? endOfWhiteSpace : startOfThisLine;
     return cursor - startOfThisLine;
 }
 
-void Text::ende(std::vector<ssize_t>& newLines) {
-    const auto pos = std::lower_bound(newLines.begin(), newLines.end(), cursor);
-    if (pos == newLines.end()) {
-        ending();
-        return;
-    }
-    const size_t startOfNextLine = *pos;
-    const size_t newPos = startOfNextLine;
-    std::memmove(buffer+cursor, buffer+bufferSize-fileSize+cursor, newPos-cursor);
-    cursor = newPos;
+void Text::ende() {
+    cursor = lineEnd(lineOf(cursor));
+}
+
+char Text::at(size_t pos) const {
+    return buffer[pos + (bufferSize-fileSize)*(pos >= gap)];
+}
+
+Text::Spans Text::spans(size_t from, size_t to) const {
+    Spans spans{};
+    size_t count = 0;
+    to = std::min(to, fileSize);
+    segments(std::min(from, to), to, [&](const char* data, size_t len) {
+        spans[count++] = {data, len};
+    });
+    return spans;
 }
 
 void Text::print() const {
-    for (size_t i = 0; i < cursor; i++) {
+    for (size_t i = 0; i < gap; i++) {
         printf("%c", buffer[i]);
     }
-    for (size_t i = 0; i < fileSize-cursor; i++) {
-        printf("%c", (buffer+bufferSize-fileSize+cursor)[i]);
+    for (size_t i = 0; i < fileSize-gap; i++) {
+        printf("%c", (buffer+bufferSize-fileSize+gap)[i]);
+    }
+}
+
+#endif
+
+void Text::save(const char* file) const {
+    if (!file || !*file) {
+        return;
+    }
+    saveInBackground(file);
+    saves.back()->wait();
+}
+
+size_t Text::stepLeft(size_t pos, bool wordWise) const {
+    bool needMoreForWholeWord, nonAscii;
+    while (pos) {
+        --pos;
+        if (!pos) {
+            break;
+        }
+        needMoreForWholeWord = wordWise && !isWordBreak(at(pos), at(pos-1));
+        nonAscii = (at(pos-1) & 0x80) && ((at(pos) & 0xC0) == 0x80); // checking at(pos-1) is redundant but helps if the file is not utf8
+        if (!nonAscii && !needMoreForWholeWord) {
+            break;
+        }
+    }
+    return pos;
+}
+
+size_t Text::stepRight(size_t pos, bool wordWise) const {
+    bool needMoreForWholeWord, nonAscii;
+    while (pos < getFileSize()) {
+        ++pos;
+        if (pos == getFileSize()) {
+            break;
+        }
+        needMoreForWholeWord = wordWise && !isWordBreak(at(pos-1), at(pos));
+        nonAscii = ((at(pos) & 0xC0) == 0x80) && (at(pos-1) & 0x80);
+        if (!nonAscii && !needMoreForWholeWord) {
+            break;
+        }
+    }
+    return pos;
+}
+
+// utf8 characters count as word characters, a word in any language is selected as a whole
+static int kindOf(char c) {
+    if ((c & 0x80) || c == '_' || ('0' <= c && c <= '9') || ('a' <= (c | 0x20) && (c | 0x20) <= 'z')) {
+        return 0;
+    }
+    return c == ' ' || c == '\t' ? 1 : 2;
+}
+
+std::pair<size_t, size_t> Text::wordAt(size_t pos) const {
+    const size_t size = getFileSize();
+    pos = std::min(pos, size);
+    if (pos == size || at(pos) == '\n') {
+        if (!pos || at(pos-1) == '\n') {
+            return {pos, pos};
+        }
+        pos--;
+    }
+    const int kind = kindOf(at(pos));
+    size_t from = pos;
+    size_t to = pos+1;
+    while (from && at(from-1) != '\n' && kindOf(at(from-1)) == kind) {
+        from--;
+    }
+    while (to < size && at(to) != '\n' && kindOf(at(to)) == kind) {
+        to++;
+    }
+    return {from, to};
+}
+
+void Text::setLanguage(Highlighter::Language language) {
+    highlighter.setLanguage(language);
+}
+
+bool Text::isCompressed() const {
+    return !compressed.empty();
+}
+
+size_t Text::takeRecolored() const {
+    return highlighter.takeRecolored();
+}
+
+const Highlighter::Tokens& Text::tokens(size_t line) const {
+    return highlighter.tokens([this](size_t first, size_t last, std::string& scratch) -> std::string_view {
+        const auto pieces = spans(lineStart(first), lineEnd(last));
+        if (pieces.empty() || pieces[0].empty()) {
+            return {};
+        }
+        if (pieces.size() == 1 || pieces[1].empty()) {
+            return pieces[0];
+        }
+        scratch.clear();
+        for (const std::string_view piece : pieces) {
+            scratch += piece;
+        }
+        return scratch;
+    }, line);
+}
+
+void Text::highlightEdit(size_t from, size_t to, const char* str, size_t len) {
+    if (!highlighter.isActive()) {
+        return;
+    }
+    size_t removedLines = 0;
+    segments(from, to, [&](const char* data, size_t n) {
+        removedLines += std::count(data, data+n, '\n');
+    });
+    highlighter.edited(lineOf(from), removedLines, std::count(str, str+len, '\n'));
+}
+
+void Text::replace(size_t from, size_t to, const char* str, size_t len) {
+    edit(from, to, str, len, false);
+}
+
+// the edit is recorded before it is made, while the removed bytes can still be copied
+void Text::edit(size_t from, size_t to, const char* str, size_t len, bool backspace) {
+    to = std::min(to, getFileSize());
+    from = std::min(from, to);
+    history.record(from, to-from, [&](auto&& f) { segments(from, to, f); }, str, len, backspace);
+    splice(from, to, str, len);
+}
+
+bool Text::undo() {
+    const History::Record* record = history.undo();
+    if (!record) {
+        return false;
+    }
+    // a step of many records is taken back from its last record to its first
+    do {
+        splice(record->offset, record->offset+record->inserted, nullptr, 0);
+        history.removedBytes(*record, [&](const char* data, size_t len) {
+            splice(cursor, cursor, data, len);
+        });
+    } while (record->joined && (record = history.undo()));
+    return true;
+}
+
+bool Text::redo() {
+    const History::Record* record = history.redo();
+    if (!record) {
+        return false;
+    }
+    while (true) {
+        splice(record->offset, record->offset+record->removed, nullptr, 0);
+        history.insertedBytes(*record, [&](const char* data, size_t len) {
+            splice(cursor, cursor, data, len);
+        });
+        if (!history.redoJoined()) {
+            return true;
+        }
+        record = history.redo();
+    }
+}
+
+void Text::insert(std::vector<size_t>& cursors, const char* str, size_t len) {
+    std::vector<std::pair<size_t, size_t>> ranges(cursors.size());
+    for (size_t i = 0; i < cursors.size(); i++) {
+        ranges[i] = {cursors[i], cursors[i]};
+    }
+    editAll(cursors, ranges, str, len, false);
+}
+
+void Text::backspace(std::vector<size_t>& cursors, bool wordWise) {
+    std::vector<std::pair<size_t, size_t>> ranges(cursors.size());
+    for (size_t i = 0; i < cursors.size(); i++) {
+        ranges[i] = {stepLeft(cursors[i], wordWise), cursors[i]};
+    }
+    editAll(cursors, ranges, nullptr, 0, true);
+}
+
+void Text::del(std::vector<size_t>& cursors, bool wordWise) {
+    std::vector<std::pair<size_t, size_t>> ranges(cursors.size());
+    for (size_t i = 0; i < cursors.size(); i++) {
+        ranges[i] = {cursors[i], stepRight(cursors[i], wordWise)};
     }
+    editAll(cursors, ranges, nullptr, 0, false);
 }
 
-#endif
\ No newline at end of file
+// Going from the front of the file to its back every edit starts where the one before it left the gap,
+// so the gap moves over the file once instead of once per cursor. Everything behind an edit moves by
+// what it inserted and removed. Back to front nothing moves, that way is taken if the gap is closer to the end.
+void Text::editAll(std::vector<size_t>& cursors, const std::vector<std::pair<size_t, size_t>>& ranges, const char* str, size_t len, bool backspace) {
+    if (ranges.empty()) {
+        return;
+    }
+    const size_t size = getFileSize();
+    const size_t gap = gapPosition();
+    const auto distance = [gap](size_t pos) {
+        return gap > pos ? gap-pos : pos-gap;
+    };
+    const bool backToFront = distance(ranges.back().second) < distance(ranges.front().first);
+    // the positions of the edits before any of them was made, overlapping ones are made as one
+    struct Merged{
+        size_t from;
+        size_t to;
+        // cursors [first, last) are in it
+        size_t first;
+        size_t last;
+    };
+    std::vector<Merged> merged;
+    for (size_t i = 0; i < ranges.size(); i++) {
+        const size_t from = std::min(ranges[i].first, size);
+        const size_t to = std::clamp(ranges[i].second, from, size);
+        if (!merged.empty() && (from < merged.back().to || from == merged.back().from)) {
+            merged.back().to = std::max(merged.back().to, to);
+            merged.back().last = i+1;
+        } else {
+            merged.push_back({from, to, i, i+1});
+        }
+    }
+    history.beginBatch();
+    ssize_t moved = 0;
+    auto apply = [&](const Merged& range) {
+        const size_t from = range.from+moved;
+        const size_t to = range.to+moved;
+        if (from < to || len) {
+            edit(from, to, str, len, backspace);
+        }
+        std::fill(cursors.begin()+range.first, cursors.begin()+range.last, from+len);
+    };
+    if (backToFront) {
+        std::for_each(merged.rbegin(), merged.rend(), apply);
+        // the cursors in front of an edit didn't move, the ones behind it moved by all edits in front of them
+        for (const Merged& range : merged) {
+            for (size_t i = range.first; i < range.last; i++) {
+                cursors[i] += moved;
+            }
+            moved += static_cast<ssize_t>(len) - static_cast<ssize_t>(range.to-range.from);
+        }
+    } else {
+        for (const Merged& range : merged) {
+            apply(range);
+            moved += static_cast<ssize_t>(len) - static_cast<ssize_t>(range.to-range.from);
+        }
+    }
+    history.endBatch();
+}
+
+Finder::Segments Text::pieces() const {
+    return [this](size_t from, size_t to, const std::function<void(const char*, size_t)>& piece) {
+        segments(from, to, piece);
+    };
+}
+
+std::vector<size_t> Text::findAll(std::string_view needle) const {
+    return Finder(needle).findAll(pieces(), getFileSize());
+}
+
+size_t Text::findNext(std::string_view needle, size_t from) const {
+    return Finder(needle).findNext(pieces(), getFileSize(), from);
+}
+
+void Text::refine(std::vector<size_t>& matches, std::string_view needle) const {
+    Finder(needle).refine(pieces(), getFileSize(), matches);
+}
+
+std::vector<Regex::Match> Text::findAll(const Regex& regex) const {
+    return regex.findAll(pieces(), getFileSize());
+}
+
+size_t Text::getHistoryMemory() const {
+    return history.getMemoryUsage();
+}
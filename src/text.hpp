@@ -6,179 +6,209 @@
 #include <cstring>
 #include <util.hpp>
 #include <cassert>
+#include <memory>
+#include <vector>
+#include "compressed.hpp"
+#include "highlight.hpp"
+#include "history.hpp"
+#include "regex.hpp"
+#include "search.hpp"
+#include "snapshot.hpp"
 
+// the gap buffer is the default, build with -DROPE=1 for the B-tree rope
+#ifndef ROPE
 #define ROPE 0
+#endif
 
 #if ROPE
-#include <algorithm>
-#include <iterator>
+#include <string_view>
+#include <utility>
+#include "rope.hpp"
 
-struct Rope{
-    // positive or zero means it is a leaf
-    // negative means its absolute value is the sum of all sizes of the leafs to the left of it
-    ssize_t length = 0;
-    static const ssize_t maxSize = 1024;
-    union{
-        struct {
-            Rope *left, *right;
-        } children;
-        Array string = {nullptr, 0};
-    };
+class Text{
+    public:
     class Iterator{
-        Iterator* child = nullptr;
-        const Rope* parent = nullptr;
-        size_t pos = 0;
+        const Rope* rope = nullptr;
+        const Rope::Leaf* leaf = nullptr;
+        size_t offset = 0;
         public:
+        size_t pos = 0;
+        size_t cursorPos = 0;
         Iterator() = default;
-        Iterator(const Rope* self, size_t pos)
-         : parent(self), pos(pos)
+        Iterator(const Rope* rope, size_t pos, size_t cursor)
+         : rope(rope), pos(pos), cursorPos(cursor)
         {
-            if (parent->length < 0) {
-                if ((ssize_t)pos < -parent->length) {
-                    child = new Iterator(parent->children.left, pos);
-                } else {
-                    child = new Iterator(parent->children.right, pos+parent->length);
-                }
-            } else {
-                assert((ssize_t)pos <= parent->length);
-            }
+            leaf = rope->find(pos, offset);
         }
         Iterator& operator++() {
-            if (child) {
-                if (++*child == std::end(*parent->children.left)) {
-                    delete child;
-                    child = new Iterator(parent->children.right, 0);
-                }
-            }
             pos++;
+            if (++offset == leaf->count && leaf->next) {
+                leaf = leaf->next;
+                offset = 0;
+            }
             return *this;
         }
         Iterator& operator--() {
-            if (child) {
-                if (*child == std::begin(*parent->children.right)) {
-                    delete child;
-                    child = new Iterator(parent->children.left, ~parent->length);
-                }
-            }
             pos--;
+            if (!offset) {
+                leaf = leaf->prev;
+                offset = leaf->count;
+            }
+            offset--;
             return *this;
         }
-        char operator*() const {
-            if (parent->length < 0) {
-                return **child;
+        // warning: do not add more than pos-fileSize, it will break the iterator for loop
+        Iterator& operator+(size_t offset) {
+            pos += offset;
+            if (this->offset+offset < leaf->count) {
+                this->offset += offset;
+            } else {
+                leaf = rope->find(pos, this->offset);
             }
-            assert(pos < parent->string.size);
-            return parent->string.content[pos];
+            return *this;
         }
-        bool operator==(const Iterator& rhs) const {
-            if (parent == rhs.parent && pos == rhs.pos) {
-                return true;
-            }
-            if (child) {
-                if (*child == rhs) {
-                    return true;
-                }
-            }
-            if (rhs.child) {
-                if (*this == *rhs.child) {
-                    return true;
-                }
-            }
-            return false;
+        char operator*() const {
+            return leaf->data[offset];
+        }
+        inline bool operator==(const Iterator& rhs) const {
+            return rope == rhs.rope && pos == rhs.pos;
         }
         inline bool operator!=(const Iterator& rhs) const {
             return !(*this == rhs);
         }
-        ~Iterator() {
-            if (child) {
-                delete child;
-            }
-        }
     };
+    static_assert(std::is_trivially_copyable_v<Iterator>);
     Iterator begin() const {
-        return {this, 0};
+        return {&rope, 0, cursor};
     }
     Iterator end() const {
-        if (length < 0) {
-            return {this, (size_t)-length};
-        }
-        return {this, (size_t)length};
-    }
-    Rope() {
-        assert(16 < maxSize);
-        string.content = (char*)malloc(16);
-        string.size = 16;
-    }
-    void print();
-    void insertToChild(char c, ssize_t where) {
-        if (where < -length) {
-            children.left->insert(c, where);
-            length--;
-        } else {
-            children.right->insert(c, where+length);
-        }
-    }
-    void insertToString(char c, ssize_t where) {
-        if (string.size <= (size_t)length) {
-            assert(string.size == (size_t)length);
-            size_t newSize = std::min((size_t)maxSize, string.size*2);
-            string.content = (char*)realloc(string.content, newSize);
-            string.size = string.content ? newSize : 0;
-        }
-        std::memmove(string.content+where+1, string.content+where, length-where);
-        string.content[where] = c;
-        length++;
-    }
-    void insert(char c, ssize_t where) {
-        if (length < 0) {
-            insertToChild(c, where);
-            return;
-        }
-        assert(where <= length);
-        if (length < maxSize) {
-            insertToString(c, where);
-            return;
-        }
-        char tmp[maxSize];
-        printf("%ld %lu %lu\n", length, maxSize, where);
-        assert(length == maxSize && where <= maxSize);
-        std::memcpy(tmp, string.content, length);
-        delete string.content;
-        children.left = new Rope();
-        children.right = new Rope();
-        for (ssize_t i = 0; i < where; i++) {
-            children.left->insertToString(tmp[i], i);
-        }
-        children.right->insertToString(c, 0);
-        for (ssize_t i = where; i < length; i++) {
-            children.right->insertToString(tmp[i], 1+i-where);
-        }
-        length = -length;
-    }
-};
-
-class Text{
-    public:
-    Rope::Iterator begin() const {
-        return std::begin(rope);
-    }
-    Rope::Iterator end() const {
-        return std::end(rope);
+        return {&rope, rope.size(), cursor};
     }
+    Text() = default;
+    Text(const char* file);
+    Text& operator=(Text&&);
+    Text(Text&&);
+    ~Text();
+    // writes a temporary file next to filename and renames it over filename, blocks until that is done
+    void save(const char* filename) const;
+    // the same without blocking, the text can be edited meanwhile, done(saved) is called from the writer thread
+    void saveInBackground(const char* filename, Snapshot::Done done = nullptr) const;
+    void load(const char* filename);
+    void print() const;
     void insert(char c);
-    void insert(const char* string);
-    void print();
-    // void moveRel();
-    Rope::Iterator getView(int startLine, int lineCount) const;
+    void insert(const char* str);
+    void insert(const char* str, size_t len);
+    // removes [from, to), the cursor moves to from
+    void erase(size_t from, size_t to);
+    // replaces [from, to) with len bytes of str, the cursor ends up behind them
+    void replace(size_t from, size_t to, const char* str, size_t len);
+    void del(bool wordWise = false);
+    void backspace(bool wordWise = false);
+    // the same edit at many cursors in one pass over the file, undone as one step. cursors has to be sorted,
+    // every cursor moves behind its edit, cursors whose edits overlap end up at the same position
+    void insert(std::vector<size_t>& cursors, const char* str, size_t len);
+    void backspace(std::vector<size_t>& cursors, bool wordWise = false);
+    void del(std::vector<size_t>& cursors, bool wordWise = false);
+    // revert or repeat the last edit, false if there is none
+    bool undo();
+    bool redo();
+    // bytes held by the undo log
+    size_t getHistoryMemory() const;
+    void left(bool wordWise = false);
+    void right(bool wordWise = false);
+    void up(ssize_t inLineOffset);
+    void down(ssize_t inLineOffset);
+    ssize_t home();
+    void ende();
+    size_t getFileSize() const;
+    size_t getLineCount() const;
+    // the rope always knows all lines, this is the same as getLineCount()
+    size_t getIndexedLineCount() const;
+    // line if it exists, otherwise the last line
+    size_t clampLine(size_t line) const;
+    // the rope always reads the whole file
+    bool isMapped() const;
+    // the line containing pos, a '\n' belongs to the line it ends
+    size_t lineOf(size_t pos) const;
+    size_t lineStart(size_t line) const;
+    // position of the '\n' ending the line or the file size for the last line
+    size_t lineEnd(size_t line) const;
+    // display column of pos in its line, tabs count 4 and utf8 characters 1
+    size_t columnOf(size_t pos) const;
+    // the first position in line at or after the given display column, or the end of the line
+    size_t posAtColumn(size_t line, size_t column) const;
+    // total number of bytes this Text has memmoved so far, for benchmarks
+    size_t getBytesMoved() const;
+    // the bytes of [from, to) where they are, one span per leaf, valid until the next edit
+    using Spans = std::vector<std::string_view>;
+    Spans spans(size_t from, size_t to) const;
+    // the run of word characters, spaces or other characters at pos, or in front of it at the end of a line
+    std::pair<size_t, size_t> wordAt(size_t pos) const;
+    // highlighting starts over in language, PLAIN turns it off
+    void setLanguage(Highlighter::Language language);
+    // the highlighted runs of line, starting at offsets into the line, empty without a language.
+    // Valid until the next call or edit.
+    const Highlighter::Tokens& tokens(size_t line) const;
+    // the first line whose highlighting changed since the last call other than by an edit to it, SIZE_MAX if none did
+    size_t takeRecolored() const;
+    // keeps content, which was made from spans(0, getFileSize()) of a non-empty Text, instead of the rope.
+    // The rope holds the line index too, until decompress() nothing but the history may be used.
+    void store(Compressed&& content);
+    // puts the content back if it was stored compressed
+    void decompress();
+    bool isCompressed() const;
+    void moveTo(ssize_t new_position);
+    void beginning();
+    void ending();
+    // the starts of all matches of needle in order, large files are searched on several threads
+    std::vector<size_t> findAll(std::string_view needle) const;
+    // the first match of needle at or after from, getFileSize() if there is none
+    size_t findNext(std::string_view needle, size_t from) const;
+    // drops the matches at which needle doesn't match, for a query that got longer while typing it
+    void refine(std::vector<size_t>& matches, std::string_view needle) const;
+    // the matches of regex in order, no match spans a line
+    std::vector<Regex::Match> findAll(const Regex& regex) const;
     private:
-    // char* buffer;
-    // size_t bufferSize;
-    uint64_t cursor;
+    // replace() without recording it in history
+    void splice(size_t from, size_t to, const char* str, size_t len);
+    void edit(size_t from, size_t to, const char* str, size_t len, bool backspace);
+    // the edits of the ranges [first, second), see insert(cursors, ...)
+    void editAll(std::vector<size_t>& cursors, const std::vector<std::pair<size_t, size_t>>& ranges, const char* str, size_t len, bool backspace);
+    // the rope has no gap, edits cost the same everywhere
+    size_t gapPosition() const {
+        return 0;
+    }
+    // where left() and right() would move pos to
+    size_t stepLeft(size_t pos, bool wordWise) const;
+    size_t stepRight(size_t pos, bool wordWise) const;
+    // segments() for the Finder
+    Finder::Segments pieces() const;
+    char at(size_t pos) const;
+    bool isLastLine(size_t line) const;
+    size_t columnsIn(size_t from, size_t to) const;
+    // [from, to) is about to be replaced with len bytes of str, the highlighter is told which lines change
+    void highlightEdit(size_t from, size_t to, const char* str, size_t len);
+    template <typename F>
+    void segments(size_t from, size_t to, F&& f) const {
+        rope.segments(from, to, f);
+    }
+    // moving the cursor is free, edits go to the rope at the cursor
+    size_t cursor = 0;
     Rope rope;
+    // the content while the tab is in the background, see store()
+    Compressed compressed;
+    History history;
+    mutable Highlighter highlighter;
+    mutable std::vector<std::shared_ptr<Snapshot>> saves;
 };
 
 #else 
+#include <algorithm>
+#include <array>
+#include <string_view>
 #include <utility>
+#include "columnindex.hpp"
+#include "lineindex.hpp"
 
 extern const char* untitled;
 
@@ -187,12 +217,13 @@ class Text{
     class Iterator{
         const char* base = 0;
         size_t gapSize = 0;
+        size_t gapStart = 0;
         public:
         size_t pos = 0;
         size_t cursorPos = 0;
         Iterator() = default;
-        Iterator(char* buffer, size_t pos, size_t gap, size_t cursor)
-         : base(buffer), gapSize(gap), pos(pos), cursorPos(cursor)
+        Iterator(char* buffer, size_t pos, size_t gapSize, size_t gapStart, size_t cursor)
+         : base(buffer), gapSize(gapSize), gapStart(gapStart), pos(pos), cursorPos(cursor)
         {}
         Iterator& operator++() {
             pos++;
@@ -208,7 +239,7 @@ class Text{
             return *this;
         }
         char operator*() const {
-            return *(base + pos + gapSize * (pos >= cursorPos));
+            return *(base + pos + gapSize * (pos >= gapStart));
         }
         inline bool operator==(const Iterator& rhs) const {
             return base == rhs.base && pos == rhs.pos;
@@ -219,40 +250,172 @@ class Text{
     };
     static_assert(std::is_trivially_copyable_v<Iterator>);
     Iterator begin() const {
-        return {buffer, 0, bufferSize-fileSize, cursor};
+        return {buffer, 0, bufferSize-fileSize, gap, cursor};
     }
     Iterator end() const {
-        return {buffer, fileSize, bufferSize-fileSize, cursor};
+        return {buffer, fileSize, bufferSize-fileSize, gap, cursor};
     }
+    // files of at least this size are mmapped instead of read
+    static constexpr size_t mapThreshold = 16 << 20;
     Text();
     Text(const char* file);
     Text& operator=(Text&&);
     Text(Text&&);
     ~Text();
+    // writes a temporary file next to filename and renames it over filename, blocks until that is done
     void save(const char* filename) const;
+    // the same without blocking, the text can be edited meanwhile, done(saved) is called from the writer thread
+    void saveInBackground(const char* filename, Snapshot::Done done = nullptr) const;
     void load(const char* filename);
     void print() const;
     void insert(char c);
     void insert(const char* str);
+    void insert(const char* str, size_t len);
+    // removes [from, to), the cursor moves to from
+    void erase(size_t from, size_t to);
+    // replaces [from, to) with len bytes of str, the cursor ends up behind them
+    void replace(size_t from, size_t to, const char* str, size_t len);
     void del(bool wordWise = false);
     void backspace(bool wordWise = false);
+    // the same edit at many cursors in one pass over the file, undone as one step. cursors has to be sorted,
+    // every cursor moves behind its edit, cursors whose edits overlap end up at the same position
+    void insert(std::vector<size_t>& cursors, const char* str, size_t len);
+    void backspace(std::vector<size_t>& cursors, bool wordWise = false);
+    void del(std::vector<size_t>& cursors, bool wordWise = false);
+    // revert or repeat the last edit, false if there is none
+    bool undo();
+    bool redo();
+    // bytes held by the undo log
+    size_t getHistoryMemory() const;
     void left(bool wordWise = false);
     void right(bool wordWise = false);
-    void up(std::vector<ssize_t>& newLines, ssize_t inLineOffset);
-    void down(std::vector<ssize_t>& newLines, ssize_t inLineOffset);
-    ssize_t home(std::vector<ssize_t>& newLines);
-    void ende(std::vector<ssize_t>& newLines);
+    void up(ssize_t inLineOffset);
+    void down(ssize_t inLineOffset);
+    ssize_t home();
+    void ende();
     size_t getFileSize() const;
+    // indexes the whole file, which reads all of it if it is mmapped
+    size_t getLineCount() const;
+    // the lines found so far, the same as getLineCount() once everything was indexed
+    size_t getIndexedLineCount() const;
+    // line if it exists, otherwise the last line
+    size_t clampLine(size_t line) const;
+    bool isMapped() const;
+    // the line containing pos, a '\n' belongs to the line it ends
+    size_t lineOf(size_t pos) const;
+    size_t lineStart(size_t line) const;
+    // position of the '\n' ending the line or the file size for the last line
+    size_t lineEnd(size_t line) const;
+    // display column of pos in its line, tabs count 4 and utf8 characters 1
+    size_t columnOf(size_t pos) const;
+    // the first position in line at or after the given display column, or the end of the line
+    size_t posAtColumn(size_t line, size_t column) const;
+    // total number of bytes this Text has memmoved so far, for benchmarks
+    size_t getBytesMoved() const;
+    // the bytes of [from, to) where they are, in front of and behind the gap, valid until the next edit.
+    // Nothing is copied and the gap doesn't move, the second span is empty if the range is on one side.
+    using Spans = std::array<std::string_view, 2>;
+    Spans spans(size_t from, size_t to) const;
+    // the run of word characters, spaces or other characters at pos, or in front of it at the end of a line
+    std::pair<size_t, size_t> wordAt(size_t pos) const;
+    // highlighting starts over in language, PLAIN turns it off
+    void setLanguage(Highlighter::Language language);
+    // the highlighted runs of line, starting at offsets into the line, empty without a language.
+    // Valid until the next call or edit.
+    const Highlighter::Tokens& tokens(size_t line) const;
+    // the first line whose highlighting changed since the last call other than by an edit to it, SIZE_MAX if none did
+    size_t takeRecolored() const;
+    // keeps content, which was made from spans(0, getFileSize()) of a non-empty Text, instead of the buffer.
+    // The line index stays, until decompress() only the sizes, the line counts and the history may be used.
+    void store(Compressed&& content);
+    // puts the content back if it was stored compressed, the gap ends up at the end of the file
+    void decompress();
+    bool isCompressed() const;
     void moveTo(ssize_t new_position);
     void beginning();
     void ending();
+    // the starts of all matches of needle in order, large files are searched on several threads
+    std::vector<size_t> findAll(std::string_view needle) const;
+    // the first match of needle at or after from, getFileSize() if there is none
+    size_t findNext(std::string_view needle, size_t from) const;
+    // drops the matches at which needle doesn't match, for a query that got longer while typing it
+    void refine(std::vector<size_t>& matches, std::string_view needle) const;
+    // the matches of regex in order, no match spans a line
+    std::vector<Regex::Match> findAll(const Regex& regex) const;
     // void moveRel();
     std::pair<Iterator, Iterator> getView(int startLine, int lineCount) const;
     private:
+    void shift(char* to, const char* from, size_t n);
+    // makes the gap at least len bytes large
+    void grow(size_t len);
+    // gives memory back if the gap got much larger than growing would make it
+    void shrink();
+    void moveGap(size_t pos);
+    // moves a gap of whole pages of a mapped file forward to the page boundary to by remapping the pages
+    // behind it, as far as the kernel lets it
+    void remapGap(size_t to);
+    // replace() without recording it in history
+    void splice(size_t from, size_t to, const char* str, size_t len);
+    void edit(size_t from, size_t to, const char* str, size_t len, bool backspace);
+    // the edits of the ranges [first, second), see insert(cursors, ...)
+    void editAll(std::vector<size_t>& cursors, const std::vector<std::pair<size_t, size_t>>& ranges, const char* str, size_t len, bool backspace);
+    // edits are cheapest where the gap already is
+    size_t gapPosition() const {
+        return gap;
+    }
+    // segments() for the Finder
+    Finder::Segments pieces() const;
+    // bytes [from, from+len) of buffer are about to be overwritten, running saves copy what they still need
+    void preserve(const char* from, size_t len);
+    // some save didn't finish yet and may read from buffer
+    bool isSaving() const;
+    // where left() and right() would move pos to
+    size_t stepLeft(size_t pos, bool wordWise) const;
+    size_t stepRight(size_t pos, bool wordWise) const;
+    bool map(const char* file);
+    void release();
+    // frees the buffer, or leaves it to the saves that still read from it
+    void dropBuffer();
+    // mmapped files are indexed lazily, lines only covers [0, indexed)
+    void ensureIndexed(size_t pos) const;
+    // indexes until line is known to be complete or the file ends
+    void ensureLine(size_t line) const;
+    bool isLastLine(size_t line) const;
+    void indexInserted(size_t pos, const char* content, size_t len);
+    void indexErased(size_t pos, size_t len);
+    char at(size_t pos) const;
+    size_t columnsIn(size_t from, size_t to) const;
+    // [from, to) is about to be replaced with len bytes of str, the highlighter is told which lines change
+    void highlightEdit(size_t from, size_t to, const char* str, size_t len);
+    // calls f(pointer, length) for the (up to two) contiguous pieces of [from, to)
+    template <typename F>
+    void segments(size_t from, size_t to, F&& f) const {
+        if (from < gap && from < to) {
+            f(buffer+from, std::min<size_t>(to, gap)-from);
+        }
+        if (to > gap && from < to) {
+            const size_t start = std::max<size_t>(from, gap);
+            f(buffer+start+bufferSize-fileSize, to-start);
+        }
+    }
     char* buffer = nullptr;
     size_t bufferSize = 0;
     uint64_t cursor = 0;
+    // the gap starts here, it only follows the cursor when something is edited
+    size_t gap = 0;
     size_t fileSize = 0;
+    size_t bytesMoved = 0;
+    // size of the whole mapping if buffer was mmapped, 0 if it was malloced
+    size_t mappedSize = 0;
+    mutable size_t indexed = 0;
+    mutable LineIndex lines;
+    mutable ColumnIndex columns;
+    // the content while the tab is in the background, see store()
+    Compressed compressed;
+    History history;
+    mutable Highlighter highlighter;
+    // saves that may still read from buffer
+    mutable std::vector<std::shared_ptr<Snapshot>> saves;
 };
 
 #endif
@@ -0,0 +1,92 @@
+#include "tilecache.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <utility>
+
+// the bits of the rows in front of row
+static constexpr uint32_t rowsBefore(size_t row) {
+    return row >= 32 ? ~0u : (1u << row)-1;
+}
+
+TileCache::TileCache(TileCache&& moveFrom) {
+    *this = std::move(moveFrom);
+}
+
+TileCache& TileCache::operator=(TileCache&& moveFrom) {
+    tiles.swap(moveFrom.tiles);
+    std::swap(owner, moveFrom.owner);
+    std::swap(width, moveFrom.width);
+    std::swap(rowHeight, moveFrom.rowHeight);
+    std::swap(clock, moveFrom.clock);
+    return *this;
+}
+
+TileCache::~TileCache() {
+    clear();
+}
+
+void TileCache::clear() {
+    for (Tile& tile : tiles) {
+        SDL_DestroyTexture(tile.texture);
+    }
+    tiles.clear();
+    owner = nullptr;
+}
+
+void TileCache::resize(SDL_Renderer* renderer, int newWidth, int newRowHeight) {
+    if (renderer == owner && newWidth == width && newRowHeight == rowHeight) {
+        return;
+    }
+    clear();
+    // tile() hands out pointers into it
+    tiles.reserve(maxTiles);
+    owner = renderer;
+    width = newWidth;
+    rowHeight = newRowHeight;
+}
+
+TileCache::Tile* TileCache::tile(SDL_Renderer* renderer, size_t line) {
+    resize(renderer, width, rowHeight);
+    const ssize_t first = line - line%linesPerTile;
+    Tile* found = nullptr;
+    for (Tile& tile : tiles) {
+        if (tile.first == first) {
+            found = &tile;
+            break;
+        }
+    }
+    if (!found) {
+        if (tiles.size() < maxTiles) {
+            if (width <= 0 || rowHeight <= 0) {
+                return nullptr;
+            }
+            SDL_Texture* texture = SDL_CreateTexture(
+                renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_TARGET, width, rowHeight*linesPerTile
+            );
+            SDL_CHK(!!texture);
+            // the tiles are opaque, copying them replaces what was there
+            SDL_CHK(SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_NONE));
+            SDL_CHK(SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST));
+            found = &tiles.emplace_back(Tile{texture});
+        } else {
+            found = &*std::min_element(tiles.begin(), tiles.end(), [](const Tile& a, const Tile& b) {
+                return a.used < b.used;
+            });
+        }
+        found->first = first;
+        found->stale = rowsBefore(linesPerTile);
+    }
+    found->used = ++clock;
+    return found;
+}
+
+void TileCache::invalidate(ssize_t first, ssize_t last) {
+    for (Tile& tile : tiles) {
+        if (tile.first < 0 || last < tile.first || first >= tile.first+static_cast<ssize_t>(linesPerTile)) {
+            continue;
+        }
+        const size_t from = std::max<ssize_t>(first-tile.first, 0);
+        const size_t to = std::min<ssize_t>(last-tile.first, linesPerTile-1);
+        tile.stale |= rowsBefore(to+1) & ~rowsBefore(from);
+    }
+}
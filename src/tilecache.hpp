@@ -0,0 +1,52 @@
+#pragma once
+
+#include <SDL3/SDL.h>
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+#include <vector>
+
+// The text area as strips of linesPerTile lines, every strip a texture that keeps what was drawn into it.
+// A tile belongs to the lines it shows, not to a place on the screen, so scrolling copies the tiles that are
+// still visible to their new place and only draws the lines that came into view. An edit makes the rows of
+// the lines it touched stale, a row is drawn again when it is stale and visible. The least recently used
+// tile is taken for lines that have none.
+class TileCache{
+    public:
+    static constexpr size_t linesPerTile = 16;
+    // a few screens, scrolling back and forth within them draws nothing
+    static constexpr size_t maxTiles = 16;
+    struct Tile{
+        SDL_Texture* texture = nullptr;
+        // a multiple of linesPerTile, -1 while the tile holds nothing
+        ssize_t first = -1;
+        // bit i is set if line first+i has to be drawn again
+        uint32_t stale = 0;
+        uint64_t used = 0;
+    };
+    static_assert(linesPerTile <= 32, "the stale rows are bits of a uint32_t");
+    TileCache() = default;
+    TileCache(TileCache&&);
+    TileCache& operator=(TileCache&&);
+    TileCache(const TileCache&) = delete;
+    TileCache& operator=(const TileCache&) = delete;
+    ~TileCache();
+    // tiles are width pixels wide and have rows rowHeight pixels high, a different size drops all of them
+    void resize(SDL_Renderer* renderer, int width, int rowHeight);
+    // the tile that holds line, every row of it is stale if it didn't have one. nullptr if the tiles have no size yet.
+    // It stays where it is until the next resize(), only the least recently used tile is given to other lines.
+    Tile* tile(SDL_Renderer* renderer, size_t line);
+    // the rows of the lines [first, last] are drawn again
+    void invalidate(ssize_t first, ssize_t last);
+    // drops the textures
+    void clear();
+    int getRowHeight() const {
+        return rowHeight;
+    }
+    private:
+    std::vector<Tile> tiles{};
+    SDL_Renderer* owner = nullptr;
+    int width = 0;
+    int rowHeight = 0;
+    uint64_t clock = 0;
+};
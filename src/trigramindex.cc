@@ -0,0 +1,446 @@
+#include "trigramindex.hpp"
+#include "folderwalk.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <future>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+static constexpr char magic[8] = {'t', 'e', 't', 'r', 'i', '0', '1', '\n'};
+
+static int64_t modifiedOf(const struct stat& st) {
+    return st.st_mtim.tv_sec*1'000'000'000ll + st.st_mtim.tv_nsec;
+}
+
+static uint32_t trigramAt(const char* data) {
+    return static_cast<uint8_t>(data[0]) << 16 | static_cast<uint8_t>(data[1]) << 8 | static_cast<uint8_t>(data[2]);
+}
+
+TrigramIndex::TrigramIndex(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+        close(fd);
+        return;
+    }
+    void* region = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        return;
+    }
+    base = static_cast<const char*>(region);
+    length = st.st_size;
+    const Header* h = reinterpret_cast<const Header*>(base);
+    // everything has to be where the header says, the rest is trusted
+    const bool valid = !memcmp(h->magic, magic, sizeof(magic)) && h->size == length
+        && h->filesAt % alignof(File) == 0 && h->trigramsAt % alignof(Trigram) == 0
+        && h->filesAt <= length && h->files <= (length-h->filesAt) / sizeof(File)
+        && h->pathsAt <= length && h->postingsAt <= length
+        && h->trigramsAt <= length && h->trigrams <= (length-h->trigramsAt) / sizeof(Trigram);
+    if (!valid) {
+        return;
+    }
+    header = h;
+    files = reinterpret_cast<const File*>(base+h->filesAt);
+    trigrams = reinterpret_cast<const Trigram*>(base+h->trigramsAt);
+    byPath.reserve(h->files);
+    for (uint32_t id = 0; id < h->files; id++) {
+        byPath.emplace(pathOf(files[id]), id);
+    }
+}
+
+TrigramIndex::~TrigramIndex() {
+    if (base) {
+        munmap(const_cast<char*>(base), length);
+    }
+}
+
+std::vector<uint32_t> TrigramIndex::postings(const Trigram& trigram) const {
+    std::vector<uint32_t> ids;
+    ids.reserve(trigram.count);
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(base+header->postingsAt+trigram.postings);
+    const uint8_t* end = reinterpret_cast<const uint8_t*>(base+length);
+    uint32_t id = 0;
+    for (uint32_t i = 0; i < trigram.count; i++) {
+        uint32_t delta = 0;
+        for (int shift = 0; in < end; shift += 7) {
+            delta |= (*in & 0x7F) << shift;
+            if (!(*in++ & 0x80)) {
+                break;
+            }
+        }
+        // the first one is the id plus 1
+        id += delta;
+        if (id-1 >= header->files) {
+            break;
+        }
+        ids.push_back(id-1);
+    }
+    return ids;
+}
+
+std::vector<bool> TrigramIndex::candidates(std::string_view query, bool regex) const {
+    std::vector<bool> candidate(getFileCount());
+    if (!header) {
+        return candidate;
+    }
+    const std::vector<uint32_t> needed = trigramsOf(query, regex);
+    if (needed.empty()) {
+        candidate.assign(getFileCount(), true);
+    } else {
+        std::vector<const Trigram*> lists;
+        for (const uint32_t trigram : needed) {
+            const Trigram* end = trigrams+header->trigrams;
+            const Trigram* at = std::lower_bound(trigrams, end, trigram, [](const Trigram& t, uint32_t value) {
+                return t.trigram < value;
+            });
+            if (at == end || at->trigram != trigram) {
+                // no indexed file has it
+                lists.clear();
+                break;
+            }
+            lists.push_back(at);
+        }
+        // the shortest lists first, the intersection only gets shorter
+        std::sort(lists.begin(), lists.end(), [](const Trigram* a, const Trigram* b) {
+            return a->count < b->count;
+        });
+        std::vector<uint32_t> ids;
+        for (size_t i = 0; i < lists.size(); i++) {
+            const std::vector<uint32_t> list = postings(*lists[i]);
+            if (!i) {
+                ids = list;
+                continue;
+            }
+            std::vector<uint32_t> both;
+            std::set_intersection(ids.begin(), ids.end(), list.begin(), list.end(), std::back_inserter(both));
+            ids.swap(both);
+            if (ids.empty()) {
+                break;
+            }
+        }
+        for (const uint32_t id : ids) {
+            candidate[id] = true;
+        }
+    }
+    for (uint32_t id = 0; id < getFileCount(); id++) {
+        if (files[id].flags & UNINDEXED) {
+            // nothing is known about the content of these
+            candidate[id] = true;
+        } else if (files[id].flags & BINARY) {
+            candidate[id] = false;
+        }
+    }
+    return candidate;
+}
+
+static bool isSame(const TrigramIndex::File& file, const struct stat& st) {
+    return file.size == static_cast<uint64_t>(st.st_size) && file.modified == modifiedOf(st);
+}
+
+bool TrigramIndex::skips(const std::vector<bool>& candidates, const std::string& path, const struct stat& st) const {
+    const auto id = byPath.find(path);
+    return id != byPath.end() && id->second < candidates.size() && !candidates[id->second] && isSame(files[id->second], st);
+}
+
+std::vector<uint32_t> TrigramIndex::trigramsOf(std::string_view query, bool regex) {
+    // the runs of bytes every match contains
+    std::vector<std::string> runs(1);
+    if (!regex) {
+        runs[0] = query;
+    } else if (query.find('|') == std::string_view::npos) {
+        size_t depth = 0;
+        for (size_t i = 0; i < query.size(); i++) {
+            const char c = query[i];
+            const bool quantified = i+1 < query.size() && (query[i+1] == '*' || query[i+1] == '?' || query[i+1] == '{');
+            if (c == '\\' && i+1 < query.size()) {
+                const char escaped = query[++i];
+                const bool alike = i+1 < query.size() && (query[i+1] == '*' || query[i+1] == '?' || query[i+1] == '{');
+                // \d, \w, \s and the like are classes
+                if (!depth && !alike && !isalnum(static_cast<unsigned char>(escaped))) {
+                    runs.back() += escaped;
+                } else {
+                    runs.emplace_back();
+                }
+            } else if (c == '[') {
+                // a class, ] right at the start belongs to it
+                i += i+1 < query.size() && query[i+1] == '^';
+                i += i+1 < query.size() && query[i+1] == ']';
+                while (i+1 < query.size() && query[++i] != ']') {
+                    i += query[i] == '\\';
+                }
+                runs.emplace_back();
+            } else if (c == '(') {
+                depth++;
+                runs.emplace_back();
+            } else if (c == ')') {
+                depth -= depth > 0;
+                runs.emplace_back();
+            } else if (c == '{') {
+                while (i+1 < query.size() && query[++i] != '}') {}
+                runs.emplace_back();
+            } else if (c == '+') {
+                // the byte in front is there at least once, what follows may come after more of it
+                runs.emplace_back();
+            } else if (c == '.' || c == '^' || c == '$' || c == '*' || c == '?' || quantified || depth) {
+                runs.emplace_back();
+            } else {
+                runs.back() += c;
+            }
+        }
+    }
+    std::vector<uint32_t> needed;
+    for (const std::string& run : runs) {
+        for (size_t i = 0; i+3 <= run.size(); i++) {
+            needed.push_back(trigramAt(run.data()+i));
+        }
+    }
+    std::sort(needed.begin(), needed.end());
+    needed.erase(std::unique(needed.begin(), needed.end()), needed.end());
+    return needed;
+}
+
+// a posting list while it is built, the ids are appended in order
+struct Posting{
+    std::string bytes;
+    uint32_t last = 0;
+    uint32_t count = 0;
+    void append(uint32_t id) {
+        // the first delta is from -1
+        uint32_t delta = id+1-last;
+        last = id+1;
+        count++;
+        while (delta >= 0x80) {
+            bytes += static_cast<char>(delta | 0x80);
+            delta >>= 7;
+        }
+        bytes += static_cast<char>(delta);
+    }
+};
+
+// what the index knows about a file while it is built
+struct Indexed{
+    std::string path;
+    uint64_t size;
+    int64_t modified;
+    uint32_t flags;
+};
+
+// the directories of path that don't exist yet
+static void makeParents(const std::string& path) {
+    for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash+1)) {
+        mkdir(path.substr(0, slash).c_str(), 0755);
+    }
+}
+
+static bool writeIndex(const std::string& path, const std::vector<Indexed>& indexed, const std::unordered_map<uint32_t, Posting>& postings) {
+    std::vector<uint32_t> order;
+    order.reserve(postings.size());
+    for (const auto& [trigram, posting] : postings) {
+        order.push_back(trigram);
+    }
+    std::sort(order.begin(), order.end());
+    TrigramIndex::Header header{};
+    memcpy(header.magic, magic, sizeof(magic));
+    header.files = indexed.size();
+    header.trigrams = order.size();
+    header.filesAt = sizeof(header);
+    header.trigramsAt = header.filesAt + indexed.size()*sizeof(TrigramIndex::File);
+    header.pathsAt = header.trigramsAt + order.size()*sizeof(TrigramIndex::Trigram);
+    size_t paths = 0;
+    std::vector<TrigramIndex::File> files;
+    files.reserve(indexed.size());
+    for (const Indexed& file : indexed) {
+        files.push_back({file.size, file.modified, paths, static_cast<uint32_t>(file.path.size()), file.flags});
+        paths += file.path.size();
+    }
+    header.postingsAt = header.pathsAt + paths;
+    std::vector<TrigramIndex::Trigram> trigrams;
+    trigrams.reserve(order.size());
+    size_t bytes = 0;
+    for (const uint32_t trigram : order) {
+        const Posting& posting = postings.at(trigram);
+        trigrams.push_back({trigram, posting.count, bytes});
+        bytes += posting.bytes.size();
+    }
+    header.size = header.postingsAt + bytes;
+
+    makeParents(path);
+    // a search that has the old one mapped keeps it until it is done
+    const std::string temporary = path + ".tmp";
+    FILE* f = fopen(temporary.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, f) == 1;
+    written &= fwrite(files.data(), sizeof(files[0]), files.size(), f) == files.size();
+    written &= fwrite(trigrams.data(), sizeof(trigrams[0]), trigrams.size(), f) == trigrams.size();
+    for (const Indexed& file : indexed) {
+        written &= fwrite(file.path.data(), 1, file.path.size(), f) == file.path.size();
+    }
+    for (const uint32_t trigram : order) {
+        const std::string& list = postings.at(trigram).bytes;
+        written &= fwrite(list.data(), 1, list.size(), f) == list.size();
+    }
+    written &= !fclose(f);
+    if (!written || rename(temporary.c_str(), path.c_str())) {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// waits for the walk to call done, stops it early if stop is set
+static bool waitFor(FolderWalk& walk, std::future<void>& done, const std::atomic<bool>& stop) {
+    while (done.wait_for(std::chrono::milliseconds(10)) != std::future_status::ready) {
+        if (stop) {
+            walk.stop();
+            done.wait();
+            return false;
+        }
+    }
+    return !stop;
+}
+
+bool TrigramIndex::compare(
+    const std::string& folder, std::vector<uint32_t>& kept, std::vector<std::string>& changed, const std::atomic<bool>& stop
+) const {
+    std::mutex mutex;
+    std::promise<void> walked;
+    std::future<void> done = walked.get_future();
+    FolderWalk listing(folder, [&](FolderWalk& walk, const std::string& file) {
+        struct stat st;
+        if (stat((walk.getPrefix()+file).c_str(), &st)) {
+            return;
+        }
+        const auto id = byPath.find(file);
+        const bool same = id != byPath.end() && isSame(files[id->second], st);
+        std::lock_guard lock(mutex);
+        if (same) {
+            kept.push_back(id->second);
+        } else {
+            changed.push_back(file);
+        }
+    }, [&] {
+        walked.set_value();
+    });
+    if (!waitFor(listing, done, stop)) {
+        return false;
+    }
+    std::sort(kept.begin(), kept.end());
+    return true;
+}
+
+bool TrigramIndex::update(const std::string& folder, const std::string& path, const std::atomic<bool>& stop) {
+    const TrigramIndex old(path);
+    // which files there are and which of them changed, only looking at their size and modification time
+    std::mutex mutex;
+    std::vector<uint32_t> kept;
+    std::vector<std::string> changed;
+    if (!old.compare(folder, kept, changed, stop)) {
+        return false;
+    }
+
+    // the files that stayed the same come first in their old order, so their ids go up like before
+    std::vector<uint32_t> remap(old.getFileCount(), UINT32_MAX);
+    std::vector<Indexed> indexed;
+    indexed.reserve(kept.size()+changed.size());
+    for (const uint32_t id : kept) {
+        remap[id] = indexed.size();
+        const File& file = old.files[id];
+        indexed.push_back({std::string(old.pathOf(file)), file.size, file.modified, file.flags});
+    }
+    std::unordered_map<uint32_t, Posting> postings;
+    for (size_t i = 0; i < (old.isOpen() ? old.header->trigrams : 0); i++) {
+        Posting* posting = nullptr;
+        for (const uint32_t id : old.postings(old.trigrams[i])) {
+            if (remap[id] == UINT32_MAX) {
+                continue;
+            }
+            if (!posting) {
+                posting = &postings[old.trigrams[i].trigram];
+            }
+            posting->append(remap[id]);
+        }
+    }
+
+    // the ones that changed are read, a file gets its id when its trigrams are added so every list stays in order
+    {
+        std::promise<void> read;
+        std::future<void> done = read.get_future();
+        FolderWalk reading(folder, changed, [&](FolderWalk& walk, const std::string& file) {
+            const MappedFile mapped(walk.getPrefix()+file);
+            const struct stat& st = mapped.getStat();
+            if (!S_ISREG(st.st_mode)) {
+                return;
+            }
+            uint32_t flags = 0;
+            if (mapped.size() > maxIndexed) {
+                flags = UNINDEXED;
+            } else if (mapped.size() && mapped.isBinary()) {
+                flags = BINARY;
+            }
+            // bit t of seen is set once trigram t was found in the file
+            thread_local std::vector<uint64_t> seen(1 << 18);
+            std::vector<uint32_t> found;
+            const char* data = mapped.data();
+            for (size_t i = 0; !flags && i+3 <= mapped.size(); i++) {
+                const uint32_t trigram = trigramAt(data+i);
+                uint64_t& word = seen[trigram >> 6];
+                if (!(word & 1ull << (trigram & 63))) {
+                    word |= 1ull << (trigram & 63);
+                    found.push_back(trigram);
+                }
+            }
+            for (const uint32_t trigram : found) {
+                seen[trigram >> 6] = 0;
+            }
+            std::lock_guard lock(mutex);
+            const uint32_t id = indexed.size();
+            indexed.push_back({file, static_cast<uint64_t>(st.st_size), modifiedOf(st), flags});
+            for (const uint32_t trigram : found) {
+                postings[trigram].append(id);
+            }
+        }, [&] {
+            read.set_value();
+        });
+        if (!waitFor(reading, done, stop)) {
+            return false;
+        }
+    }
+    return writeIndex(path, indexed, postings);
+}
+
+std::string TrigramIndex::pathFor(const std::string& folder) {
+    std::string absolute = folder;
+    if (char* resolved = realpath(folder.empty() ? "." : folder.c_str(), nullptr)) {
+        absolute = resolved;
+        free(resolved);
+    }
+    // FNV-1a of the folder names the index
+    uint64_t hash = 0xcbf29ce484222325;
+    for (const char c : absolute) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.trigrams", static_cast<unsigned long long>(hash));
+    std::string cache;
+    if (const char* xdg = getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+        cache = xdg;
+    } else if (const char* home = getenv("HOME")) {
+        cache = std::string(home) + "/.cache";
+    } else {
+        cache = "/tmp";
+    }
+    return cache + "/te/" + name;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <unordered_map>
+#include <vector>
+
+// The trigrams of the files below a folder in one file that is mapped and used as it is:
+// a Header, the Files with their size and modification time, their paths, the Trigrams in order and
+// their posting lists, the ids of the files a trigram occurs in as varint deltas.
+// A query only opens the files that contain every trigram its matches need.
+// update() writes a new index next to the old one and renames it over it. Files whose size and
+// modification time didn't change aren't read again, their ids are carried over from the old posting lists.
+// A search compares the files the same way while it walks the folder, the ones that changed since are searched
+// until an update has them.
+class TrigramIndex{
+    public:
+    // larger files aren't indexed, every query searches them
+    static constexpr size_t maxIndexed = 16 << 20;
+    struct Header{
+        char magic[8];
+        uint64_t files;
+        uint64_t trigrams;
+        // offsets into the index
+        uint64_t filesAt;
+        uint64_t pathsAt;
+        uint64_t trigramsAt;
+        uint64_t postingsAt;
+        uint64_t size;
+    };
+    enum FileFlags : uint32_t{
+        // too large, a candidate of every query
+        UNINDEXED = 1,
+        // never a candidate, FolderSearch skips it
+        BINARY = 2,
+    };
+    struct File{
+        uint64_t size;
+        // nanoseconds
+        int64_t modified;
+        // offset of the path relative to the folder from pathsAt
+        uint64_t path;
+        uint32_t pathLength;
+        uint32_t flags;
+    };
+    struct Trigram{
+        uint32_t trigram;
+        // files it occurs in
+        uint32_t count;
+        // offset of the posting list from postingsAt
+        uint64_t postings;
+    };
+    // maps the index at path, isOpen() is false if there is none or it is damaged
+    explicit TrigramIndex(const std::string& path);
+    TrigramIndex(const TrigramIndex&) = delete;
+    TrigramIndex& operator=(const TrigramIndex&) = delete;
+    ~TrigramIndex();
+    bool isOpen() const {
+        return header;
+    }
+    size_t getFileCount() const {
+        return header ? header->files : 0;
+    }
+    // for every id whether the file may have a match of the query, all of them if it needs no trigrams.
+    // Only looks at the index, the files on disk are compared by skips().
+    std::vector<bool> candidates(std::string_view query, bool regex) const;
+    // true for a file, relative to the folder, that the index has with the same size and modification time
+    // and that isn't one of the candidates. What isn't in the index or changed since has to be searched.
+    bool skips(const std::vector<bool>& candidates, const std::string& path, const struct stat& st) const;
+    // the trigrams every match of the query contains, sorted. A regular expression gives the ones of the
+    // literal runs outside of groups that aren't optional, none if it has a |.
+    static std::vector<uint32_t> trigramsOf(std::string_view query, bool regex);
+    // indexes the files below folder into path, only reading the ones that differ from the index there.
+    // Blocks until it is done, false if stop was set meanwhile or the index couldn't be written.
+    static bool update(const std::string& folder, const std::string& path, const std::atomic<bool>& stop);
+    // where the index of folder is kept, in the cache directory of the user
+    static std::string pathFor(const std::string& folder);
+    private:
+    // the ids of the indexed files below folder whose size and modification time are still the same, in order,
+    // and the files that aren't in the index or changed since. False if stop was set meanwhile.
+    bool compare(
+        const std::string& folder, std::vector<uint32_t>& kept, std::vector<std::string>& changed, const std::atomic<bool>& stop
+    ) const;
+    // the ids in the posting list of trigram, in order
+    std::vector<uint32_t> postings(const Trigram& trigram) const;
+    std::string_view pathOf(const File& file) const {
+        return std::string_view(base+header->pathsAt+file.path, file.pathLength);
+    }
+    const char* base = nullptr;
+    size_t length = 0;
+    const Header* header = nullptr;
+    const File* files = nullptr;
+    const Trigram* trigrams = nullptr;
+    // the id of every path
+    std::unordered_map<std::string_view, uint32_t> byPath;
+};
@@ -0,0 +1,51 @@
+#include "workerpool.hpp"
+#include <algorithm>
+
+WorkerPool::WorkerPool(size_t count) {
+    if (!count) {
+        count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        threads.emplace_back([this] {
+            work();
+        });
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+        jobs.clear();
+    }
+    available.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void WorkerPool::submit(Job job) {
+    {
+        std::lock_guard lock(mutex);
+        jobs.push_back(std::move(job));
+    }
+    available.notify_one();
+}
+
+void WorkerPool::work() {
+    std::unique_lock lock(mutex);
+    while (true) {
+        available.wait(lock, [&] {
+            return stopping || !jobs.empty();
+        });
+        if (stopping) {
+            return;
+        }
+        Job job = std::move(jobs.front());
+        jobs.pop_front();
+        lock.unlock();
+        job();
+        lock.lock();
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads running jobs in the order they were submitted.
+// Destroying the pool drops the jobs that didn't start yet and waits for the running ones.
+class WorkerPool{
+    public:
+    using Job = std::function<void()>;
+    // 0 threads means one per core
+    explicit WorkerPool(size_t threads = 0);
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    ~WorkerPool();
+    void submit(Job job);
+    private:
+    void work();
+    std::mutex mutex;
+    std::condition_variable available;
+    std::deque<Job> jobs;
+    std::vector<std::thread> threads;
+    bool stopping = false;
+};